@@ -14,6 +14,7 @@
 
 
 #include "SCL_Import.h"
+#include "TUN_MappedFile.h"
 
 
 
@@ -39,6 +40,29 @@ namespace TUN
 
 
 
+// Number conversion like atol() and atof(), but independent of the locale
+static long EvalLong(std::string_view sv)
+{
+	std::string_view::size_type	pos = 0;
+	long						lResult;
+	TUN::strx::Eval(sv, pos, lResult); // 0 on error
+	return lResult;
+}
+
+
+
+static double EvalDouble(std::string_view sv)
+{
+	std::string_view::size_type	pos = 0;
+	double						dblResult;
+	TUN::strx::Eval(sv, pos, dblResult); // 0 on error
+	return dblResult;
+}
+
+
+
+
+
 //////////////////////////////////////////////////////////////////////
 // Konstruktion/Destruktion
 //////////////////////////////////////////////////////////////////////
@@ -116,15 +140,24 @@ void CSCL_Import::ResetMapping()
 
 bool CSCL_Import::ReadKBM(const char * szFilepath)
 {
-	// Open the file
-	std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
-
-	if ( !ifstr )
-		return m_err.SetError("Error opening the file.");
-
 	// String which will receive the current line from the file
 	CStringParser	strparser;
-	strparser.InitStreamReading();
+
+	// Map the file, if possible. Otherwise open the file as a stream
+	CMappedFile		mf;
+	std::ifstream	ifstr;
+	if ( mf.Open(szFilepath) )
+		strparser.InitMemoryReading(mf.GetData(), mf.GetSize());
+	else
+	{
+		ifstr.open(szFilepath, std::ios_base::in | std::ios_base::binary);
+
+		if ( !ifstr )
+			return m_err.SetError("Error opening the file.");
+
+		strparser.InitStreamReading(true);
+		strparser.AttachStream(ifstr);
+	}
 
 	// Initialize data
 	// Important, because notes not listed in the tuning file
@@ -136,7 +169,7 @@ bool CSCL_Import::ReadKBM(const char * szFilepath)
 	m_strMappingName = m_strMappingName.substr(('\\' + m_strMappingName).find_last_of("/\\"));
 
 	// Read the file
-	bool	bResult = ReadKBM(ifstr, strparser);
+	bool	bResult = ReadKBM(strparser);
 
 	// Close the file
 	ifstr.close();
@@ -146,7 +179,7 @@ bool CSCL_Import::ReadKBM(const char * szFilepath)
 
 
 
-bool CSCL_Import::ReadKBM(std::istream & istr, CStringParser & strparser)
+bool CSCL_Import::ReadKBM(CStringParser & strparser)
 {
 	// IMPORTANT: ResetMapping is expected to be called before calling this function!
 
@@ -156,14 +189,14 @@ bool CSCL_Import::ReadKBM(std::istream & istr, CStringParser & strparser)
 	do
 	{
 		// Get next line
-		if ( !strparser.GetLineAndTrim(istr, m_lReadLineCount) )
+		if ( !strparser.GetLineAndTrim(m_lReadLineCount) )
 			return m_err.SetError("Premature end of file.", m_lReadLineCount);
 		// Skip empty lines and comments
-		if ( strparser.str().empty() || (strparser.str().at(0) == '!') )
+		if ( strparser.view().empty() || (strparser.view().front() == '!') )
 			continue;
 
-		long	lValue = atol(strparser.str().c_str());
-		double	dblValue = atof(strparser.str().c_str());
+		long	lValue = EvalLong(strparser.view());
+		double	dblValue = EvalDouble(strparser.view());
 		bool	bValueOK = true;
 
 		switch ( ++lSettingCounter )
@@ -205,19 +238,19 @@ bool CSCL_Import::ReadKBM(std::istream & istr, CStringParser & strparser)
 		m_lKeybMap[lEntryNumber] = -1;
 
 		// Get next line
-		if ( !strparser.GetLineAndTrim(istr, m_lReadLineCount) )
+		if ( !strparser.GetLineAndTrim(m_lReadLineCount) )
 			continue; // Premature end of file means 'x' for any missing entry
 		// Skip empty lines and comments
-		if ( strparser.str().empty() || (strparser.str().at(0) == '!') )
+		if ( strparser.view().empty() || (strparser.view().front() == '!') )
 		{
 			--lEntryNumber;
 			continue;
 		}
 
 		// Apply data
-		if ( TUN::strx::GetAsLower(strparser.str()).at(0) != 'x' )
+		if ( tolower(static_cast<unsigned char>(strparser.view().front())) != 'x' )
 		{
-			long	lScaleNoteIndex = atol(strparser.str().c_str());
+			long	lScaleNoteIndex = EvalLong(strparser.view());
 			m_lKeybMap[lEntryNumber] = RestrictMinMax(lScaleNoteIndex, 0, 127);
 		}
 	}
@@ -226,10 +259,10 @@ bool CSCL_Import::ReadKBM(std::istream & istr, CStringParser & strparser)
 	while ( true )
 	{
 		// Get next line
-		if ( !strparser.GetLineAndTrim(istr, m_lReadLineCount) )
+		if ( !strparser.GetLineAndTrim(m_lReadLineCount) )
 			break; // End of file reached
 		// Skip empty lines and comments
-		if ( strparser.str().empty() || (strparser.str().at(0) == '!') )
+		if ( strparser.view().empty() || (strparser.view().front() == '!') )
 			continue;
 		return m_err.SetError("End of file expected, but additional data found.", m_lReadLineCount);
 	}
@@ -241,15 +274,24 @@ bool CSCL_Import::ReadKBM(std::istream & istr, CStringParser & strparser)
 
 bool CSCL_Import::ReadSCL(const char * szFilepath)
 {
-	// Open the file
-	std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
-
-	if ( !ifstr )
-		return m_err.SetError("Error opening the file.");
-
 	// String which will receive the current line from the file
 	CStringParser	strparser;
-	strparser.InitStreamReading();
+
+	// Map the file, if possible. Otherwise open the file as a stream
+	CMappedFile		mf;
+	std::ifstream	ifstr;
+	if ( mf.Open(szFilepath) )
+		strparser.InitMemoryReading(mf.GetData(), mf.GetSize());
+	else
+	{
+		ifstr.open(szFilepath, std::ios_base::in | std::ios_base::binary);
+
+		if ( !ifstr )
+			return m_err.SetError("Error opening the file.");
+
+		strparser.InitStreamReading(true);
+		strparser.AttachStream(ifstr);
+	}
 
 	// Initialize data
 	// Important, because notes not listed in the tuning file
@@ -261,7 +303,7 @@ bool CSCL_Import::ReadSCL(const char * szFilepath)
 	m_strTuningName = m_strTuningName.substr(('\\' + m_strTuningName).find_last_of("/\\"));
 
 	// Read the file
-	bool	bResult = ReadSCL(ifstr, strparser);
+	bool	bResult = ReadSCL(strparser);
 
 	// Close the file
 	ifstr.close();
@@ -271,7 +313,7 @@ bool CSCL_Import::ReadSCL(const char * szFilepath)
 
 
 
-bool CSCL_Import::ReadSCL(std::istream & istr, CStringParser & strparser)
+bool CSCL_Import::ReadSCL(CStringParser & strparser)
 {
 	// IMPORTANT: ResetTuning is expected to be called before calling this function!
 
@@ -282,10 +324,10 @@ bool CSCL_Import::ReadSCL(std::istream & istr, CStringParser & strparser)
 	while ( true )
 	{
 		// Get next line
-		if ( !strparser.GetLineAndTrim(istr, m_lReadLineCount) )
+		if ( !strparser.GetLineAndTrim(m_lReadLineCount) )
 			break; // End of file reached
 		// Skip empty lines and comments
-		if ( strparser.str().empty() || (strparser.str().at(0) == '!') )
+		if ( strparser.view().empty() || (strparser.view().front() == '!') )
 			continue;
 
 		if ( !bNameRead )
@@ -304,7 +346,7 @@ bool CSCL_Import::ReadSCL(std::istream & istr, CStringParser & strparser)
 		if ( m_lScaleSize < 0 )
 		{
 			// Line contains number of tunes
-			m_lScaleSize = atol(strparser.str().c_str());
+			m_lScaleSize = EvalLong(strparser.view());
 			// Check number of notes. Must be from 1 to 127. Other tunings are rejected
 			if ( (m_lScaleSize < 1) || (m_lScaleSize > 127) )
 				return m_err.SetError("Scale size not allowed. Must be within [1;127].", m_lReadLineCount);
@@ -324,13 +366,15 @@ bool CSCL_Import::ReadSCL(std::istream & istr, CStringParser & strparser)
 		if ( (posMaybePeriod == std::string::npos) || (strparser.str().at(posMaybePeriod) != '.') )
 		{
 			// No period --> ratio
-			const char	* szCurr = strparser.str().c_str();
-			double	dblNumber1 = strtod(szCurr, const_cast<char **>(&szCurr));
-			while ( isspace(*szCurr) )
-				++szCurr;
-			if ( *szCurr == '/' )
+			std::string_view			svLine = strparser.view();
+			std::string_view::size_type	pos = 0;
+			double	dblNumber1;
+			TUN::strx::Eval(svLine, pos, dblNumber1);
+			while ( (pos < svLine.size()) && isspace(static_cast<unsigned char>(svLine[pos])) )
+				++pos;
+			if ( (pos < svLine.size()) && (svLine[pos] == '/') )
 			{
-				double	dblNumber2 = strtod(++szCurr, NULL);
+				double	dblNumber2 = EvalDouble(svLine.substr(pos + 1));
 				if ( dblNumber2 == 0 )
 					return m_err.SetError("Division by zero.", m_lReadLineCount);
 				m_dblScaleCents[lCurrNote] = TUN::Factor2Cents(dblNumber1 / dblNumber2);
@@ -341,7 +385,7 @@ bool CSCL_Import::ReadSCL(std::istream & istr, CStringParser & strparser)
 		else
 		{
 			// Period found --> cent value
-			m_dblScaleCents[lCurrNote] = atof(strparser.str().c_str());
+			m_dblScaleCents[lCurrNote] = EvalDouble(strparser.view());
 		}
 	} // while (true)
 
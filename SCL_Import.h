@@ -55,7 +55,7 @@ public:
 	// Handling of Scala Keyboard Mapping files
 	bool			ReadKBM(const char * szFilepath);
 private:
-	bool			ReadKBM(std::istream & istr, CStringParser & strparser);
+	bool			ReadKBM(CStringParser & strparser);
 public:
 
 
@@ -63,7 +63,7 @@ public:
 	// Handling of Scala tuning files
 	bool			ReadSCL(const char * szFilepath);
 private:
-	bool			ReadSCL(std::istream & istr, CStringParser & strparser);
+	bool			ReadSCL(CStringParser & strparser);
 public:
 
 
@@ -0,0 +1,304 @@
+// TUN_BatchLoader.cpp: Implementation of the class CBatchLoader.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#include "TUN_BatchLoader.h"
+#include "SCL_Import.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+// Returns the extension in lower chars, e.g. ".tun"
+static std::string GetExtension(const std::filesystem::path & path)
+{
+	return strx::GetAsLower(path.extension().string());
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CBatchLoader::CBatchLoader(unsigned int nThreads /* = 0 */)
+	: m_nThreads(nThreads), m_pCache(NULL)
+{
+	if ( m_nThreads == 0 )
+		m_nThreads = std::max(1u, std::thread::hardware_concurrency());
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Files to load
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+void CBatchLoader::AddFile(const std::string & strFilepath)
+{
+	m_vstrFilepaths.push_back(strFilepath);
+}
+
+
+
+bool CBatchLoader::AddDirectory(const std::string & strDirectory, bool bRecursive /* = false */)
+{
+	std::error_code		ec;
+	std::vector<std::string>	vstrFound;
+	auto	AddIfSupported = [&vstrFound](const std::filesystem::directory_entry & entry)
+	{
+		std::error_code		ecEntry;
+		if ( !entry.is_regular_file(ecEntry) )
+			return;
+		std::string	strExt = GetExtension(entry.path());
+		if ( (strExt == ".tun") || (strExt == ".scl") )
+			vstrFound.push_back(entry.path().string());
+	};
+
+	if ( bRecursive )
+	{
+		std::filesystem::recursive_directory_iterator	it(strDirectory, ec), itEnd;
+		for ( ; !ec && (it != itEnd) ; it.increment(ec) )
+			AddIfSupported(*it);
+	}
+	else
+	{
+		std::filesystem::directory_iterator	it(strDirectory, ec), itEnd;
+		for ( ; !ec && (it != itEnd) ; it.increment(ec) )
+			AddIfSupported(*it);
+	}
+	if ( ec )
+		return m_err.SetError(("Error reading the directory: " + ec.message()).c_str());
+
+	// The order of directory entries is not defined
+	std::sort(vstrFound.begin(), vstrFound.end());
+	m_vstrFilepaths.insert(m_vstrFilepaths.end(), vstrFound.begin(), vstrFound.end());
+	return m_err.SetOK();
+}
+
+
+
+void CBatchLoader::Clear()
+{
+	m_vstrFilepaths.clear();
+	m_vresResults.clear();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Loading
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+bool CBatchLoader::LoadFile(const std::string & strFilepath, CSingleScale & SS, CErr & err,
+							CScaleCache * pCache /* = NULL */)
+{
+	std::filesystem::path	path(strFilepath);
+	std::string				strExt = GetExtension(path);
+
+	if ( strExt == ".tun" )
+	{
+		long	lResult = ( pCache != NULL ? pCache->Read(SS, strFilepath.c_str()) : SS.Read(strFilepath.c_str()) );
+		if ( lResult == 1 )
+			return err.SetOK();
+		if ( SS.Err().IsOK() )
+			return err.SetError("No scale dataset found");
+		return err.SetError(SS.Err());
+	}
+
+	if ( strExt == ".scl" )
+	{
+		// Keyboard mapping with the same name, if there is one
+		std::string				strKBMFilepath;
+		std::error_code			ec;
+		std::filesystem::path	pathKBM = path;
+		for ( const char * szExtKBM : { ".kbm", ".KBM", ".Kbm" } )
+		{
+			pathKBM.replace_extension(szExtKBM);
+			if ( std::filesystem::is_regular_file(pathKBM, ec) )
+			{
+				strKBMFilepath = pathKBM.string();
+				break;
+			}
+		}
+		const char	* szKBMFilepath = ( strKBMFilepath.empty() ? NULL : strKBMFilepath.c_str() );
+
+		if ( pCache != NULL )
+			return pCache->ReadSCL(SS, err, strFilepath.c_str(), szKBMFilepath);
+
+		CSCL_Import	imp;
+		if ( (szKBMFilepath != NULL) && !imp.ReadKBM(szKBMFilepath) )
+			return err.SetError(imp.Err());
+		if ( !imp.ReadSCL(strFilepath.c_str()) )
+			return err.SetError(imp.Err());
+		imp.SetSingleScale(SS);
+		return err.SetOK();
+	}
+
+	return err.SetError("Unknown file type.");
+}
+
+
+
+void CBatchLoader::Load()
+{
+	m_vresResults.clear();
+	m_vresResults.resize(m_vstrFilepaths.size());
+	if ( m_vstrFilepaths.empty() )
+		return;
+
+	// Sort the files by size (largest first), so that large files do not
+	// end up at the end of the work
+	std::vector<std::pair<std::uintmax_t, std::size_t> >	vFiles;
+	vFiles.reserve(m_vstrFilepaths.size());
+	for ( std::size_t i = 0 ; i < m_vstrFilepaths.size() ; ++i )
+	{
+		m_vresResults[i].strFilepath = m_vstrFilepaths[i];
+		std::error_code	ec;
+		std::uintmax_t	sizeFile = std::filesystem::file_size(m_vstrFilepaths[i], ec);
+		vFiles.push_back(std::make_pair(ec ? 0 : sizeFile, i));
+	}
+	std::stable_sort(vFiles.begin(), vFiles.end(),
+					 [](const std::pair<std::uintmax_t, std::size_t> & a,
+						const std::pair<std::uintmax_t, std::size_t> & b) { return a.first > b.first; });
+
+	// Each worker has its own queue of files. The files are dealt out
+	// round robin, so each queue starts with its largest file.
+	unsigned int	nThreads = static_cast<unsigned int>(std::min<std::size_t>(m_nThreads, vFiles.size()));
+	struct SQueue
+	{
+		std::mutex				mtx;
+		std::deque<std::size_t>	dq;
+	};
+	std::vector<SQueue>	vqQueues(nThreads);
+	for ( std::size_t i = 0 ; i < vFiles.size() ; ++i )
+		vqQueues[i % nThreads].dq.push_back(vFiles[i].second);
+
+	// A worker takes files from the front of its own queue. If it is
+	// empty, the worker steals from the back of the other queues.
+	auto	Worker = [this, &vqQueues, nThreads](unsigned int nWorker)
+	{
+		while ( true )
+		{
+			std::size_t	nFile = 0;
+			bool		bFound = false;
+			{
+				SQueue &	q = vqQueues[nWorker];
+				std::lock_guard<std::mutex>	lock(q.mtx);
+				if ( !q.dq.empty() )
+				{
+					nFile = q.dq.front();
+					q.dq.pop_front();
+					bFound = true;
+				}
+			}
+			for ( unsigned int n = 1 ; !bFound && (n < nThreads) ; ++n )
+			{
+				SQueue &	q = vqQueues[(nWorker + n) % nThreads];
+				std::lock_guard<std::mutex>	lock(q.mtx);
+				if ( !q.dq.empty() )
+				{
+					nFile = q.dq.back();
+					q.dq.pop_back();
+					bFound = true;
+				}
+			}
+			if ( !bFound )
+				return; // All files loaded or being loaded
+
+			SResult &	res = m_vresResults[nFile];
+			try
+			{
+				LoadFile(res.strFilepath, res.SS, res.err, m_pCache);
+			}
+			catch ( const std::exception & e )
+			{
+				res.err.SetError(e.what());
+			}
+			catch ( ... )
+			{
+				// An exception leaving the worker would terminate the process
+				res.err.SetError("Unknown error while loading the file.");
+			}
+		}
+	};
+
+	// Joins the workers started, also if an exception leaves this function
+	struct SWorkers
+	{
+		std::vector<std::thread>	vthreads;
+		~SWorkers()
+		{
+			for ( std::size_t i = 0 ; i < vthreads.size() ; ++i )
+				vthreads[i].join();
+		}
+	} workers;
+	workers.vthreads.reserve(nThreads);
+	for ( unsigned int n = 1 ; n < nThreads ; ++n )
+	{
+		try
+		{
+			workers.vthreads.emplace_back(Worker, n);
+		}
+		catch ( const std::system_error & )
+		{
+			// No more threads: The queues of the missing workers are
+			// taken over by the others
+			break;
+		}
+	}
+	Worker(0); // The calling thread works, too
+}
+
+
+
+long CBatchLoader::GetNumOfErrors() const
+{
+	long	lErrors = 0;
+	for ( std::size_t i = 0 ; i < m_vresResults.size() ; ++i )
+		if ( !m_vresResults[i].err.IsOK() )
+			++lErrors;
+	return lErrors;
+}
+
+
+
+
+
+} // namespace TUN
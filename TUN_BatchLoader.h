@@ -0,0 +1,117 @@
+// TUN_BatchLoader.h: Interface of the class CBatchLoader.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class loads many tuning files at once by a pool of worker
+// threads. Supported are AnaMark tuning files (.tun) and Scala files
+// (.scl). If a Scala keyboard mapping file (.kbm) with the same name
+// exists next to a .scl file, it is applied, too.
+//
+// Usage:
+//
+//		CBatchLoader	bl;
+//		bl.AddDirectory("tunings");
+//		bl.Load();
+//		for ( const CBatchLoader::SResult & res : bl.GetResults() )
+//			if ( res.err.IsOK() ) ... res.SS ...
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_BATCHLOADER_H__58D91A1A_9CEE_4261_9FE7_796BDAD2CAC8__INCLUDED_)
+#define AFX_TUN_BATCHLOADER_H__58D91A1A_9CEE_4261_9FE7_796BDAD2CAC8__INCLUDED_
+
+
+
+
+
+#include <string>
+#include <vector>
+
+#include "TUN_Error.h"
+#include "TUN_Scale.h"
+#include "TUN_ScaleCache.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CBatchLoader
+{
+public:
+	// nThreads = 0: Use one thread per CPU core
+	explicit CBatchLoader(unsigned int nThreads = 0);
+
+
+
+	// Error handling (errors of AddDirectory(), errors of the single
+	// files are found in the results)
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+
+
+	// Files to load
+	void	AddFile(const std::string & strFilepath);
+	// Adds all .tun and .scl files of the directory (not case sensitive)
+	bool	AddDirectory(const std::string & strDirectory, bool bRecursive = false);
+	void	Clear();
+
+	// Optional cache for the scales (see CScaleCache), NULL = no cache.
+	// The cache must exist until Load() returns.
+	void	SetCache(CScaleCache * pCache) { m_pCache = pCache; }
+
+
+
+	// Loads all files added. The results are in the order the files were
+	// added. Larger files are loaded first, and idle threads take over
+	// files queued for busy threads, so that a single huge file does not
+	// delay the other ones.
+	struct SResult
+	{
+		std::string		strFilepath;
+		CSingleScale	SS;
+		CErr			err; // IsOK() = SS was loaded
+	};
+	void							Load();
+	const std::vector<SResult> &	GetResults() const { return m_vresResults; }
+	std::vector<SResult> &			GetResults() { return m_vresResults; }
+	// Number of files which could not be loaded
+	long							GetNumOfErrors() const;
+
+
+
+	// Loads a single file like Load() does
+	static bool	LoadFile(const std::string & strFilepath, CSingleScale & SS, CErr & err,
+						 CScaleCache * pCache = NULL);
+
+
+
+private:
+	unsigned int				m_nThreads;
+	CScaleCache					* m_pCache;
+	std::vector<std::string>	m_vstrFilepaths;
+	std::vector<SResult>		m_vresResults;
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_BATCHLOADER_H__58D91A1A_9CEE_4261_9FE7_796BDAD2CAC8__INCLUDED_)
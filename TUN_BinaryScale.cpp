@@ -0,0 +1,622 @@
+// TUN_BinaryScale.cpp: Implementation of the class CBinaryScale.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+//
+// Layout of a .tunb file (all offsets are multiples of 8):
+//
+//		STUNBHeader			(128 bytes)
+//		double				MIDI note frequencies [ulNumOfMIDINotes]
+//		double				Note frequencies [ulNumOfNotes]
+//		int32				Mapping [ulNumOfMappings], padded to 8 bytes
+//		STUNBFormula		Formulas [ulNumOfFormulas]
+//		STUNBString			String directory [ulNumOfStrings]
+//		char				String data [ulStringDataSize], padded to 8 bytes
+//
+// The checksum is taken over the complete file, with the checksum field
+// itself set to 0.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstring>
+#include <fstream>
+
+#include "TUN_BinaryScale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// File layout
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+static const char			TUNBMagic[4] = { 'T', 'U', 'N', 'B' };
+static const std::uint32_t	TUNBEndianTag = 0x01020304;
+
+
+
+struct STUNBHeader
+{
+	char			achMagic[4];
+	std::uint32_t	ulEndianTag;
+	std::uint32_t	ulVersion;
+	std::uint32_t	ulHeaderSize;
+	std::uint64_t	ullFileSize;
+	std::uint64_t	ullChecksum;
+	std::int32_t	lBaseNote;
+	std::int32_t	lMappingLoopSize;
+	double			dblBaseFreqHz;
+	std::uint32_t	ulNumOfMIDINotes;
+	std::uint32_t	ulNumOfNotes;
+	std::uint32_t	ulNumOfMappings;
+	std::uint32_t	ulNumOfFormulas;
+	std::uint32_t	ulNumOfStrings;
+	std::uint32_t	ulStringDataSize;
+	std::uint8_t	aReserved[56]; // Keeps the tables aligned to a cache line
+};
+static_assert(sizeof(STUNBHeader) == 128, "Layout of STUNBHeader changed");
+
+
+
+struct STUNBRVParam
+{
+	std::int32_t	nParamType; // SRVParam::eRVParamType
+	std::int32_t	lRef;
+	double			dblValue;
+};
+
+struct STUNBFormula
+{
+	std::int32_t	lMyIndex;
+	std::int32_t	lLoop;
+	double			dblEnsureHz;
+	STUNBRVParam	rvpRangeHz;
+	double			dblMUL;
+	double			dblDIV;
+	double			dblCENTS;
+	STUNBRVParam	rvpShiftHz;
+};
+static_assert(sizeof(STUNBFormula) == 72, "Layout of STUNBFormula changed");
+
+
+
+struct STUNBString
+{
+	std::uint32_t	ulKey; // CSingleScale::eKey
+	std::uint32_t	ulOffset; // Offset in the string data
+	std::uint32_t	ulLength;
+	std::uint32_t	ulReserved;
+};
+static_assert(sizeof(STUNBString) == 16, "Layout of STUNBString changed");
+
+
+
+// Limits against damaged files
+static const std::uint32_t	MaxNumOfMappings = 65536;
+static const std::uint32_t	MaxNumOfFormulas = 1 << 24;
+static const std::uint32_t	MaxNumOfStrings = 1 << 20;
+
+
+
+static std::uint64_t Align8(std::uint64_t ullSize)
+{
+	return (ullSize + 7) & ~static_cast<std::uint64_t>(7);
+}
+
+
+
+// Offsets of the tables, computed from the header
+struct STUNBLayout
+{
+	std::uint64_t	ullMIDINoteFreqs;
+	std::uint64_t	ullNoteFreqs;
+	std::uint64_t	ullMapping;
+	std::uint64_t	ullFormulas;
+	std::uint64_t	ullStrings;
+	std::uint64_t	ullStringData;
+	std::uint64_t	ullFileSize;
+};
+
+
+
+// The data of an opened file is always aligned to 8 bytes
+static const STUNBHeader & GetHeader(const char * pData)
+{
+	return *reinterpret_cast<const STUNBHeader *>(pData);
+}
+
+
+
+static STUNBLayout GetLayout(const STUNBHeader & hdr)
+{
+	STUNBLayout	lo;
+	lo.ullMIDINoteFreqs = sizeof(STUNBHeader);
+	lo.ullNoteFreqs = lo.ullMIDINoteFreqs + hdr.ulNumOfMIDINotes * static_cast<std::uint64_t>(sizeof(double));
+	lo.ullMapping = lo.ullNoteFreqs + hdr.ulNumOfNotes * static_cast<std::uint64_t>(sizeof(double));
+	lo.ullFormulas = lo.ullMapping + Align8(hdr.ulNumOfMappings * static_cast<std::uint64_t>(sizeof(std::int32_t)));
+	lo.ullStrings = lo.ullFormulas + hdr.ulNumOfFormulas * static_cast<std::uint64_t>(sizeof(STUNBFormula));
+	lo.ullStringData = lo.ullStrings + hdr.ulNumOfStrings * static_cast<std::uint64_t>(sizeof(STUNBString));
+	lo.ullFileSize = lo.ullStringData + Align8(hdr.ulStringDataSize);
+	return lo;
+}
+
+
+
+static std::uint64_t Checksum(const char * pData, std::size_t sizeData)
+{
+	return ChecksumFNV1a(pData, sizeData, offsetof(STUNBHeader, ullChecksum));
+}
+
+
+
+static void SetRVParam(STUNBRVParam & rec, const SRVParam & rvp)
+{
+	rec.nParamType = rvp.m_paramtype;
+	rec.lRef = ( rvp.m_paramtype == SRVParam::t_Value ? 0 : rvp.m_lRef );
+	rec.dblValue = ( rvp.m_paramtype == SRVParam::t_Value ? rvp.m_dblValue : 0 );
+}
+
+static SRVParam GetRVParam(const STUNBRVParam & rec)
+{
+	SRVParam	rvp;
+	rvp.m_paramtype = static_cast<SRVParam::eRVParamType>(rec.nParamType);
+	rvp.m_lRef = rec.lRef;
+	rvp.m_dblValue = rec.dblValue;
+	return rvp;
+}
+
+static bool IsRVParamOK(const STUNBRVParam & rec)
+{
+	return (rec.nParamType >= SRVParam::t_Value) && (rec.nParamType <= SRVParam::t_RelRef);
+}
+
+static CFormula GetFormula(const STUNBFormula & rec)
+{
+	CFormula	formula(rec.lMyIndex);
+	formula.Set(rec.dblEnsureHz, GetRVParam(rec.rvpRangeHz),
+				rec.dblMUL, rec.dblDIV, rec.dblCENTS,
+				GetRVParam(rec.rvpShiftHz), rec.lLoop);
+	return formula;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CBinaryScale::CBinaryScale()
+{
+	Close();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Opening files
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+bool CBinaryScale::Open(const char * szFilepath)
+{
+	Close();
+	if ( !m_mf.Open(szFilepath) )
+		return m_err.SetError("Error opening the file.");
+	if ( !CheckData(m_mf.GetData(), m_mf.GetSize()) )
+	{
+		Close();
+		return false;
+	}
+	return m_err.SetOK();
+}
+
+
+
+bool CBinaryScale::OpenFromMemory(const void * pData, std::size_t sizeData)
+{
+	Close();
+	const char	* pchData = static_cast<const char *>(pData);
+	if ( reinterpret_cast<std::uintptr_t>(pData) % sizeof(std::uint64_t) != 0 )
+	{
+		m_vullCopy.resize((sizeData + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t));
+		if ( sizeData > 0 )
+			std::memcpy(m_vullCopy.data(), pData, sizeData);
+		pchData = reinterpret_cast<const char *>(m_vullCopy.data());
+	}
+	if ( !CheckData(pchData, sizeData) )
+	{
+		Close();
+		return false;
+	}
+	return m_err.SetOK();
+}
+
+
+
+void CBinaryScale::Close()
+{
+	m_mf.Close();
+	m_vullCopy.clear();
+	m_pData = NULL;
+	m_pdblMIDINoteFreqHz = NULL;
+	m_pdblNoteFrequenciesHz = NULL;
+	m_plMapping = NULL;
+	m_pFormulas = NULL;
+	m_pStrings = NULL;
+	m_pStringData = NULL;
+}
+
+
+
+bool CBinaryScale::CheckData(const char * pData, std::size_t sizeData)
+{
+	STUNBHeader	hdr;
+	if ( sizeData < sizeof(hdr) )
+		return m_err.SetError("Not a binary tuning file.");
+	std::memcpy(&hdr, pData, sizeof(hdr));
+
+	if ( std::memcmp(hdr.achMagic, TUNBMagic, sizeof(TUNBMagic)) != 0 )
+		return m_err.SetError("Not a binary tuning file.");
+	if ( hdr.ulEndianTag != TUNBEndianTag )
+		return m_err.SetError("Binary tuning file has a different byte order.");
+	if ( (hdr.ulVersion != FormatVersion) || (hdr.ulHeaderSize != sizeof(hdr)) )
+		return m_err.SetError("Binary tuning file has a different version.");
+
+	if ( (hdr.ulNumOfMIDINotes != static_cast<std::uint32_t>(CSingleScale::NumOfMIDINotes)) ||
+		 (hdr.ulNumOfNotes != static_cast<std::uint32_t>(MaxNumOfNotes)) ||
+		 (hdr.ulNumOfMappings > MaxNumOfMappings) ||
+		 (hdr.ulNumOfFormulas > MaxNumOfFormulas) ||
+		 (hdr.ulNumOfStrings > MaxNumOfStrings) )
+		return m_err.SetError("Binary tuning file is damaged.");
+	STUNBLayout	lo = GetLayout(hdr);
+	if ( (lo.ullFileSize != hdr.ullFileSize) || (lo.ullFileSize != sizeData) )
+		return m_err.SetError("Binary tuning file is damaged.");
+	if ( Checksum(pData, sizeData) != hdr.ullChecksum )
+		return m_err.SetError("Binary tuning file is damaged (checksum error).");
+
+	// Check the records, so that the accessors need no checks
+	const STUNBFormula	* pFormulas = reinterpret_cast<const STUNBFormula *>(pData + lo.ullFormulas);
+	for ( std::uint32_t i = 0 ; i < hdr.ulNumOfFormulas ; ++i )
+		if ( (pFormulas[i].lMyIndex < 0) || (pFormulas[i].lMyIndex >= MaxNumOfNotes) ||
+			 !IsRVParamOK(pFormulas[i].rvpRangeHz) || !IsRVParamOK(pFormulas[i].rvpShiftHz) ||
+			 !GetFormula(pFormulas[i]).HasValidRefs() ) // Same check as CSingleScale::Read()
+			return m_err.SetError("Binary tuning file is damaged.");
+	const STUNBString	* pStrings = reinterpret_cast<const STUNBString *>(pData + lo.ullStrings);
+	for ( std::uint32_t i = 0 ; i < hdr.ulNumOfStrings ; ++i )
+		if ( static_cast<std::uint64_t>(pStrings[i].ulOffset) + pStrings[i].ulLength > hdr.ulStringDataSize )
+			return m_err.SetError("Binary tuning file is damaged.");
+
+	m_pData = pData;
+	m_pdblMIDINoteFreqHz = reinterpret_cast<const double *>(pData + lo.ullMIDINoteFreqs);
+	m_pdblNoteFrequenciesHz = reinterpret_cast<const double *>(pData + lo.ullNoteFreqs);
+	m_plMapping = reinterpret_cast<const std::int32_t *>(pData + lo.ullMapping);
+	m_pFormulas = pFormulas;
+	m_pStrings = pStrings;
+	m_pStringData = pData + lo.ullStringData;
+	return true;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Accessing the opened file
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CBinaryScale::GetBaseNote() const
+{
+	return ( IsOpen() ? GetHeader(m_pData).lBaseNote : 0 );
+}
+
+
+
+double CBinaryScale::GetBaseFreqHz() const
+{
+	return ( IsOpen() ? GetHeader(m_pData).dblBaseFreqHz : 0 );
+}
+
+
+
+long CBinaryScale::GetMappingLoopSize() const
+{
+	return ( IsOpen() ? GetHeader(m_pData).lMappingLoopSize : 0 );
+}
+
+
+
+long CBinaryScale::GetMappingSize() const
+{
+	return ( IsOpen() ? GetHeader(m_pData).ulNumOfMappings : 0 );
+}
+
+
+
+long CBinaryScale::GetNumOfFormulas() const
+{
+	return ( IsOpen() ? GetHeader(m_pData).ulNumOfFormulas : 0 );
+}
+
+
+
+std::string_view CBinaryScale::GetString(CSingleScale::eKey key) const
+{
+	const STUNBString	* pStrings = static_cast<const STUNBString *>(m_pStrings);
+	std::uint32_t		ulNumOfStrings = ( IsOpen() ? GetHeader(m_pData).ulNumOfStrings : 0 );
+	for ( std::uint32_t i = 0 ; i < ulNumOfStrings ; ++i )
+		if ( pStrings[i].ulKey == static_cast<std::uint32_t>(key) )
+			return std::string_view(m_pStringData + pStrings[i].ulOffset, pStrings[i].ulLength);
+	return std::string_view();
+}
+
+
+
+bool CBinaryScale::GetSingleScale(CSingleScale & SS) const
+{
+	if ( !IsOpen() )
+		return SS.m_err.SetError("No binary tuning file opened.");
+
+	const STUNBHeader &	hdr = GetHeader(m_pData);
+
+	SS.m_err.SetOK();
+	SS.m_strFormat = SS.Format();
+	SS.m_lFormatVersion = SS.FormatVersion();
+	SS.m_strFormatSpecs = SS.FormatSpecs();
+
+	// Strings
+	SS.m_strName = "";
+	SS.m_strID = "";
+	SS.m_strFilename = "";
+	SS.m_strAuthor = "";
+	SS.m_strLocation = "";
+	SS.m_strContact = "";
+	SS.m_strDate = "";
+	SS.m_strEditor = "";
+	SS.m_strEditorSpecs = "";
+	SS.m_strDescription = "";
+	SS.m_lstrKeywords.clear();
+	SS.m_strHistory = "";
+	SS.m_strGeography = "";
+	SS.m_strInstrument = "";
+	SS.m_lstrCompositions.clear();
+	SS.m_strComments = "";
+	SS.m_lmcrChannels.clear();
+	const STUNBString	* pStrings = static_cast<const STUNBString *>(m_pStrings);
+	for ( std::uint32_t i = 0 ; i < hdr.ulNumOfStrings ; ++i )
+	{
+		std::string_view	svValue(m_pStringData + pStrings[i].ulOffset, pStrings[i].ulLength);
+		switch ( pStrings[i].ulKey )
+		{
+		case CSingleScale::KEY_Name:		SS.m_strName = svValue;			break;
+		case CSingleScale::KEY_ID:			SS.m_strID = svValue;			break;
+		case CSingleScale::KEY_Filename:	SS.m_strFilename = svValue;		break;
+		case CSingleScale::KEY_Author:		SS.m_strAuthor = svValue;		break;
+		case CSingleScale::KEY_Location:	SS.m_strLocation = svValue;		break;
+		case CSingleScale::KEY_Contact:		SS.m_strContact = svValue;		break;
+		case CSingleScale::KEY_Date:		SS.m_strDate = svValue;			break;
+		case CSingleScale::KEY_Editor:		SS.m_strEditor = svValue;		break;
+		case CSingleScale::KEY_EditorSpecs:	SS.m_strEditorSpecs = svValue;	break;
+		case CSingleScale::KEY_Description:	SS.m_strDescription = svValue;	break;
+		case CSingleScale::KEY_Keyword:		SS.m_lstrKeywords.push_back(std::string(svValue));		break;
+		case CSingleScale::KEY_History:		SS.m_strHistory = svValue;		break;
+		case CSingleScale::KEY_Geography:	SS.m_strGeography = svValue;	break;
+		case CSingleScale::KEY_Instrument:	SS.m_strInstrument = svValue;	break;
+		case CSingleScale::KEY_Composition:	SS.m_lstrCompositions.push_back(std::string(svValue));	break;
+		case CSingleScale::KEY_Comments:	SS.m_strComments = svValue;		break;
+		case CSingleScale::KEY_MIDIChannel:
+			if ( !SS.SetMIDIChannelsAssignment(svValue) )
+				return SS.m_err.SetError("Binary tuning file is damaged (MIDI channel assignment).");
+			break;
+		default: // Unknown keys are ignored
+			break;
+		}
+	}
+
+	// The scale, as it results from the formulas
+	SS.m_lInitEqual_BaseNote = hdr.lBaseNote;
+	SS.m_dblInitEqual_BaseFreqHz = hdr.dblBaseFreqHz;
+	SS.m_vdblNoteFrequenciesHz.assign(m_pdblNoteFrequenciesHz, m_pdblNoteFrequenciesHz + hdr.ulNumOfNotes);
+	SS.m_lformulas.clear();
+	SS.m_bEqualPending = false;
+	SS.m_lNumOfPendingFormulas = 0;
+	const STUNBFormula	* pFormulas = static_cast<const STUNBFormula *>(m_pFormulas);
+	for ( std::uint32_t i = 0 ; i < hdr.ulNumOfFormulas ; ++i )
+		SS.m_lformulas.push_back(GetFormula(pFormulas[i]));
+
+	// Keyboard mapping
+	SS.m_vlMapping.assign(m_plMapping, m_plMapping + hdr.ulNumOfMappings);
+	SS.m_lMappingLoopSize = hdr.lMappingLoopSize;
+	std::memcpy(SS.m_adblMIDINoteFreqHz, m_pdblMIDINoteFreqHz, sizeof(SS.m_adblMIDINoteFreqHz));
+
+	return true;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Writing and reading files
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+void CBinaryScale::Write(const CSingleScale & SS, std::vector<char> & vchBuffer)
+{
+	// Collect the strings
+	std::vector<std::pair<CSingleScale::eKey, std::string> >	vStrings;
+	auto	AddString = [&vStrings](CSingleScale::eKey key, const std::string & strValue)
+	{
+		if ( !strValue.empty() )
+			vStrings.push_back(std::make_pair(key, strValue));
+	};
+	AddString(CSingleScale::KEY_Name, SS.m_strName);
+	AddString(CSingleScale::KEY_ID, SS.m_strID);
+	AddString(CSingleScale::KEY_Filename, SS.m_strFilename);
+	AddString(CSingleScale::KEY_Author, SS.m_strAuthor);
+	AddString(CSingleScale::KEY_Location, SS.m_strLocation);
+	AddString(CSingleScale::KEY_Contact, SS.m_strContact);
+	AddString(CSingleScale::KEY_Date, SS.m_strDate);
+	AddString(CSingleScale::KEY_Editor, SS.m_strEditor);
+	AddString(CSingleScale::KEY_EditorSpecs, SS.m_strEditorSpecs);
+	AddString(CSingleScale::KEY_Description, SS.m_strDescription);
+	std::list<std::string>::const_iterator	it;
+	for ( it = SS.m_lstrKeywords.begin() ; it != SS.m_lstrKeywords.end() ; ++it )
+		vStrings.push_back(std::make_pair(CSingleScale::KEY_Keyword, *it));
+	AddString(CSingleScale::KEY_History, SS.m_strHistory);
+	AddString(CSingleScale::KEY_Geography, SS.m_strGeography);
+	AddString(CSingleScale::KEY_Instrument, SS.m_strInstrument);
+	for ( it = SS.m_lstrCompositions.begin() ; it != SS.m_lstrCompositions.end() ; ++it )
+		vStrings.push_back(std::make_pair(CSingleScale::KEY_Composition, *it));
+	AddString(CSingleScale::KEY_Comments, SS.m_strComments);
+	AddString(CSingleScale::KEY_MIDIChannel, SS.GetMIDIChannelsAssignment());
+
+	// The file contains the note frequencies (see CSingleScale::SetDeferredEvaluation())
+	SS.EvaluateFormulas();
+
+	// Header
+	STUNBHeader	hdr;
+	std::memset(&hdr, 0, sizeof(hdr));
+	std::memcpy(hdr.achMagic, TUNBMagic, sizeof(TUNBMagic));
+	hdr.ulEndianTag = TUNBEndianTag;
+	hdr.ulVersion = FormatVersion;
+	hdr.ulHeaderSize = sizeof(hdr);
+	hdr.lBaseNote = SS.m_lInitEqual_BaseNote;
+	hdr.lMappingLoopSize = SS.m_lMappingLoopSize;
+	hdr.dblBaseFreqHz = SS.m_dblInitEqual_BaseFreqHz;
+	hdr.ulNumOfMIDINotes = CSingleScale::NumOfMIDINotes;
+	hdr.ulNumOfNotes = static_cast<std::uint32_t>(SS.m_vdblNoteFrequenciesHz.size());
+	hdr.ulNumOfMappings = static_cast<std::uint32_t>(SS.m_vlMapping.size());
+	hdr.ulNumOfFormulas = static_cast<std::uint32_t>(SS.m_lformulas.size());
+	hdr.ulNumOfStrings = static_cast<std::uint32_t>(vStrings.size());
+	for ( std::size_t i = 0 ; i < vStrings.size() ; ++i )
+		hdr.ulStringDataSize += static_cast<std::uint32_t>(vStrings[i].second.size());
+	STUNBLayout	lo = GetLayout(hdr);
+	hdr.ullFileSize = lo.ullFileSize;
+
+	vchBuffer.assign(static_cast<std::size_t>(lo.ullFileSize), 0);
+	char	* pData = vchBuffer.data();
+
+	// Tables
+	std::memcpy(pData + lo.ullMIDINoteFreqs, SS.m_adblMIDINoteFreqHz, sizeof(SS.m_adblMIDINoteFreqHz));
+	if ( !SS.m_vdblNoteFrequenciesHz.empty() )
+		std::memcpy(pData + lo.ullNoteFreqs, SS.m_vdblNoteFrequenciesHz.data(),
+					SS.m_vdblNoteFrequenciesHz.size() * sizeof(double));
+	for ( std::size_t i = 0 ; i < SS.m_vlMapping.size() ; ++i )
+	{
+		std::int32_t	lMapping = static_cast<std::int32_t>(SS.m_vlMapping[i]);
+		std::memcpy(pData + lo.ullMapping + i * sizeof(lMapping), &lMapping, sizeof(lMapping));
+	}
+
+	// Formulas
+	std::uint64_t	ullPos = lo.ullFormulas;
+	std::list<CFormula>::const_iterator	itf;
+	for ( itf = SS.m_lformulas.begin() ; itf != SS.m_lformulas.end() ; ++itf, ullPos += sizeof(STUNBFormula) )
+	{
+		STUNBFormula	rec;
+		rec.lMyIndex = itf->GetMyIndex();
+		rec.lLoop = itf->GetLoop();
+		rec.dblEnsureHz = itf->GetEnsureHz();
+		SetRVParam(rec.rvpRangeHz, itf->GetRangeHz());
+		rec.dblMUL = itf->GetMUL();
+		rec.dblDIV = itf->GetDIV();
+		rec.dblCENTS = itf->GetCENTS();
+		SetRVParam(rec.rvpShiftHz, itf->GetShiftHz());
+		std::memcpy(pData + ullPos, &rec, sizeof(rec));
+	}
+
+	// Strings
+	std::uint32_t	ulOffset = 0;
+	for ( std::size_t i = 0 ; i < vStrings.size() ; ++i )
+	{
+		STUNBString	rec;
+		rec.ulKey = vStrings[i].first;
+		rec.ulOffset = ulOffset;
+		rec.ulLength = static_cast<std::uint32_t>(vStrings[i].second.size());
+		rec.ulReserved = 0;
+		std::memcpy(pData + lo.ullStrings + i * sizeof(rec), &rec, sizeof(rec));
+		std::memcpy(pData + lo.ullStringData + ulOffset, vStrings[i].second.data(), rec.ulLength);
+		ulOffset += rec.ulLength;
+	}
+
+	// Checksum
+	std::memcpy(pData, &hdr, sizeof(hdr));
+	hdr.ullChecksum = Checksum(pData, vchBuffer.size());
+	std::memcpy(pData, &hdr, sizeof(hdr));
+}
+
+
+
+bool CBinaryScale::Write(const CSingleScale & SS, const char * szFilepath, CErr & err)
+{
+	std::vector<char>	vchBuffer;
+	Write(SS, vchBuffer);
+
+	std::ofstream	ofs(szFilepath, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+	if ( !ofs )
+		return err.SetError("Error opening the file.");
+	ofs.write(vchBuffer.data(), static_cast<std::streamsize>(vchBuffer.size()));
+	ofs.close();
+	if ( !ofs )
+		return err.SetError("Error writing the file.");
+	return err.SetOK();
+}
+
+
+
+long CBinaryScale::Read(CSingleScale & SS, const char * szBinaryFilepath,
+						const char * szTextFilepath /* = NULL */)
+{
+	CBinaryScale	bs;
+	if ( bs.Open(szBinaryFilepath) )
+	{
+		if ( bs.GetSingleScale(SS) )
+			return 1;
+	}
+	else
+		SS.m_err.SetError(bs.Err());
+	// SS.Err() tells why the binary file can not be used
+
+	if ( szTextFilepath != NULL )
+		return SS.Read(szTextFilepath);
+	return -1;
+}
+
+
+
+
+
+} // namespace TUN
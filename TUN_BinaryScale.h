@@ -0,0 +1,143 @@
+// TUN_BinaryScale.h: Interface of the class CBinaryScale.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class implements a compiled binary tuning format (*.TUNB).
+// A .tunb file holds the final state of a CSingleScale: the note and
+// MIDI note frequencies, the keyboard mapping, loop size, base note and
+// frequency, the formulas and the strings of section [Info].
+//
+// The file is memory mapped and used in place: After checking the
+// header and the checksum, the frequency tables and the mapping are
+// read directly from the mapping without any parsing. Formulas are not
+// evaluated again.
+//
+// The data is stored in the byte order of the machine which wrote the
+// file. Files of another version or byte order are rejected, so that
+// the text file can be read instead (see Read()).
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_BINARYSCALE_H__7DD8080C_BE36_46C9_AD41_0A88A85FC625__INCLUDED_)
+#define AFX_TUN_BINARYSCALE_H__7DD8080C_BE36_46C9_AD41_0A88A85FC625__INCLUDED_
+
+
+
+
+
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#include "TUN_Error.h"
+#include "TUN_MappedFile.h"
+#include "TUN_Scale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CBinaryScale
+{
+public:
+	static constexpr std::uint32_t	FormatVersion = 1; // Increase on each change of the layout!
+
+	CBinaryScale();
+
+	// Mappings are not copyable
+	CBinaryScale(const CBinaryScale &) = delete;
+	CBinaryScale & operator=(const CBinaryScale &) = delete;
+
+
+
+	// Error handling
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+
+
+	// Opens a .tunb file (memory mapped) and checks it.
+	// Returns false, if the file can not be opened or is not valid.
+	bool	Open(const char * szFilepath);
+	// Uses a .tunb file in memory. The memory must stay valid until
+	// Close(). If it is not aligned to 8 bytes, it is copied.
+	bool	OpenFromMemory(const void * pData, std::size_t sizeData);
+	void	Close();
+	bool	IsOpen() const { return m_pData != NULL; }
+
+
+
+	// In-place access of the opened file (the pointers are valid until Close())
+	long					GetBaseNote() const;
+	double					GetBaseFreqHz() const;
+	long					GetMappingLoopSize() const;
+	// Table with CSingleScale::NumOfMIDINotes entries, aligned to a cache line
+	// if the file is memory mapped (see CSingleScale::GetMIDINoteFreqTable())
+	const double *			GetMIDINoteFreqTable() const { return m_pdblMIDINoteFreqHz; }
+	// Table with MaxNumOfNotes entries (index = scale note number)
+	const double *			GetNoteFrequenciesHz() const { return m_pdblNoteFrequenciesHz; }
+	// Mapping with GetMappingSize() entries (index = MIDI note number)
+	const std::int32_t *	GetMapping() const { return m_plMapping; }
+	long					GetMappingSize() const;
+	long					GetNumOfFormulas() const;
+	// First string stored for the key (section [Info], KEY_MIDIChannel),
+	// empty if there is none
+	std::string_view		GetString(CSingleScale::eKey key) const;
+
+	// Copies the opened file into the scale. Formulas are not evaluated.
+	// Returns false and sets SS.Err(), if the data can not be restored.
+	bool	GetSingleScale(CSingleScale & SS) const;
+
+
+
+	// Creates a .tunb file from the scale
+	static void	Write(const CSingleScale & SS, std::vector<char> & vchBuffer);
+	static bool	Write(const CSingleScale & SS, const char * szFilepath, CErr & err);
+
+	// Reads a .tunb file into the scale. If the binary file can not be
+	// used (missing, damaged, other version or byte order, or the scale
+	// can not be restored from it) and a text file is given, the text file
+	// is read instead. Otherwise SS.Err() tells why.
+	// Returns the same values as CSingleScale::Read().
+	static long	Read(CSingleScale & SS, const char * szBinaryFilepath,
+					 const char * szTextFilepath = NULL);
+
+
+
+private:
+	bool	CheckData(const char * pData, std::size_t sizeData);
+
+	CMappedFile					m_mf;
+	std::vector<std::uint64_t>	m_vullCopy; // Aligned copy, see OpenFromMemory()
+
+	const char					* m_pData; // Begin of the file or NULL
+	const double				* m_pdblMIDINoteFreqHz;
+	const double				* m_pdblNoteFrequenciesHz;
+	const std::int32_t			* m_plMapping;
+	const void					* m_pFormulas;
+	const void					* m_pStrings;
+	const char					* m_pStringData;
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_BINARYSCALE_H__7DD8080C_BE36_46C9_AD41_0A88A85FC625__INCLUDED_)
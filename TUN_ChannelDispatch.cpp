@@ -0,0 +1,152 @@
+// TUN_ChannelDispatch.cpp: Implementation of the class CChannelDispatch.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <queue>
+
+#include "TUN_ChannelDispatch.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+void CChannelDispatch::Clear()
+{
+	m_vcrRanges.clear();
+	for ( long i = 0 ; i < NumOfDenseChannels ; ++i )
+		m_alDenseScaleIndex[i] = -1;
+	m_lGlobalScaleIndex = -1;
+}
+
+
+
+void CChannelDispatch::Build(const std::list<CSingleScale> & lssScales)
+{
+	Clear();
+
+	// Collect the channel ranges of all scales
+	std::vector<SChannelRange>	vcrAssigned;
+	long						lScaleIndex = 0;
+	std::list<CSingleScale>::const_iterator	it;
+	for ( it = lssScales.begin() ; it != lssScales.end() ; ++it, ++lScaleIndex )
+		AddChannels(vcrAssigned, it->GetChannels(), lScaleIndex);
+
+	BuildRanges(vcrAssigned);
+}
+
+
+
+void CChannelDispatch::Build(const std::vector<std::list<CMIDIChannelRange> > & vlmcrChannels)
+{
+	Clear();
+
+	std::vector<SChannelRange>	vcrAssigned;
+	for ( std::size_t i = 0 ; i < vlmcrChannels.size() ; ++i )
+		AddChannels(vcrAssigned, vlmcrChannels[i], static_cast<long>(i));
+
+	BuildRanges(vcrAssigned);
+}
+
+
+
+void CChannelDispatch::AddChannels(std::vector<SChannelRange> & vcrAssigned,
+								   const std::list<CMIDIChannelRange> & lmcrChannels, long lScaleIndex)
+{
+	if ( lmcrChannels.empty() )
+	{
+		// Scale applies to all channels
+		SChannelRange	cr = { 1, MaxChannel, lScaleIndex };
+		vcrAssigned.push_back(cr);
+		if ( m_lGlobalScaleIndex < 0 )
+			m_lGlobalScaleIndex = lScaleIndex;
+		return;
+	}
+	std::list<CMIDIChannelRange>::const_iterator	itmcr;
+	for ( itmcr = lmcrChannels.begin() ; itmcr != lmcrChannels.end() ; ++itmcr )
+	{
+		if ( (itmcr->GetFrom() < 1) || (itmcr->GetTo() < itmcr->GetFrom()) )
+			continue; // Invalid range applies to no channel
+		SChannelRange	cr = { itmcr->GetFrom(), std::min(itmcr->GetTo(), MaxChannel), lScaleIndex };
+		vcrAssigned.push_back(cr);
+	}
+}
+
+
+
+void CChannelDispatch::BuildRanges(std::vector<SChannelRange> & vcrAssigned)
+{
+	// Sweep over the channels: Of all ranges covering the current channel,
+	// the one of the scale with the lowest index wins. The active ranges
+	// are kept in a heap; ranges already passed are removed lazily.
+	std::sort(vcrAssigned.begin(), vcrAssigned.end(),
+			  [](const SChannelRange & a, const SChannelRange & b) { return a.lFrom < b.lFrom; });
+	auto	cmpScaleIndex = [](const SChannelRange & a, const SChannelRange & b) { return a.lScaleIndex > b.lScaleIndex; };
+	std::priority_queue<SChannelRange, std::vector<SChannelRange>, decltype(cmpScaleIndex)>	pqActive(cmpScaleIndex);
+
+	std::vector<SChannelRange>::size_type	i = 0;
+	long									lChannel = 1;
+	while ( (i < vcrAssigned.size()) || !pqActive.empty() )
+	{
+		if ( pqActive.empty() )
+			lChannel = std::max(lChannel, vcrAssigned[i].lFrom);
+		while ( (i < vcrAssigned.size()) && (vcrAssigned[i].lFrom <= lChannel) )
+			pqActive.push(vcrAssigned[i++]);
+		while ( !pqActive.empty() && (pqActive.top().lTo < lChannel) )
+			pqActive.pop();
+		if ( pqActive.empty() )
+			continue;
+
+		// The winner is valid until its range ends or another range begins
+		SChannelRange	cr = pqActive.top();
+		cr.lFrom = lChannel;
+		if ( i < vcrAssigned.size() )
+			cr.lTo = std::min(cr.lTo, vcrAssigned[i].lFrom - 1);
+
+		if ( !m_vcrRanges.empty() &&
+			 (m_vcrRanges.back().lScaleIndex == cr.lScaleIndex) &&
+			 (m_vcrRanges.back().lTo + 1 == cr.lFrom) )
+			m_vcrRanges.back().lTo = cr.lTo; // Merge with previous range
+		else
+			m_vcrRanges.push_back(cr);
+		lChannel = cr.lTo + 1;
+	}
+
+	for ( long lDense = 0 ; lDense < NumOfDenseChannels ; ++lDense )
+		m_alDenseScaleIndex[lDense] = FindInRanges(lDense + 1);
+}
+
+
+
+long CChannelDispatch::FindInRanges(long lMIDIChannel) const noexcept
+{
+	// Scales without assignment apply even to channels out of range
+	if ( (lMIDIChannel < 1) || (lMIDIChannel > MaxChannel) )
+		return m_lGlobalScaleIndex;
+
+	// Binary search for the last range beginning at or before the channel
+	std::vector<SChannelRange>::const_iterator	it =
+		std::upper_bound(m_vcrRanges.begin(), m_vcrRanges.end(), lMIDIChannel,
+						 [](long lChannel, const SChannelRange & cr) { return lChannel < cr.lFrom; });
+	if ( it == m_vcrRanges.begin() )
+		return -1;
+	--it;
+	return ( lMIDIChannel <= it->lTo ? it->lScaleIndex : -1 );
+}
+
+
+
+
+
+} // namespace TUN
@@ -0,0 +1,103 @@
+// TUN_ChannelDispatch.h: Interface of the class CChannelDispatch.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class maps MIDI channels to the scale which applies to them.
+// It is used by CMultiScaleFile::Find().
+//
+// Scales of a multi scale file are assigned to MIDI channel ranges
+// (1-65535). If several scales apply to a channel, the first one in the
+// list wins. Scales without any assignment apply to all channels.
+// The resulting mapping is stored as a sorted table of non-overlapping
+// channel ranges, plus a dense table for the channels 1-16, which are
+// used most often. The memory needed depends only on the number of
+// ranges, not on the number of channels.
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_CHANNELDISPATCH_H__2D6BCED0_B335_4B04_A299_15D7B759DF51__INCLUDED_)
+#define AFX_TUN_CHANNELDISPATCH_H__2D6BCED0_B335_4B04_A299_15D7B759DF51__INCLUDED_
+
+
+
+
+
+#include <list>
+#include <vector>
+
+#include "TUN_Scale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CChannelDispatch
+{
+public:
+	static constexpr long	MaxChannel = 65535;
+	static constexpr long	NumOfDenseChannels = 16; // Channels 1-16
+
+	CChannelDispatch() { Clear(); }
+
+
+
+	// Builds the table from the assignments of the scales (in list order)
+	void	Build(const std::list<CSingleScale> & lssScales);
+	// Same for the channel assignments only (index = scale index)
+	void	Build(const std::vector<std::list<CMIDIChannelRange> > & vlmcrChannels);
+	// No scale applies to any channel
+	void	Clear();
+
+
+
+	// Returns the index of the scale (list order) which applies to the
+	// MIDI channel, or -1 if there is none. Real-time safe.
+	long	Find(long lMIDIChannel) const noexcept
+	{
+		if ( (lMIDIChannel >= 1) && (lMIDIChannel <= NumOfDenseChannels) )
+			return m_alDenseScaleIndex[lMIDIChannel - 1];
+		return FindInRanges(lMIDIChannel);
+	}
+
+
+
+private:
+	long	FindInRanges(long lMIDIChannel) const noexcept;
+
+	struct SChannelRange
+	{
+		long	lFrom;
+		long	lTo;
+		long	lScaleIndex;
+	};
+
+	// Collects the ranges of a scale, then builds the table from all of them
+	void	AddChannels(std::vector<SChannelRange> & vcrAssigned,
+						const std::list<CMIDIChannelRange> & lmcrChannels, long lScaleIndex);
+	void	BuildRanges(std::vector<SChannelRange> & vcrAssigned);
+
+	std::vector<SChannelRange>	m_vcrRanges; // Sorted, not overlapping
+	long						m_alDenseScaleIndex[NumOfDenseChannels];
+	long						m_lGlobalScaleIndex; // Scale applying to all channels or -1
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_CHANNELDISPATCH_H__2D6BCED0_B335_4B04_A299_15D7B759DF51__INCLUDED_)
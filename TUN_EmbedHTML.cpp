@@ -162,9 +162,8 @@ void CTokenPos::ReplaceToken(std::string & str,
 		{
 		case CSingleScale::KEY_AllData:
 			{
-				std::stringstream	strstr;
-				ss.Write(strstr, lVersionFrom, lVersionTo);
-				strValue = strstr.str() + "__FakeKey = ";
+				ss.WriteToString(strValue, lVersionFrom, lVersionTo);
+				strValue += "__FakeKey = ";
 			}
 			break;
 		default:
@@ -38,12 +38,6 @@ public:
 
 
 
-	virtual ~CErr()
-	{
-	}
-
-
-
 	// Checks for OK
 	bool	IsOK() const
 	{
@@ -0,0 +1,455 @@
+// TUN_FileWatcher.cpp: Implementation of the classes CWatchedFile and
+// CFileWatcher.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+#include <vector>
+
+#include "TUN_FileWatcher.h"
+#include "SCL_Import.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+// Watched files are identified by their absolute, normalized path
+static std::string NormalizePath(const std::filesystem::path & path)
+{
+	std::error_code	ec;
+	std::filesystem::path	pathAbsolute = std::filesystem::absolute(path, ec);
+	return ( ec ? path : pathAbsolute ).lexically_normal().string();
+}
+
+
+
+// Modification time or the minimum, if the file does not exist
+static std::filesystem::file_time_type GetModificationTime(const std::string & strFilepath)
+{
+	std::error_code	ec;
+	std::filesystem::file_time_type	time = std::filesystem::last_write_time(strFilepath, ec);
+	return ( ec ? std::filesystem::file_time_type::min() : time );
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CWatchedFile
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CWatchedFile::CWatchedFile(eType type, const std::string & strFilepath,
+						   const std::string & strKBMFilepath, CScalePublisher * pPublisher)
+	: m_type(type), m_strFilepath(strFilepath), m_strKBMFilepath(strKBMFilepath),
+	  m_pPublisher(pPublisher), m_nLoads(0), m_bPending(false)
+{
+	m_timeModified[0] = GetModificationTime(m_strFilepath);
+	m_timeModified[1] = ( m_strKBMFilepath.empty() ? std::filesystem::file_time_type::min()
+												   : GetModificationTime(m_strKBMFilepath) );
+}
+
+
+
+CErr CWatchedFile::GetLastError() const
+{
+	std::lock_guard<std::mutex>	lock(m_mtxErr);
+	return m_errLoad;
+}
+
+
+
+bool CWatchedFile::Load()
+{
+	CErr	err;
+
+	if ( m_type == TYPE_MultiScaleFile )
+	{
+		std::shared_ptr<CMultiScaleFile>	spMSF = std::make_shared<CMultiScaleFile>();
+		long	lResult = spMSF->Add(m_strFilepath.c_str());
+		if ( (lResult < 0) || !spMSF->Err().IsOK() )
+			err.SetError(spMSF->Err().IsOK() ? "Error reading the file." : spMSF->Err().GetLastError().c_str());
+		else
+			std::atomic_store(&m_spMultiScaleFile, std::shared_ptr<const CMultiScaleFile>(spMSF));
+	}
+	else
+	{
+		std::shared_ptr<CSingleScale>	spSS = std::make_shared<CSingleScale>();
+		if ( strx::GetAsLower(std::filesystem::path(m_strFilepath).extension().string()) == ".scl" )
+		{
+			CSCL_Import	imp;
+			if ( !m_strKBMFilepath.empty() && !imp.ReadKBM(m_strKBMFilepath.c_str()) )
+				err.SetError(imp.Err());
+			else if ( !imp.ReadSCL(m_strFilepath.c_str()) )
+				err.SetError(imp.Err());
+			else
+				imp.SetSingleScale(*spSS);
+		}
+		else if ( spSS->Read(m_strFilepath.c_str()) != 1 )
+			err.SetError(spSS->Err().IsOK() ? "No scale dataset found" : spSS->Err().GetLastError().c_str());
+
+		if ( err.IsOK() )
+		{
+			if ( m_pPublisher != NULL )
+				m_pPublisher->Publish(*spSS);
+			std::atomic_store(&m_spScale, std::shared_ptr<const CSingleScale>(spSS));
+		}
+	}
+
+	if ( err.IsOK() )
+		++m_nLoads;
+	std::lock_guard<std::mutex>	lock(m_mtxErr);
+	m_errLoad = err;
+	return err.IsOK();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CFileWatcher: Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CFileWatcher::CFileWatcher(unsigned long ulDebounceMs /* = 50 */)
+	: m_durDebounce(ulDebounceMs), m_bStop(false), m_fdNotify(-1)
+{
+	m_afdStopPipe[0] = -1;
+	m_afdStopPipe[1] = -1;
+#if defined(__linux__)
+	// Created at once, so that changes after the registration of a file
+	// are noticed even before Start()
+	m_fdNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if ( m_fdNotify < 0 )
+		m_err.SetError("Error initializing inotify.");
+	else if ( pipe2(m_afdStopPipe, O_NONBLOCK | O_CLOEXEC) != 0 )
+	{
+		m_err.SetError("Error creating a pipe.");
+		close(m_fdNotify);
+		m_fdNotify = -1;
+	}
+#endif
+}
+
+
+
+CFileWatcher::~CFileWatcher()
+{
+	Stop();
+#if defined(__linux__)
+	if ( m_fdNotify >= 0 )
+		close(m_fdNotify);
+	for ( int i = 0 ; i < 2 ; ++i )
+		if ( m_afdStopPipe[i] >= 0 )
+			close(m_afdStopPipe[i]);
+#endif
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CFileWatcher: Registration
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CWatchedFile & CFileWatcher::WatchScale(const std::string & strFilepath,
+										const std::string & strKBMFilepath /* = "" */,
+										CScalePublisher * pPublisher /* = NULL */)
+{
+	return AddFile(CWatchedFile::TYPE_Scale, strFilepath, strKBMFilepath, pPublisher);
+}
+
+
+
+CWatchedFile & CFileWatcher::WatchMultiScaleFile(const std::string & strFilepath)
+{
+	return AddFile(CWatchedFile::TYPE_MultiScaleFile, strFilepath, "", NULL);
+}
+
+
+
+void CFileWatcher::SetReloadCallback(std::function<void(const CWatchedFile &)> fnReloaded)
+{
+	std::lock_guard<std::mutex>	lock(m_mtxFiles);
+	m_fnReloaded = fnReloaded;
+}
+
+
+
+CWatchedFile & CFileWatcher::AddFile(CWatchedFile::eType type, const std::string & strFilepath,
+									 const std::string & strKBMFilepath, CScalePublisher * pPublisher)
+{
+	std::unique_ptr<CWatchedFile>	pwf(new CWatchedFile(type, NormalizePath(strFilepath),
+														 strKBMFilepath.empty() ? "" : NormalizePath(strKBMFilepath),
+														 pPublisher));
+	CWatchedFile &	wf = *pwf;
+
+	std::lock_guard<std::mutex>	lock(m_mtxFiles);
+	AddSystemWatch(wf.m_strFilepath);
+	if ( !wf.m_strKBMFilepath.empty() )
+		AddSystemWatch(wf.m_strKBMFilepath);
+	m_lpwfFiles.push_back(std::move(pwf));
+
+	// Loaded after the watch was added, so that no change gets lost
+	wf.Load();
+	return wf;
+}
+
+
+
+bool CFileWatcher::AddSystemWatch(const std::string & strFilepath)
+{
+	// IMPORTANT: m_mtxFiles is expected to be locked!
+#if defined(__linux__)
+	if ( m_fdNotify < 0 )
+		return false;
+
+	// The directory is watched, as editors often replace files by renaming
+	std::string	strDirectory = std::filesystem::path(strFilepath).parent_path().string();
+	std::list<std::pair<int, std::string> >::const_iterator	it;
+	for ( it = m_lWatchedDirectories.begin() ; it != m_lWatchedDirectories.end() ; ++it )
+		if ( it->second == strDirectory )
+			return true;
+
+	int	wd = inotify_add_watch(m_fdNotify, strDirectory.c_str(),
+							   IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_MODIFY);
+	if ( wd < 0 )
+		return m_err.SetError(("Error watching the directory " + strDirectory).c_str());
+	m_lWatchedDirectories.push_back(std::make_pair(wd, strDirectory));
+	return true;
+#else
+	(void)strFilepath;
+	return true; // Polled
+#endif
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CFileWatcher: Background thread
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+bool CFileWatcher::Start()
+{
+	if ( IsRunning() )
+		return true;
+#if defined(__linux__)
+	if ( m_fdNotify < 0 )
+		return false; // See Err()
+	// Discard a stop request of a previous run
+	char	ch;
+	while ( read(m_afdStopPipe[0], &ch, 1) > 0 )
+		;
+#endif
+	m_bStop = false;
+	m_threadWatcher = std::thread(&CFileWatcher::Run, this);
+	return true;
+}
+
+
+
+void CFileWatcher::Stop()
+{
+	if ( !IsRunning() )
+		return;
+	m_bStop = true;
+#if defined(__linux__)
+	char	ch = 0;
+	ssize_t	nWritten = write(m_afdStopPipe[1], &ch, 1); // Fails only, if the pipe is full
+	(void)nWritten;
+#endif
+	m_threadWatcher.join();
+}
+
+
+
+void CFileWatcher::Run()
+{
+	long	lTimeoutMs = ReloadPending();
+
+#if defined(__linux__)
+	pollfd	apfd[2];
+	apfd[0].fd = m_fdNotify;
+	apfd[0].events = POLLIN;
+	apfd[1].fd = m_afdStopPipe[0];
+	apfd[1].events = POLLIN;
+
+	while ( !m_bStop )
+	{
+		apfd[0].revents = 0;
+		apfd[1].revents = 0;
+		if ( (poll(apfd, 2, static_cast<int>(lTimeoutMs)) < 0) && (errno != EINTR) )
+			break;
+		if ( (apfd[1].revents != 0) || m_bStop )
+			break;
+
+		if ( apfd[0].revents & POLLIN )
+		{
+			alignas(inotify_event) char	achBuffer[4096];
+			ssize_t	nRead;
+			while ( (nRead = read(m_fdNotify, achBuffer, sizeof(achBuffer))) > 0 )
+			{
+				for ( ssize_t pos = 0 ; pos < nRead ; )
+				{
+					const inotify_event	* pEvent = reinterpret_cast<const inotify_event *>(achBuffer + pos);
+					pos += sizeof(inotify_event) + pEvent->len;
+
+					if ( pEvent->mask & IN_Q_OVERFLOW )
+					{
+						MarkChanged(""); // Events were lost
+						continue;
+					}
+					if ( pEvent->len == 0 )
+						continue; // Event of the directory itself
+
+					std::string	strDirectory;
+					{
+						std::lock_guard<std::mutex>	lock(m_mtxFiles);
+						std::list<std::pair<int, std::string> >::const_iterator	it;
+						for ( it = m_lWatchedDirectories.begin() ; it != m_lWatchedDirectories.end() ; ++it )
+							if ( it->first == pEvent->wd )
+								strDirectory = it->second;
+					}
+					if ( !strDirectory.empty() )
+						MarkChanged((std::filesystem::path(strDirectory) / pEvent->name).lexically_normal().string());
+				}
+			}
+		}
+
+		lTimeoutMs = ReloadPending();
+	}
+#else
+	// Poll the modification times
+	while ( !m_bStop )
+	{
+		std::this_thread::sleep_for(m_durDebounce);
+		{
+			std::lock_guard<std::mutex>	lock(m_mtxFiles);
+			std::chrono::steady_clock::time_point	timeReload = std::chrono::steady_clock::now() + m_durDebounce;
+			std::list<std::unique_ptr<CWatchedFile> >::iterator	it;
+			for ( it = m_lpwfFiles.begin() ; it != m_lpwfFiles.end() ; ++it )
+			{
+				CWatchedFile &	wf = **it;
+				std::filesystem::file_time_type	timeModified[2] = {
+					GetModificationTime(wf.m_strFilepath),
+					( wf.m_strKBMFilepath.empty() ? std::filesystem::file_time_type::min()
+												  : GetModificationTime(wf.m_strKBMFilepath) ) };
+				if ( (timeModified[0] != wf.m_timeModified[0]) || (timeModified[1] != wf.m_timeModified[1]) )
+				{
+					wf.m_timeModified[0] = timeModified[0];
+					wf.m_timeModified[1] = timeModified[1];
+					wf.m_bPending = true;
+					wf.m_timeReload = timeReload;
+				}
+			}
+		}
+		ReloadPending();
+	}
+	(void)lTimeoutMs;
+#endif
+}
+
+
+
+void CFileWatcher::MarkChanged(const std::string & strFilepath)
+{
+	std::lock_guard<std::mutex>	lock(m_mtxFiles);
+	std::chrono::steady_clock::time_point	timeReload = std::chrono::steady_clock::now() + m_durDebounce;
+	std::list<std::unique_ptr<CWatchedFile> >::iterator	it;
+	for ( it = m_lpwfFiles.begin() ; it != m_lpwfFiles.end() ; ++it )
+	{
+		CWatchedFile &	wf = **it;
+		if ( strFilepath.empty() || (wf.m_strFilepath == strFilepath) || (wf.m_strKBMFilepath == strFilepath) )
+		{
+			// Each further change delays the reload
+			wf.m_bPending = true;
+			wf.m_timeReload = timeReload;
+		}
+	}
+}
+
+
+
+long CFileWatcher::ReloadPending()
+{
+	std::vector<CWatchedFile *>					vpwfDue;
+	std::function<void(const CWatchedFile &)>	fnReloaded;
+	long										lTimeoutMs = -1;
+	{
+		std::lock_guard<std::mutex>	lock(m_mtxFiles);
+		std::chrono::steady_clock::time_point	timeNow = std::chrono::steady_clock::now();
+		std::list<std::unique_ptr<CWatchedFile> >::iterator	it;
+		for ( it = m_lpwfFiles.begin() ; it != m_lpwfFiles.end() ; ++it )
+		{
+			CWatchedFile &	wf = **it;
+			if ( !wf.m_bPending )
+				continue;
+			if ( wf.m_timeReload <= timeNow )
+			{
+				wf.m_bPending = false;
+				vpwfDue.push_back(&wf);
+				continue;
+			}
+			// Round up, so that the file is due after the timeout
+			long	lMs = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+							wf.m_timeReload - timeNow + std::chrono::microseconds(999)).count());
+			if ( (lTimeoutMs < 0) || (lMs < lTimeoutMs) )
+				lTimeoutMs = lMs;
+		}
+		fnReloaded = m_fnReloaded;
+	}
+
+	// Loaded without lock, so that files can be registered meanwhile
+	for ( std::size_t i = 0 ; i < vpwfDue.size() ; ++i )
+	{
+		vpwfDue[i]->Load();
+		if ( fnReloaded )
+			fnReloaded(*vpwfDue[i]);
+	}
+
+	// Changes during the loads are found in the next call
+	return ( vpwfDue.empty() ? lTimeoutMs : 0 );
+}
+
+
+
+
+
+} // namespace TUN
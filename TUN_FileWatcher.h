@@ -0,0 +1,204 @@
+// TUN_FileWatcher.h: Interface of the classes CWatchedFile and
+// CFileWatcher.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// These classes reload tuning files, when they are changed on disk
+// (e.g. by an editor), without restarting the host application.
+//
+// Each watched file (.tun, .scl with optional .kbm, or .msf) is read
+// once at registration. A background thread waits for changes of the
+// files and reloads only the changed ones. Several changes within the
+// debounce time (e.g. an editor writing a file in several steps) cause
+// one reload only. The new contents are published atomically: Readers
+// get a shared pointer to an immutable scale, which stays valid as long
+// as they hold it. If a reload fails, the old contents are kept.
+//
+// On Linux, inotify is used, so changes are picked up immediately
+// without polling. On other systems, the modification times of the
+// files are polled every debounce period.
+//
+// Usage:
+//
+//		CFileWatcher		watcher;
+//		CWatchedFile &		wf = watcher.WatchScale("scale.tun", "", &publisher);
+//		watcher.Start();
+//		...
+//		std::shared_ptr<const CSingleScale>	spSS = wf.GetScale();
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_FILEWATCHER_H__7594CD4E_66CB_4D50_8BB1_2B42FB328727__INCLUDED_)
+#define AFX_TUN_FILEWATCHER_H__7594CD4E_66CB_4D50_8BB1_2B42FB328727__INCLUDED_
+
+
+
+
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "TUN_Error.h"
+#include "TUN_Scale.h"
+#include "TUN_MultiScaleFile.h"
+#include "TUN_ScalePublisher.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CWatchedFile
+//////////////////////////////////////////////////////////////////////
+
+// A file watched by CFileWatcher. The read functions are thread safe.
+class CWatchedFile
+{
+public:
+	enum eType {
+		TYPE_Scale,				// .tun or .scl (+ .kbm)
+		TYPE_MultiScaleFile		// .msf
+	};
+
+	eType					GetType() const { return m_type; }
+	const std::string &		GetFilepath() const { return m_strFilepath; }
+	const std::string &		GetKBMFilepath() const { return m_strKBMFilepath; }
+
+	// Contents of the last successful load, NULL if there was none.
+	// GetScale() is NULL for TYPE_MultiScaleFile and vice versa.
+	std::shared_ptr<const CSingleScale>		GetScale() const { return std::atomic_load(&m_spScale); }
+	std::shared_ptr<const CMultiScaleFile>	GetMultiScaleFile() const { return std::atomic_load(&m_spMultiScaleFile); }
+
+	// Result of the last load (OK or the error, why the old contents are kept)
+	CErr			GetLastError() const;
+	// Number of successful loads (including the initial one)
+	unsigned long	GetNumOfLoads() const { return m_nLoads.load(); }
+
+
+
+private:
+	friend class CFileWatcher;
+	CWatchedFile(eType type, const std::string & strFilepath,
+				 const std::string & strKBMFilepath, CScalePublisher * pPublisher);
+
+	// Loads the file and publishes its contents, if it was read successfully
+	bool	Load();
+
+	eType									m_type;
+	std::string								m_strFilepath;
+	std::string								m_strKBMFilepath; // Empty = none
+	CScalePublisher							* m_pPublisher; // NULL = none
+
+	std::shared_ptr<const CSingleScale>		m_spScale; // Accessed atomically
+	std::shared_ptr<const CMultiScaleFile>	m_spMultiScaleFile; // Accessed atomically
+	std::atomic<unsigned long>				m_nLoads;
+	mutable std::mutex						m_mtxErr; // Guards m_errLoad
+	CErr									m_errLoad;
+
+	// Used by CFileWatcher only
+	bool									m_bPending;
+	std::chrono::steady_clock::time_point	m_timeReload;
+	std::filesystem::file_time_type			m_timeModified[2]; // File, KBM file (polling only)
+};
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CFileWatcher
+//////////////////////////////////////////////////////////////////////
+
+class CFileWatcher
+{
+public:
+	// ulDebounceMs: Time without further changes before a file is reloaded
+	explicit CFileWatcher(unsigned long ulDebounceMs = 50);
+	~CFileWatcher(); // Stops the background thread
+
+	// Watchers are not copyable
+	CFileWatcher(const CFileWatcher &) = delete;
+	CFileWatcher & operator=(const CFileWatcher &) = delete;
+
+
+
+	// Error handling (errors of the watcher, load errors are found in
+	// the watched files)
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+
+
+	// Registers a file and loads it. Files may also be registered while
+	// the watcher is running. The returned object exists as long as the
+	// watcher exists.
+	// WatchScale() takes .tun or .scl files. For .scl files, a .kbm file
+	// may be given, which is watched, too. If a publisher is given, each
+	// scale loaded is also published there (for real-time readers).
+	CWatchedFile &	WatchScale(const std::string & strFilepath,
+							   const std::string & strKBMFilepath = "",
+							   CScalePublisher * pPublisher = NULL);
+	CWatchedFile &	WatchMultiScaleFile(const std::string & strFilepath);
+
+	// Called on the background thread after each reload (successful or not)
+	void	SetReloadCallback(std::function<void(const CWatchedFile &)> fnReloaded);
+
+
+
+	// Starts/stops the background thread
+	bool	Start();
+	void	Stop();
+	bool	IsRunning() const { return m_threadWatcher.joinable(); }
+
+
+
+private:
+	CWatchedFile &	AddFile(CWatchedFile::eType type, const std::string & strFilepath,
+							const std::string & strKBMFilepath, CScalePublisher * pPublisher);
+	bool			AddSystemWatch(const std::string & strFilepath);
+	void			Run();
+	void			MarkChanged(const std::string & strFilepath); // Empty = all files
+	long			ReloadPending(); // Returns ms until the next reload or -1
+
+	std::chrono::milliseconds				m_durDebounce;
+
+	std::mutex								m_mtxFiles; // Guards the next three members
+	std::list<std::unique_ptr<CWatchedFile> >	m_lpwfFiles;
+	std::function<void(const CWatchedFile &)>	m_fnReloaded;
+	std::list<std::pair<int, std::string> >	m_lWatchedDirectories; // Watch descriptor, directory
+
+	std::thread								m_threadWatcher;
+	std::atomic<bool>						m_bStop;
+	int										m_fdNotify; // inotify instance or -1
+	int										m_afdStopPipe[2]; // Wakes up the thread on Stop()
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_FILEWATCHER_H__7594CD4E_66CB_4D50_8BB1_2B42FB328727__INCLUDED_)
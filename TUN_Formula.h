@@ -15,7 +15,10 @@
 
 #pragma warning( disable : 4786 )
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <vector>
 
 #include "TUN_Error.h"
 #include "TUN_StringTools.h"
@@ -42,7 +45,6 @@ extern const long	MaxNumOfNotes;
 struct SRVParam
 {
 	SRVParam() {}
-	virtual ~SRVParam() {}
 
 
 	// Parameter definition
@@ -68,9 +70,16 @@ struct SRVParam
 		}
 	}
 
+	// Index of the note referred to (see IsRef()); may be out of range
+	bool IsRef() const { return m_paramtype != t_Value; }
+	long GetRefIndex(long scaleNoteNumber) const
+	{
+		return ( m_paramtype == t_RelRef ? scaleNoteNumber + m_lRef : m_lRef );
+	}
+
 
 	// Set RVParameter from string with error checking
-	bool SetFromStr(const std::string & str, std::string::size_type & pos)
+	bool SetFromStr(std::string_view str, std::string_view::size_type & pos)
 	{
 		switch ( str.at(pos) )
 		{
@@ -97,6 +106,102 @@ struct SRVParam
 
 
 
+// Note frequencies with a lazily applied global factor
+//
+// Ensure_Hz steps (!) shift the whole scale by multiplying all notes
+// with a factor. Instead, only a global factor is changed (O(1)), and
+// Materialize() (also called by the destructor) applies it to the notes
+// at once. Only if a note is written while a factor is pending, each
+// note remembers the factor valid when it was written.
+//
+// CFormula::Apply() uses it for one formula, so the steps of a looped
+// Ensure_Hz formula get the product of their factors, which may differ
+// in the last bits from multiplying the notes after each step. The
+// factors of different formulas are applied one after another, so each
+// Ensure_Hz formula still costs one pass over the notes.
+// CFormulaEngine and CFormulaProgram calculate the same way, so all
+// ways of evaluating formulas give the same results.
+class CNoteFrequencies
+{
+public:
+	explicit CNoteFrequencies(std::vector<double> & vdblNoteFrequenciesHz)
+		: m_vdblNoteFrequenciesHz(vdblNoteFrequenciesHz), m_dblFactor(1) {}
+	~CNoteFrequencies() { Materialize(); }
+
+	// Note frequencies are not copyable
+	CNoteFrequencies(const CNoteFrequencies &) = delete;
+	CNoteFrequencies & operator=(const CNoteFrequencies &) = delete;
+
+
+	// Invalid indexes throw std::out_of_range, just like std::vector::at()
+	double Get(long lIndex) const
+	{
+		double	dblHz = m_vdblNoteFrequenciesHz.at(lIndex);
+		double	dblBase = ( m_vdblFactorBase.empty() ? 1 : m_vdblFactorBase[lIndex] );
+		if ( dblBase == m_dblFactor )
+			return dblHz;
+		return dblHz * (m_dblFactor / dblBase);
+	}
+
+
+	void Set(long lIndex, double dblHz)
+	{
+		if ( m_vdblFactorBase.empty() && (m_dblFactor != 1) )
+			m_vdblFactorBase.assign(m_vdblNoteFrequenciesHz.size(), 1);
+		m_vdblNoteFrequenciesHz.at(lIndex) = dblHz;
+		if ( !m_vdblFactorBase.empty() )
+			m_vdblFactorBase[lIndex] = m_dblFactor;
+	}
+
+
+	// Multiplies all notes with dblFactor
+	void Scale(double dblFactor)
+	{
+		double	dblNewFactor = m_dblFactor * dblFactor;
+		if ( !std::isfinite(dblNewFactor) || (dblNewFactor == 0) )
+		{
+			// Factors which can not be undone are applied at once
+			Materialize();
+			for ( long i = 0 ; i < MaxNumOfNotes ; ++i )
+				m_vdblNoteFrequenciesHz.at(i) *= dblFactor;
+			return;
+		}
+		m_dblFactor = dblNewFactor;
+	}
+
+
+	// Applies the pending factors to the notes
+	void Materialize()
+	{
+		if ( m_vdblFactorBase.empty() )
+		{
+			if ( m_dblFactor != 1 )
+				for ( std::size_t i = 0 ; i < m_vdblNoteFrequenciesHz.size() ; ++i )
+					m_vdblNoteFrequenciesHz[i] *= m_dblFactor;
+		}
+		else
+		{
+			for ( std::size_t i = 0 ; i < m_vdblFactorBase.size() ; ++i )
+				if ( m_vdblFactorBase[i] != m_dblFactor )
+					m_vdblNoteFrequenciesHz[i] *= m_dblFactor / m_vdblFactorBase[i];
+		}
+		Discard();
+	}
+	// Drops the pending factors, e.g. after all notes were set again
+	void Discard()
+	{
+		m_vdblFactorBase.clear();
+		m_dblFactor = 1;
+	}
+
+private:
+	std::vector<double> &	m_vdblNoteFrequenciesHz;
+	double					m_dblFactor; // Product of the Ensure_Hz factors
+	std::vector<double>		m_vdblFactorBase; // Per note: m_dblFactor when it was written; empty = all 1 (no allocation)
+};
+
+
+
 // Handling of formulas
 class CFormula
 {
@@ -105,7 +210,6 @@ public:
 	// ATTENTION: The calling source code is responsible that lMyIndex is valid!
 	// There is no error checking against it!
 	CFormula(long lMyIndex) : m_lMyIndex(lMyIndex) {}
-	virtual ~CFormula() {}
 
 	long	GetMyIndex() const { return m_lMyIndex; }
 	long	GetOpenLoopValue() const { return 999; } // Loop -999 or +999 means: Loop until the begin or end of the scale
@@ -166,46 +270,49 @@ public:
 
 	// Set formula by given string
 	// returns false on error
-	bool SetFromStr(std::string strFormula)
+	bool SetFromStr(std::string_view svFormulaWithSpaces)
 	{
 		Reset();
 
-		strx::RemoveSpaces(strFormula);
+		// Short formulas with spaces fit into the small string buffer
+		// of std::string, so there is no allocation in most cases.
+		std::string			strBuffer;
+		std::string_view	svFormula = strx::RemoveSpaces(svFormulaWithSpaces, strBuffer);
 
-		std::string::size_type	pos = 0;
-		while ( pos < strFormula.size() )
+		std::string_view::size_type	pos = 0;
+		while ( pos < svFormula.size() )
 		{
-			switch ( strFormula.at(pos++) )
+			switch ( svFormula.at(pos++) )
 			{
 			case '!': // Ensure_Hz
 				// Ensure_Hz overwrites everything else in this formula!
 				Reset();
-				if ( !strx::Eval(strFormula, pos, m_dblEnsureHz) )
+				if ( !strx::Eval(svFormula, pos, m_dblEnsureHz) )
 					return false;
-				pos = strFormula.size();
+				pos = svFormula.size();
 				break;
 			case '#': // f_Range_Hz
-				if ( !m_rvpRangeHz.SetFromStr(strFormula, pos) )
+				if ( !m_rvpRangeHz.SetFromStr(svFormula, pos) )
 					return false;
 				break;
 			case '*': // MUL
-				if ( !strx::Eval(strFormula, pos, m_dblMUL) )
+				if ( !strx::Eval(svFormula, pos, m_dblMUL) )
 					return false;
 				break;
 			case '/': // DIV
-				if ( !strx::Eval(strFormula, pos, m_dblDIV) )
+				if ( !strx::Eval(svFormula, pos, m_dblDIV) )
 					return false;
 				break;
 			case '%': // CENTS
-				if ( !strx::Eval(strFormula, pos, m_dblCENTS) )
+				if ( !strx::Eval(svFormula, pos, m_dblCENTS) )
 					return false;
 				break;
 			case '+': // f_Shift_Hz
-				if ( !m_rvpShiftHz.SetFromStr(strFormula, pos) )
+				if ( !m_rvpShiftHz.SetFromStr(svFormula, pos) )
 					return false;
 				break;
 			case '~': // Loop function
-				if ( !strx::Eval(strFormula, pos, m_lLoop) )
+				if ( !strx::Eval(svFormula, pos, m_lLoop) )
 					return false;
 				if ( m_lMyIndex + m_lLoop < 0 )
 					m_lLoop = -GetOpenLoopValue();
@@ -221,6 +328,32 @@ public:
 	}
 
 
+	// Read-access of the parameters (see SetFromStr() for their meaning)
+	double				GetEnsureHz() const { return m_dblEnsureHz; }
+	const SRVParam &	GetRangeHz() const { return m_rvpRangeHz; }
+	double				GetMUL() const { return m_dblMUL; }
+	double				GetDIV() const { return m_dblDIV; }
+	double				GetCENTS() const { return m_dblCENTS; }
+	const SRVParam &	GetShiftHz() const { return m_rvpShiftHz; }
+	long				GetLoop() const { return m_lLoop; }
+
+
+	// Set all parameters at once (e.g. from a binary file)
+	// ATTENTION: There is no error checking against the references!
+	void Set(double dblEnsureHz, const SRVParam & rvpRangeHz,
+			 double dblMUL, double dblDIV, double dblCENTS,
+			 const SRVParam & rvpShiftHz, long lLoop)
+	{
+		m_dblEnsureHz = dblEnsureHz;
+		m_rvpRangeHz = rvpRangeHz;
+		m_dblMUL = dblMUL;
+		m_dblDIV = dblDIV;
+		m_dblCENTS = dblCENTS;
+		m_rvpShiftHz = rvpShiftHz;
+		m_lLoop = lLoop;
+	}
+
+
 	// Retrieves formula as string
 	std::string	GetAsStr() const
 	{
@@ -251,8 +384,46 @@ public:
 	}
 
 
+	// Steps of Apply(): Each step evaluates the formula for one note index
+	// (see GetStepIndex()). Indexes out of range end the loop.
+	long GetNumOfSteps() const
+	{
+		long	lSteps = std::max(std::abs(m_lLoop), 1L);
+		if ( (m_lMyIndex < 0) || (m_lMyIndex >= MaxNumOfNotes) )
+			return 0;
+		return std::min(lSteps, ( m_lLoop >= 0 ? MaxNumOfNotes - m_lMyIndex : m_lMyIndex + 1 ));
+	}
+	long GetStepIndex(long lStep) const { return m_lMyIndex + ( m_lLoop >= 0 ? lStep : -lStep ); }
+	// Checks the references of all steps (Apply() throws, if one is invalid)
+	bool HasValidRefs() const
+	{
+		if ( m_dblEnsureHz > 0 )
+			return true;
+		for ( long lStep = 0 ; lStep < GetNumOfSteps() ; ++lStep )
+		{
+			long	lIndex = GetStepIndex(lStep);
+			if ( (m_rvpRangeHz.IsRef() && !IsRefIndexOK(m_rvpRangeHz.GetRefIndex(lIndex))) ||
+				 (m_rvpShiftHz.IsRef() && !IsRefIndexOK(m_rvpShiftHz.GetRefIndex(lIndex))) )
+				return false;
+		}
+		return true;
+	}
+	static bool IsRefIndexOK(long lIndex) { return (lIndex >= 0) && (lIndex < MaxNumOfNotes); }
+
+	// Value of a step with resolved RV-parameters (not for Ensure_Hz)
+	double Evaluate(double dblRangeHz, double dblShiftHz) const
+	{
+		return dblRangeHz * m_dblMUL / m_dblDIV * pow(2, m_dblCENTS/1200) + dblShiftHz;
+	}
+
+
 	// Apply formula to vector of note frequencies
 	void Apply(std::vector<double> & vdblNoteFrequenciesHz) const
+	{
+		CNoteFrequencies	nfNoteFrequencies(vdblNoteFrequenciesHz);
+		Apply(nfNoteFrequencies);
+	}
+	void Apply(CNoteFrequencies & nfNoteFrequencies) const
 	{
 		// Gets the sign of the amount of times to loop
 		// The sign will determine which direction to loop
@@ -263,16 +434,15 @@ public:
 			// The current note index in regards to the entire scale
 			long	scaleNoteIndex = m_lMyIndex + l;
 			// scaleNoteIndex can never be greater than MaxNumOfNotes, as vector
-			// 		vdblNoteFrequenciesHz's size is of MaxNumOfNotes
+			// 		of the note frequencies is of size MaxNumOfNotes
 			if ( (scaleNoteIndex < 0) || (scaleNoteIndex >= MaxNumOfNotes) )
 				break;
 
 			// Shift entire scale instead of setting it, as the ! token has been used
 			if ( m_dblEnsureHz > 0 )
 			{
-				double	dblFactor = m_dblEnsureHz / vdblNoteFrequenciesHz.at(scaleNoteIndex);
-				for ( long i = 0 ; i < MaxNumOfNotes ; ++i )
-					vdblNoteFrequenciesHz.at(i) *= dblFactor;
+				double	dblFactor = m_dblEnsureHz / nfNoteFrequencies.Get(scaleNoteIndex);
+				nfNoteFrequencies.Scale(dblFactor);
 			}
 			else // ! token hasn't been used.
 			{
@@ -282,13 +452,14 @@ public:
 				// If #> : Gets the frequency of another note in the scale,
 				// 		where that index is the current note index offset by an integer
 				// (Relative reference)
-				double	dblRangeHz = m_rvpRangeHz.GetValue(vdblNoteFrequenciesHz, scaleNoteIndex);
+				double	dblRangeHz = ( m_rvpRangeHz.IsRef() ?
+									   nfNoteFrequencies.Get(m_rvpRangeHz.GetRefIndex(scaleNoteIndex)) : m_rvpRangeHz.m_dblValue );
 				// Token +
-				double	dblShiftHz = m_rvpShiftHz.GetValue(vdblNoteFrequenciesHz, scaleNoteIndex);
+				double	dblShiftHz = ( m_rvpShiftHz.IsRef() ?
+									   nfNoteFrequencies.Get(m_rvpShiftHz.GetRefIndex(scaleNoteIndex)) : m_rvpShiftHz.m_dblValue );
 
 				// Calculate
-				vdblNoteFrequenciesHz.at(scaleNoteIndex) =
-					dblRangeHz * m_dblMUL / m_dblDIV * pow(2, m_dblCENTS/1200) + dblShiftHz;
+				nfNoteFrequencies.Set(scaleNoteIndex, Evaluate(dblRangeHz, dblShiftHz));
 			}
 			l += lInc;
 		} while ( std::abs(l) < std::abs(m_lLoop) );
@@ -0,0 +1,410 @@
+// TUN_FormulaEngine.cpp: Implementation of the class CFormulaEngine.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "TUN_FormulaEngine.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+static const std::uint64_t	KeyGap = static_cast<std::uint64_t>(1) << 32;
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CFormulaEngine::CFormulaEngine()
+	: m_nEvaluatedSteps(0)
+{
+	Init(CSingleScale().GetNoteFrequenciesHz());
+}
+
+
+
+void CFormulaEngine::Init(const std::vector<double> & vdblInitialHz)
+{
+	m_vdblInitialHz = vdblInitialHz;
+	m_vdblInitialHz.resize(MaxNumOfNotes, 0);
+	m_vdblNoteFrequenciesHz = m_vdblInitialHz;
+
+	m_vullKeys.clear();
+	m_mapFormulas.clear();
+	m_vmapWrites.assign(MaxNumOfNotes, std::map<SStepKey, double>());
+	m_vsetReaders.assign(MaxNumOfNotes, std::set<SStepKey>());
+	m_setPending.clear();
+	m_mapEnsureHzStates.clear();
+	m_nEvaluatedSteps = 0;
+	m_err.SetOK();
+}
+
+
+
+bool CFormulaEngine::Init(const CSingleScale & SS)
+{
+	CSingleScale	ssEqual;
+	ssEqual.InitEqual(SS.GetBaseNote(), SS.GetBaseFreqHz());
+	Init(ssEqual.GetNoteFrequenciesHz());
+
+	// Add all formulas first, so that each step is evaluated once only
+	std::list<CFormula>::const_iterator	it;
+	for ( it = SS.GetFormulas().begin() ; it != SS.GetFormulas().end() ; ++it )
+	{
+		if ( !CheckFormula(*it) )
+			break;
+		m_vullKeys.push_back(KeyGap * (m_vullKeys.size() + 1));
+		AddSteps(m_vullKeys.back(), *it);
+	}
+	EvaluatePendingSteps();
+	return m_err.IsOK();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Changing the formulas
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+std::list<CFormula> CFormulaEngine::GetFormulas() const
+{
+	std::list<CFormula>	lformulas;
+	for ( std::size_t i = 0 ; i < m_vullKeys.size() ; ++i )
+		lformulas.push_back(m_mapFormulas.at(m_vullKeys[i]));
+	return lformulas;
+}
+
+
+
+bool CFormulaEngine::AddFormula(const CFormula & formula)
+{
+	return InsertFormula(GetNumOfFormulas(), formula);
+}
+
+
+
+bool CFormulaEngine::InsertFormula(long lIndex, const CFormula & formula)
+{
+	if ( (lIndex < 0) || (lIndex > GetNumOfFormulas()) )
+		return m_err.SetError("Invalid formula index!");
+	if ( !CheckFormula(formula) )
+		return false;
+	m_nEvaluatedSteps = 0;
+
+	// Find a key between the neighbours. If there is none left, all
+	// formulas get new keys.
+	std::uint64_t	ullPrev = ( lIndex > 0 ? m_vullKeys[lIndex-1] : 0 );
+	std::uint64_t	ullNext = ( lIndex < GetNumOfFormulas() ? m_vullKeys[lIndex] :
+								( ullPrev <= std::numeric_limits<std::uint64_t>::max() - KeyGap ? ullPrev + KeyGap : ullPrev ) );
+	if ( ullNext - ullPrev < 2 )
+	{
+		std::vector<CFormula>	vformulas;
+		for ( std::size_t i = 0 ; i < m_vullKeys.size() ; ++i )
+			vformulas.push_back(m_mapFormulas.at(m_vullKeys[i]));
+		vformulas.insert(vformulas.begin() + lIndex, formula);
+		Rebuild(vformulas);
+		return m_err.SetOK();
+	}
+
+	std::uint64_t	ullKey = ( lIndex < GetNumOfFormulas() ? ullPrev + (ullNext - ullPrev) / 2 : ullNext );
+	m_vullKeys.insert(m_vullKeys.begin() + lIndex, ullKey);
+	AddSteps(ullKey, formula);
+	EvaluatePendingSteps();
+	return m_err.SetOK();
+}
+
+
+
+bool CFormulaEngine::SetFormula(long lIndex, const CFormula & formula)
+{
+	if ( (lIndex < 0) || (lIndex >= GetNumOfFormulas()) )
+		return m_err.SetError("Invalid formula index!");
+	if ( !CheckFormula(formula) )
+		return false;
+	m_nEvaluatedSteps = 0;
+
+	RemoveSteps(m_vullKeys[lIndex]);
+	AddSteps(m_vullKeys[lIndex], formula);
+	EvaluatePendingSteps();
+	return m_err.SetOK();
+}
+
+
+
+bool CFormulaEngine::RemoveFormula(long lIndex)
+{
+	if ( (lIndex < 0) || (lIndex >= GetNumOfFormulas()) )
+		return m_err.SetError("Invalid formula index!");
+	m_nEvaluatedSteps = 0;
+
+	RemoveSteps(m_vullKeys[lIndex]);
+	m_vullKeys.erase(m_vullKeys.begin() + lIndex);
+	EvaluatePendingSteps();
+	return m_err.SetOK();
+}
+
+
+
+bool CFormulaEngine::CheckFormula(const CFormula & formula)
+{
+	if ( !formula.HasValidRefs() )
+		return m_err.SetError("Formula refers to an invalid note index!");
+	return true;
+}
+
+
+
+void CFormulaEngine::AddSteps(std::uint64_t ullKey, const CFormula & formula)
+{
+	m_mapFormulas.insert(std::make_pair(ullKey, formula));
+
+	std::vector<long>	vlNotes;
+	for ( long lStep = 0 ; lStep < formula.GetNumOfSteps() ; ++lStep )
+	{
+		SStepKey	key = { ullKey, lStep };
+		GetReadNotes(formula, lStep, vlNotes);
+		for ( std::size_t i = 0 ; i < vlNotes.size() ; ++i )
+			m_vsetReaders[vlNotes[i]].insert(key);
+		m_setPending.insert(key);
+	}
+}
+
+
+
+void CFormulaEngine::RemoveSteps(std::uint64_t ullKey)
+{
+	const CFormula &	formula = m_mapFormulas.at(ullKey);
+	long				lNumOfSteps = formula.GetNumOfSteps();
+
+	// The steps do not read anymore, ...
+	std::vector<long>	vlNotes;
+	for ( long lStep = 0 ; lStep < lNumOfSteps ; ++lStep )
+	{
+		SStepKey	key = { ullKey, lStep };
+		GetReadNotes(formula, lStep, vlNotes);
+		for ( std::size_t i = 0 ; i < vlNotes.size() ; ++i )
+			m_vsetReaders[vlNotes[i]].erase(key);
+		m_setPending.erase(key);
+	}
+
+	// ... so the steps reading their notes get the values written before
+	for ( long lStep = 0 ; lStep < lNumOfSteps ; ++lStep )
+	{
+		SStepKey	key = { ullKey, lStep };
+		if ( formula.GetEnsureHz() > 0 )
+		{
+			for ( long lNote = 0 ; lNote < MaxNumOfNotes ; ++lNote )
+				RemoveValue(lNote, key);
+			m_mapEnsureHzStates.erase(key);
+		}
+		else
+			RemoveValue(formula.GetStepIndex(lStep), key);
+	}
+
+	m_mapFormulas.erase(ullKey);
+}
+
+
+
+void CFormulaEngine::Rebuild(const std::vector<CFormula> & vformulas)
+{
+	Init(std::vector<double>(m_vdblInitialHz));
+	for ( std::size_t i = 0 ; i < vformulas.size() ; ++i )
+	{
+		m_vullKeys.push_back(KeyGap * (i + 1));
+		AddSteps(m_vullKeys.back(), vformulas[i]);
+	}
+	EvaluatePendingSteps();
+}
+
+
+
+void CFormulaEngine::GetReadNotes(const CFormula & formula, long lStep, std::vector<long> & vlNotes) const
+{
+	vlNotes.clear();
+	long	lIndex = formula.GetStepIndex(lStep);
+	if ( formula.GetEnsureHz() > 0 )
+	{
+		// All notes are multiplied by the factor of the note lIndex
+		for ( long lNote = 0 ; lNote < MaxNumOfNotes ; ++lNote )
+			vlNotes.push_back(lNote);
+		return;
+	}
+	if ( formula.GetRangeHz().IsRef() )
+		vlNotes.push_back(formula.GetRangeHz().GetRefIndex(lIndex));
+	if ( formula.GetShiftHz().IsRef() )
+		vlNotes.push_back(formula.GetShiftHz().GetRefIndex(lIndex));
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Evaluation
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+double CFormulaEngine::GetValue(long lNote, const SStepKey & key) const
+{
+	// Last value written before the step
+	const std::map<SStepKey, double> &			mapWrites = m_vmapWrites[lNote];
+	std::map<SStepKey, double>::const_iterator	it = mapWrites.lower_bound(key);
+	if ( it == mapWrites.begin() )
+		return m_vdblInitialHz[lNote];
+	--it;
+	return it->second;
+}
+
+
+
+void CFormulaEngine::SetValue(long lNote, const SStepKey & key, double dblValue)
+{
+	std::map<SStepKey, double> &			mapWrites = m_vmapWrites[lNote];
+	std::map<SStepKey, double>::iterator	it = mapWrites.find(key);
+	if ( it != mapWrites.end() )
+	{
+		// Same value (bitwise, also for NaN): The readers need not be evaluated
+		if ( std::memcmp(&it->second, &dblValue, sizeof(double)) == 0 )
+			return;
+		it->second = dblValue;
+	}
+	else
+		mapWrites.insert(std::make_pair(key, dblValue));
+	AddDependentSteps(lNote, key);
+}
+
+
+
+void CFormulaEngine::RemoveValue(long lNote, const SStepKey & key)
+{
+	std::map<SStepKey, double> &			mapWrites = m_vmapWrites[lNote];
+	std::map<SStepKey, double>::iterator	it = mapWrites.find(key);
+	if ( it == mapWrites.end() )
+		return;
+	AddDependentSteps(lNote, key);
+	mapWrites.erase(it);
+}
+
+
+
+void CFormulaEngine::AddDependentSteps(long lNote, const SStepKey & key)
+{
+	// The readers up to the next write of the note (inclusive, as a step
+	// reads before it writes) see the value written at key
+	const std::map<SStepKey, double> &			mapWrites = m_vmapWrites[lNote];
+	const std::set<SStepKey> &					setReaders = m_vsetReaders[lNote];
+	std::map<SStepKey, double>::const_iterator	itNext = mapWrites.upper_bound(key);
+	std::set<SStepKey>::const_iterator			itBegin = setReaders.upper_bound(key);
+	std::set<SStepKey>::const_iterator			itEnd = ( itNext == mapWrites.end() ?
+														  setReaders.end() : setReaders.upper_bound(itNext->first) );
+	m_setPending.insert(itBegin, itEnd);
+}
+
+
+
+void CFormulaEngine::EvaluateStep(const SStepKey & key)
+{
+	const CFormula &	formula = m_mapFormulas.at(key.ullFormulaKey);
+	long				lIndex = formula.GetStepIndex(key.lStep);
+
+	// Same calculation as CFormula::Apply()
+	if ( formula.GetEnsureHz() > 0 )
+	{
+		// The factors of the steps are multiplied like in CNoteFrequencies::Scale()
+		// and the product is applied to the values before the formula
+		SEnsureHzState	state = { 1, 0 };
+		if ( key.lStep > 0 )
+			state = m_mapEnsureHzStates.at(SStepKey{ key.ullFormulaKey, key.lStep-1 });
+		SStepKey	keyBase = { key.ullFormulaKey, state.lBaseStep };
+		double		dblFactor = formula.GetEnsureHz() / (GetValue(lIndex, keyBase) * state.dblFactor);
+		double		dblNewFactor = state.dblFactor * dblFactor;
+		if ( std::isfinite(dblNewFactor) && (dblNewFactor != 0) )
+		{
+			state.dblFactor = dblNewFactor;
+			for ( long lNote = 0 ; lNote < MaxNumOfNotes ; ++lNote )
+				SetValue(lNote, key, GetValue(lNote, keyBase) * state.dblFactor);
+		}
+		else
+		{
+			// Applied at once
+			for ( long lNote = 0 ; lNote < MaxNumOfNotes ; ++lNote )
+				SetValue(lNote, key, GetValue(lNote, keyBase) * state.dblFactor * dblFactor);
+			state.dblFactor = 1;
+			state.lBaseStep = key.lStep + 1;
+		}
+
+		// The next step depends on the factor, even if no value changed
+		std::map<SStepKey, SEnsureHzState>::iterator	it = m_mapEnsureHzStates.find(key);
+		bool	bChanged = ( (it == m_mapEnsureHzStates.end()) ||
+							 (std::memcmp(&it->second.dblFactor, &state.dblFactor, sizeof(double)) != 0) ||
+							 (it->second.lBaseStep != state.lBaseStep) );
+		m_mapEnsureHzStates[key] = state;
+		if ( bChanged && (key.lStep+1 < formula.GetNumOfSteps()) )
+			m_setPending.insert(SStepKey{ key.ullFormulaKey, key.lStep+1 });
+	}
+	else
+	{
+		const SRVParam &	rvpRangeHz = formula.GetRangeHz();
+		const SRVParam &	rvpShiftHz = formula.GetShiftHz();
+		double	dblRangeHz = ( rvpRangeHz.IsRef() ? GetValue(rvpRangeHz.GetRefIndex(lIndex), key) : rvpRangeHz.m_dblValue );
+		double	dblShiftHz = ( rvpShiftHz.IsRef() ? GetValue(rvpShiftHz.GetRefIndex(lIndex), key) : rvpShiftHz.m_dblValue );
+		SetValue(lIndex, key, formula.Evaluate(dblRangeHz, dblShiftHz));
+	}
+}
+
+
+
+void CFormulaEngine::EvaluatePendingSteps()
+{
+	// In list order, so that each step is evaluated once with its final
+	// input values (steps only depend on steps before them)
+	while ( !m_setPending.empty() )
+	{
+		SStepKey	key = *m_setPending.begin();
+		m_setPending.erase(m_setPending.begin());
+		EvaluateStep(key);
+		++m_nEvaluatedSteps;
+	}
+
+	for ( long lNote = 0 ; lNote < MaxNumOfNotes ; ++lNote )
+		m_vdblNoteFrequenciesHz[lNote] = ( m_vmapWrites[lNote].empty() ?
+										   m_vdblInitialHz[lNote] : m_vmapWrites[lNote].rbegin()->second );
+}
+
+
+
+
+
+} // namespace TUN
@@ -0,0 +1,166 @@
+// TUN_FormulaEngine.h: Interface of the class CFormulaEngine.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class evaluates a list of formulas (see CFormula) incrementally,
+// e.g. for an editor which changes single formulas of a long history.
+//
+// The result is always the same as applying all formulas in list order
+// to the initial frequencies (see CFormula::Apply()). But instead of
+// applying all formulas again after each change, the engine keeps the
+// dependencies between the steps of the formulas: Each step writes one
+// note (Ensure_Hz steps write all notes) and reads the notes referred
+// to by #= and #> at that time. When a formula is changed, added or
+// removed, only the steps reading a note whose value changed are
+// evaluated again, in list order. Steps whose result does not change
+// stop the propagation.
+//
+// Usage:
+//
+//		CFormulaEngine	engine;
+//		engine.Init(SS);				// Equal tuning and formulas of SS
+//		engine.SetFormula(5, formula);	// Evaluates the notes depending on formula 5
+//		SS.SetFormulas(engine);
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_FORMULAENGINE_H__B7A41E0D_2C95_4F3A_8E67_5D9C13F0A2B4__INCLUDED_)
+#define AFX_TUN_FORMULAENGINE_H__B7A41E0D_2C95_4F3A_8E67_5D9C13F0A2B4__INCLUDED_
+
+
+
+
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "TUN_Error.h"
+#include "TUN_Formula.h"
+#include "TUN_Scale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CFormulaEngine
+{
+public:
+	CFormulaEngine();
+
+
+
+	// Error handling
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+
+
+	// Sets the initial frequencies (MaxNumOfNotes values) and removes all
+	// formulas
+	void	Init(const std::vector<double> & vdblInitialHz);
+	// Uses the equal tuning (see CSingleScale::InitEqual()) and the
+	// formulas of the scale. Returns false, if a formula refers to an
+	// invalid note index (the formulas before are kept).
+	bool	Init(const CSingleScale & SS);
+
+
+
+	// Access to the formulas (index = position in the list)
+	long				GetNumOfFormulas() const { return static_cast<long>(m_vullKeys.size()); }
+	const CFormula &	GetFormula(long lIndex) const { return m_mapFormulas.at(m_vullKeys.at(lIndex)); }
+	std::list<CFormula>	GetFormulas() const;
+
+	// Changing the formulas. These functions return false and change
+	// nothing, if the index is invalid or a step of the formula refers
+	// to an invalid note index (CFormula::Apply() would throw).
+	bool	AddFormula(const CFormula & formula);
+	bool	InsertFormula(long lIndex, const CFormula & formula);
+	bool	SetFormula(long lIndex, const CFormula & formula);
+	bool	RemoveFormula(long lIndex);
+
+
+
+	// The result
+	const std::vector<double> &	GetInitialFrequenciesHz() const { return m_vdblInitialHz; }
+	const std::vector<double> &	GetNoteFrequenciesHz() const { return m_vdblNoteFrequenciesHz; }
+
+	// Number of formula steps evaluated by the last change
+	unsigned long	GetNumOfEvaluatedSteps() const { return m_nEvaluatedSteps; }
+
+
+
+private:
+	// Steps are ordered by the key of their formula, then by the step
+	// number. The keys of the formulas have gaps, so that formulas can be
+	// inserted without changing the keys of the others.
+	struct SStepKey
+	{
+		std::uint64_t	ullFormulaKey;
+		long			lStep;
+
+		bool operator<(const SStepKey & other) const
+		{
+			return ( ullFormulaKey != other.ullFormulaKey ? ullFormulaKey < other.ullFormulaKey : lStep < other.lStep );
+		}
+	};
+
+	// Ensure_Hz factor after a step (see CNoteFrequencies): The notes
+	// written by the step are the values before the step lBaseStep of the
+	// same formula, multiplied by dblFactor
+	struct SEnsureHzState
+	{
+		double	dblFactor;
+		long	lBaseStep;
+	};
+
+	bool	CheckFormula(const CFormula & formula);
+	void	AddSteps(std::uint64_t ullKey, const CFormula & formula);
+	void	RemoveSteps(std::uint64_t ullKey);
+	void	Rebuild(const std::vector<CFormula> & vformulas); // Assigns new keys and evaluates all formulas
+	void	GetReadNotes(const CFormula & formula, long lStep, std::vector<long> & vlNotes) const;
+
+	double	GetValue(long lNote, const SStepKey & key) const; // Value seen by the step
+	void	SetValue(long lNote, const SStepKey & key, double dblValue);
+	void	RemoveValue(long lNote, const SStepKey & key);
+	void	AddDependentSteps(long lNote, const SStepKey & key); // Readers after the write
+	void	EvaluateStep(const SStepKey & key);
+	void	EvaluatePendingSteps();
+
+	std::vector<double>							m_vdblInitialHz;
+	std::vector<double>							m_vdblNoteFrequenciesHz;
+
+	std::vector<std::uint64_t>					m_vullKeys; // Keys of the formulas in list order
+	std::map<std::uint64_t, CFormula>			m_mapFormulas;
+
+	std::vector<std::map<SStepKey, double> >	m_vmapWrites; // Per note: Value written by the steps
+	std::vector<std::set<SStepKey> >			m_vsetReaders; // Per note: Steps reading the note
+	std::set<SStepKey>							m_setPending; // Steps to evaluate, in list order
+	std::map<SStepKey, SEnsureHzState>			m_mapEnsureHzStates; // Per Ensure_Hz step
+	unsigned long								m_nEvaluatedSteps;
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_FORMULAENGINE_H__B7A41E0D_2C95_4F3A_8E67_5D9C13F0A2B4__INCLUDED_)
@@ -0,0 +1,232 @@
+// TUN_FormulaProgram.cpp: Implementation of the class CFormulaProgram.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#include "TUN_FormulaProgram.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+// Value of an RV-parameter at a note
+static double GetOperand(const SRVParam & rvp, const double * pdblNotes, long lIndex)
+{
+	switch ( rvp.m_paramtype )
+	{
+	case SRVParam::t_AbsRef:	return pdblNotes[rvp.m_lRef];
+	case SRVParam::t_RelRef:	return pdblNotes[lIndex + rvp.m_lRef];
+	default:					return rvp.m_dblValue;
+	}
+}
+
+
+
+// Values of an RV-parameter at the notes lFirst to lFirst+lCount-1
+static void LoadOperand(const SRVParam & rvp, const double * pdblNotes,
+						long lFirst, long lCount, double * pdblOperand)
+{
+	if ( rvp.m_paramtype == SRVParam::t_RelRef )
+	{
+		std::memcpy(pdblOperand, pdblNotes + lFirst + rvp.m_lRef, lCount * sizeof(double));
+		return;
+	}
+	double	dblValue = GetOperand(rvp, pdblNotes, lFirst);
+	for ( long i = 0 ; i < lCount ; ++i )
+		pdblOperand[i] = dblValue;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Compiling
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+bool CFormulaProgram::Compile(const std::list<CFormula> & lformulas)
+{
+	m_vInstructions.clear();
+	m_vInstructions.reserve(lformulas.size());
+
+	std::list<CFormula>::const_iterator	it;
+	for ( it = lformulas.begin() ; it != lformulas.end() ; ++it )
+	{
+		const CFormula &	formula = *it;
+		SInstruction		ins;
+		ins.lFirst = formula.GetMyIndex();
+		ins.lCount = formula.GetNumOfSteps();
+		ins.lInc = ( formula.GetLoop() >= 0 ? +1 : -1 );
+		ins.rvpRangeHz = formula.GetRangeHz();
+		ins.rvpShiftHz = formula.GetShiftHz();
+		ins.dblMUL = formula.GetMUL();
+		ins.dblDIV = formula.GetDIV();
+		ins.dblCentsFactor = pow(2, formula.GetCENTS()/1200);
+		ins.dblValue = 0;
+		if ( ins.lCount == 0 )
+			continue; // Note index out of range: Apply() does nothing
+
+		if ( formula.GetEnsureHz() > 0 )
+		{
+			ins.op = OP_EnsureHz;
+			ins.dblValue = formula.GetEnsureHz();
+			m_vInstructions.push_back(ins);
+			continue;
+		}
+
+		if ( !formula.HasValidRefs() )
+		{
+			m_vInstructions.clear();
+			return m_err.SetError("Formula refers to an invalid note index!");
+		}
+
+		if ( !ins.rvpRangeHz.IsRef() && !ins.rvpShiftHz.IsRef() )
+		{
+			ins.op = OP_Fill;
+			ins.dblValue = formula.Evaluate(ins.rvpRangeHz.m_dblValue, ins.rvpShiftHz.m_dblValue);
+		}
+		else if ( (ins.lCount > 1) &&
+				  IsIndependent(ins.rvpRangeHz, ins.lFirst, ins.lCount, ins.lInc) &&
+				  IsIndependent(ins.rvpShiftHz, ins.lFirst, ins.lCount, ins.lInc) )
+			ins.op = OP_Map;
+		else
+			ins.op = OP_Loop;
+
+		// Independent steps can be evaluated in ascending order
+		if ( (ins.op != OP_Loop) && (ins.lInc < 0) )
+		{
+			ins.lFirst -= ins.lCount - 1;
+			ins.lInc = +1;
+		}
+		m_vInstructions.push_back(ins);
+	}
+
+	return m_err.SetOK();
+}
+
+
+
+// Checks whether no step reads a note written by a step before
+bool CFormulaProgram::IsIndependent(const SRVParam & rvp, long lFirst, long lCount, long lInc)
+{
+	switch ( rvp.m_paramtype )
+	{
+	case SRVParam::t_AbsRef:
+		{
+			// Step writing the referred note; the last step reads before it writes
+			long	lStep = (rvp.m_lRef - lFirst) * lInc;
+			return (lStep < 0) || (lStep >= lCount - 1);
+		}
+	case SRVParam::t_RelRef:
+		return (rvp.m_lRef * lInc >= 0) || (std::abs(rvp.m_lRef) >= lCount);
+	default:
+		return true;
+	}
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Running
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+void CFormulaProgram::Run(std::vector<double> & vdblNoteFrequenciesHz) const
+{
+	assert(static_cast<long>(vdblNoteFrequenciesHz.size()) >= MaxNumOfNotes);
+	double	* pdblNotes = vdblNoteFrequenciesHz.data();
+
+	// Operands of OP_Map, taken before the notes are written
+	std::vector<double>	vdblRangeHz(MaxNumOfNotes);
+	std::vector<double>	vdblShiftHz(MaxNumOfNotes);
+	double	* pdblRangeHz = vdblRangeHz.data();
+	double	* pdblShiftHz = vdblShiftHz.data();
+
+	// The calculations are the same as in CFormula::Apply()
+	std::vector<SInstruction>::const_iterator	it;
+	for ( it = m_vInstructions.begin() ; it != m_vInstructions.end() ; ++it )
+	{
+		const SInstruction &	ins = *it;
+		switch ( ins.op )
+		{
+		case OP_Fill:
+			for ( long i = 0 ; i < ins.lCount ; ++i )
+				pdblNotes[ins.lFirst + i] = ins.dblValue;
+			break;
+
+		case OP_Map:
+			{
+				LoadOperand(ins.rvpRangeHz, pdblNotes, ins.lFirst, ins.lCount, pdblRangeHz);
+				LoadOperand(ins.rvpShiftHz, pdblNotes, ins.lFirst, ins.lCount, pdblShiftHz);
+				double	* pdblDest = pdblNotes + ins.lFirst;
+				for ( long i = 0 ; i < ins.lCount ; ++i )
+					pdblDest[i] = pdblRangeHz[i] * ins.dblMUL / ins.dblDIV * ins.dblCentsFactor + pdblShiftHz[i];
+			}
+			break;
+
+		case OP_Loop:
+			for ( long lStep = 0, lIndex = ins.lFirst ; lStep < ins.lCount ; ++lStep, lIndex += ins.lInc )
+			{
+				double	dblRangeHz = GetOperand(ins.rvpRangeHz, pdblNotes, lIndex);
+				double	dblShiftHz = GetOperand(ins.rvpShiftHz, pdblNotes, lIndex);
+				pdblNotes[lIndex] = dblRangeHz * ins.dblMUL / ins.dblDIV * ins.dblCentsFactor + dblShiftHz;
+			}
+			break;
+
+		case OP_EnsureHz:
+			{
+				// The factors of the steps are multiplied like in
+				// CNoteFrequencies::Scale() and applied at the end
+				double	dblProduct = 1;
+				for ( long lStep = 0, lIndex = ins.lFirst ; lStep < ins.lCount ; ++lStep, lIndex += ins.lInc )
+				{
+					double	dblFactor = ins.dblValue / (pdblNotes[lIndex] * dblProduct);
+					double	dblNewProduct = dblProduct * dblFactor;
+					if ( std::isfinite(dblNewProduct) && (dblNewProduct != 0) )
+					{
+						dblProduct = dblNewProduct;
+						continue;
+					}
+					// Applied at once
+					for ( long i = 0 ; i < MaxNumOfNotes ; ++i )
+						pdblNotes[i] = pdblNotes[i] * dblProduct * dblFactor;
+					dblProduct = 1;
+				}
+				if ( dblProduct != 1 )
+					for ( long i = 0 ; i < MaxNumOfNotes ; ++i )
+						pdblNotes[i] *= dblProduct;
+			}
+			break;
+		}
+	}
+}
+
+
+
+
+
+} // namespace TUN
@@ -0,0 +1,115 @@
+// TUN_FormulaProgram.h: Interface of the class CFormulaProgram.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class compiles a list of formulas (see CFormula) into a flat
+// array of instructions, which derives the note frequencies much faster
+// than applying the formulas one after another, e.g. to recalculate a
+// long formula history after each edit in a tuning editor.
+//
+// The compiler checks the references once and resolves what does not
+// depend on the notes: The cents factors pow(2, CENTS/1200) are computed
+// in advance and formulas without references become constants. Loops
+// (~) whose steps do not read notes written by the loop itself are
+// evaluated as independent operations over the note range, which the
+// compiler can vectorize. Only loops with references to notes written
+// before within the loop are evaluated step by step.
+//
+// The result is the same as applying the formulas in list order with
+// CFormula::Apply() to a std::vector (including the Ensure_Hz factors,
+// see CNoteFrequencies).
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_FORMULAPROGRAM_H__6E2D9F41_73A8_4B1C_9D05_C84F2B6A1E37__INCLUDED_)
+#define AFX_TUN_FORMULAPROGRAM_H__6E2D9F41_73A8_4B1C_9D05_C84F2B6A1E37__INCLUDED_
+
+
+
+
+
+#include <list>
+#include <vector>
+
+#include "TUN_Error.h"
+#include "TUN_Formula.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CFormulaProgram
+{
+public:
+	CFormulaProgram() {}
+
+
+
+	// Error handling
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+
+
+	// Compiles the formulas. Returns false and leaves the program empty,
+	// if a step of a formula refers to an invalid note index
+	// (CFormula::Apply() would throw).
+	bool	Compile(const std::list<CFormula> & lformulas);
+	void	Clear() { m_vInstructions.clear(); }
+	long	GetNumOfInstructions() const { return static_cast<long>(m_vInstructions.size()); }
+
+	// Applies the program to the note frequencies (MaxNumOfNotes values)
+	void	Run(std::vector<double> & vdblNoteFrequenciesHz) const;
+
+
+
+private:
+	enum eOpCode
+	{
+		OP_Fill,		// Notes get a constant value (dblValue)
+		OP_Map,			// Steps are independent of each other
+		OP_Loop,		// Steps are evaluated one after another
+		OP_EnsureHz		// All notes are shifted, so that note lFirst gets dblValue Hz
+	};
+
+	struct SInstruction
+	{
+		eOpCode		op;
+		long		lFirst; // Note index of the first step
+		long		lCount; // Number of steps
+		long		lInc; // +1 or -1 (OP_Map: always +1)
+		SRVParam	rvpRangeHz;
+		SRVParam	rvpShiftHz;
+		double		dblMUL;
+		double		dblDIV;
+		double		dblCentsFactor; // pow(2, CENTS/1200)
+		double		dblValue;
+	};
+
+	static bool	IsIndependent(const SRVParam & rvp, long lFirst, long lCount, long lInc);
+
+	std::vector<SInstruction>	m_vInstructions;
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_FORMULAPROGRAM_H__6E2D9F41_73A8_4B1C_9D05_C84F2B6A1E37__INCLUDED_)
@@ -32,7 +32,6 @@ class CMIDIChannelRange
 {
 public:
 	CMIDIChannelRange() { Reset(); }
-	virtual ~CMIDIChannelRange() {}
 
 
 	void Reset()
@@ -43,22 +42,24 @@ public:
 
 	// Sets range by a string which can have the syntax "#" or "#-#"
 	// whereas '#' denotes a positive integer number
-	bool SetFromStr(std::string str)
+	bool SetFromStr(std::string_view svRange)
 	{
 		Reset();
 
-		std::string::size_type	pos = 0;
-		long					lFrom;
-		long					lTo;
-		if ( !strx::Eval(strx::RemoveSpaces(str), pos, lFrom) )
+		std::string					strBuffer;
+		std::string_view			svNoSpaces = strx::RemoveSpaces(svRange, strBuffer);
+		std::string_view::size_type	pos = 0;
+		long						lFrom;
+		long						lTo;
+		if ( !strx::Eval(svNoSpaces, pos, lFrom) )
 			return false;
-		if ( pos == str.size() )
+		if ( pos == svNoSpaces.size() )
 			return Set(lFrom);
 		else
 		{
-			if ( str.at(pos++) != '-' )
+			if ( svNoSpaces.at(pos++) != '-' )
 				return false; // '-' missing
-			if ( !strx::Eval(str, pos, lTo) )
+			if ( !strx::Eval(svNoSpaces, pos, lTo) )
 				return false;
 			return Set(lFrom, lTo);
 		}
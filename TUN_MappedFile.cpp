@@ -0,0 +1,273 @@
+// TUN_MappedFile.cpp: Implementation of the class CMappedFile.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <random>
+#include <thread>
+
+#include "TUN_MappedFile.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CMappedFile::CMappedFile()
+	: m_bOpen(false), m_pData(NULL), m_sizeData(0), m_pMapping(NULL)
+#if defined(_WIN32)
+	, m_hMapping(NULL)
+#endif
+{
+}
+
+
+
+CMappedFile::~CMappedFile()
+{
+	Close();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Mapping
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+#if defined(_WIN32)
+
+
+
+bool CMappedFile::Open(const char * szFilepath)
+{
+	Close();
+
+	HANDLE	hFile = CreateFileA(szFilepath, GENERIC_READ, FILE_SHARE_READ, NULL,
+								OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if ( hFile == INVALID_HANDLE_VALUE )
+		return false;
+
+	// Only regular files can be mapped
+	LARGE_INTEGER	liSize;
+	if ( (GetFileType(hFile) != FILE_TYPE_DISK) || !GetFileSizeEx(hFile, &liSize) )
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	if ( liSize.QuadPart > 0 )
+	{
+		m_hMapping = CreateFileMappingA(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+		if ( m_hMapping != NULL )
+			m_pMapping = MapViewOfFile(m_hMapping, FILE_MAP_READ, 0, 0, 0);
+		if ( m_pMapping == NULL )
+		{
+			if ( m_hMapping != NULL )
+				CloseHandle(m_hMapping);
+			m_hMapping = NULL;
+			CloseHandle(hFile);
+			return false;
+		}
+	}
+
+	// The mapping keeps its own reference to the file
+	CloseHandle(hFile);
+
+	m_pData = ( m_pMapping != NULL ? static_cast<const char *>(m_pMapping) : "" );
+	m_sizeData = static_cast<std::size_t>(liSize.QuadPart);
+	m_bOpen = true;
+	return true;
+}
+
+
+
+void CMappedFile::Close()
+{
+	if ( m_pMapping != NULL )
+		UnmapViewOfFile(m_pMapping);
+	if ( m_hMapping != NULL )
+		CloseHandle(m_hMapping);
+	m_pMapping = NULL;
+	m_hMapping = NULL;
+	m_pData = NULL;
+	m_sizeData = 0;
+	m_bOpen = false;
+}
+
+
+
+#else // POSIX
+
+
+
+bool CMappedFile::Open(const char * szFilepath)
+{
+	Close();
+
+	int		fd = open(szFilepath, O_RDONLY);
+	if ( fd < 0 )
+		return false;
+
+	// Only regular files can be mapped
+	struct stat	st;
+	if ( (fstat(fd, &st) != 0) || !S_ISREG(st.st_mode) )
+	{
+		close(fd);
+		return false;
+	}
+
+	if ( st.st_size > 0 )
+	{
+		void	* pMapping = mmap(NULL, static_cast<std::size_t>(st.st_size),
+								  PROT_READ, MAP_PRIVATE, fd, 0);
+		if ( pMapping == MAP_FAILED )
+		{
+			close(fd);
+			return false;
+		}
+		m_pMapping = pMapping;
+
+		// The file is parsed from begin to end
+		posix_madvise(m_pMapping, static_cast<std::size_t>(st.st_size), POSIX_MADV_SEQUENTIAL);
+	}
+
+	// The mapping keeps its own reference to the file
+	close(fd);
+
+	m_pData = ( m_pMapping != NULL ? static_cast<const char *>(m_pMapping) : "" );
+	m_sizeData = static_cast<std::size_t>(st.st_size);
+	m_bOpen = true;
+	return true;
+}
+
+
+
+void CMappedFile::Close()
+{
+	if ( m_pMapping != NULL )
+		munmap(m_pMapping, m_sizeData);
+	m_pMapping = NULL;
+	m_pData = NULL;
+	m_sizeData = 0;
+	m_bOpen = false;
+}
+
+
+
+#endif // POSIX
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Helpers for binary files
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+std::uint64_t HashFNV1a(const void * pData, std::size_t sizeData,
+						std::uint64_t ullHash /* = FNV1aInit */)
+{
+	const unsigned char	* pch = static_cast<const unsigned char *>(pData);
+	for ( std::size_t pos = 0 ; pos < sizeData ; ++pos )
+	{
+		ullHash ^= pch[pos];
+		ullHash *= 1099511628211ULL;
+	}
+	return ullHash;
+}
+
+
+
+std::uint64_t ChecksumFNV1a(const char * pData, std::size_t sizeData, std::size_t posChecksum)
+{
+	static const char	achZero[sizeof(std::uint64_t)] = { 0 };
+	if ( posChecksum >= sizeData )
+		return HashFNV1a(pData, sizeData);
+
+	std::size_t		sizeField = sizeData - posChecksum; // No std::min, see <windows.h>
+	if ( sizeField > sizeof(achZero) )
+		sizeField = sizeof(achZero);
+	std::uint64_t	ullHash = HashFNV1a(pData, posChecksum);
+	ullHash = HashFNV1a(achZero, sizeField, ullHash);
+	return HashFNV1a(pData + posChecksum + sizeField, sizeData - posChecksum - sizeField, ullHash);
+}
+
+
+
+bool WriteFileAtomically(const std::string & strFilepath, const char * pData, std::size_t sizeData)
+{
+	// Unique among the threads (thread ID, counter) and processes (random
+	// number, time) writing the same file
+	static std::atomic<unsigned long>	nCounter(0);
+	std::size_t	nUnique = std::hash<std::thread::id>()(std::this_thread::get_id()) ^
+						  static_cast<std::size_t>(std::chrono::steady_clock::now().time_since_epoch().count()) ^
+						  (static_cast<std::size_t>(std::random_device()()) << 16);
+	std::string	strTempPath = strFilepath + ".tmp" + std::to_string(nUnique) +
+							  "_" + std::to_string(nCounter.fetch_add(1));
+
+	std::error_code	ec;
+	std::ofstream	ofs(strTempPath, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+	if ( !ofs )
+		return false;
+	ofs.write(pData, static_cast<std::streamsize>(sizeData));
+	ofs.close();
+	if ( !ofs )
+	{
+		std::filesystem::remove(strTempPath, ec);
+		return false;
+	}
+	std::filesystem::rename(strTempPath, strFilepath, ec);
+	if ( ec )
+	{
+		std::filesystem::remove(strTempPath, ec);
+		return false;
+	}
+	return true;
+}
+
+
+
+
+
+} // namespace TUN
@@ -0,0 +1,113 @@
+// TUN_MappedFile.h: Interface of the class CMappedFile.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class provides read-only memory mapping of regular files, so
+// that files can be parsed without copying them into the heap.
+// Also contains the file helpers shared by the binary file formats
+// (see CBinaryScale, CScaleCache and CMultiScaleIndex).
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_MAPPEDFILE_H__71FE3183_9ADA_49F9_A4FD_1AB1619D5868__INCLUDED_)
+#define AFX_TUN_MAPPEDFILE_H__71FE3183_9ADA_49F9_A4FD_1AB1619D5868__INCLUDED_
+
+
+
+
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CMappedFile
+{
+public:
+	CMappedFile();
+	~CMappedFile();
+
+	// Mappings are not copyable
+	CMappedFile(const CMappedFile &) = delete;
+	CMappedFile & operator=(const CMappedFile &) = delete;
+
+
+
+	// Maps the complete file read-only into memory.
+	// Returns false, if the file can not be opened, is not a regular file
+	// (e.g. a pipe or a device) or can not be mapped. In this case, the
+	// caller should fall back to reading the file as a stream.
+	bool		Open(const char * szFilepath);
+
+	// Unmaps the file. Pointers retrieved by GetData() become invalid!
+	void		Close();
+
+
+
+	bool		IsOpen() const { return m_bOpen; }
+
+	// Mapped file data. Empty files have size 0 and a valid pointer.
+	// ATTENTION: The data is not null terminated!
+	const char *	GetData() const { return m_pData; }
+	std::size_t		GetSize() const { return m_sizeData; }
+
+
+
+private:
+	bool			m_bOpen;
+	const char		* m_pData;
+	std::size_t		m_sizeData;
+	void			* m_pMapping; // Base address of the mapping or NULL
+#if defined(_WIN32)
+	void			* m_hMapping; // Handle of the file mapping object
+#endif
+};
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Helpers for binary files
+//////////////////////////////////////////////////////////////////////
+
+// FNV-1a hash, 64 bit. Pass the result as ullHash to continue hashing.
+static constexpr std::uint64_t	FNV1aInit = 14695981039346656037ULL;
+std::uint64_t	HashFNV1a(const void * pData, std::size_t sizeData,
+						  std::uint64_t ullHash = FNV1aInit);
+
+// Checksum of a binary file: FNV-1a hash of the data, with the 8 bytes
+// of the checksum field at posChecksum taken as 0
+std::uint64_t	ChecksumFNV1a(const char * pData, std::size_t sizeData,
+							  std::size_t posChecksum);
+
+// Writes the data to a temporary file with a unique name and renames it
+// to strFilepath, so that other threads or processes never read an
+// incomplete file. On error, the temporary file is removed and false is
+// returned.
+bool			WriteFileAtomically(const std::string & strFilepath,
+									const char * pData, std::size_t sizeData);
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_MAPPEDFILE_H__71FE3183_9ADA_49F9_A4FD_1AB1619D5868__INCLUDED_)
@@ -0,0 +1,417 @@
+// TUN_MultiScaleFile.cpp: Implementation of the class CMultiScaleFile.
+//
+// (C)opyright in 2009 by Mark Henning, Germany
+//
+// Contact: See contact page at www.mark-henning.de
+//
+// You may use this code for free. If you find an error or make some
+// interesting changes, please let me know.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <system_error>
+#include <thread>
+
+#include "TUN_MultiScaleFile.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Parallel reading
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CMultiScaleFile::AddParallel(const char * szFilepath, unsigned int nThreads /* = 0 */)
+{
+	// Map the file, if possible
+	CMappedFile		mf;
+	if ( mf.Open(szFilepath) )
+		return AddParallelFromMemory(mf.GetData(), mf.GetSize(), nThreads);
+
+	// Otherwise read the complete file into memory
+	std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
+	if ( !ifstr )
+		return m_err.SetError("Error opening the file.");
+	std::string		strData((std::istreambuf_iterator<char>(ifstr)), std::istreambuf_iterator<char>());
+	return AddParallelFromMemory(strData.data(), strData.size(), nThreads);
+}
+
+
+
+long CMultiScaleFile::AddParallelFromMemory(const char * pData, std::size_t sizeData,
+											unsigned int nThreads /* = 0 */)
+{
+	if ( LoadAllScales() < 0 )
+		return -1;
+
+	// A dataset read by CSingleScale::Read() always ends with its
+	// [Scale End] line (or the end of the data). So the datasets can be
+	// found by scanning the lines for [Scale End], without reading them.
+	// For each dataset, the line counting state at its begin is kept,
+	// so that the line numbers are the same as when reading serially.
+	struct SDataSet
+	{
+		std::size_t	posBegin;
+		std::size_t	posEnd;
+		long		lLineCount;
+		char		chEOL;
+	};
+	std::vector<SDataSet>	vdsDataSets;
+	{
+		CStringParser	strparser;
+		strparser.InitMemoryReading(pData, sizeData);
+		SDataSet		ds = { 0, 0, -1, '@' };
+		long			lLineCount;
+		while ( strparser.GetLineAndTrim(lLineCount) )
+		{
+			std::string_view	svLine = strparser.view();
+			if ( (svLine.empty()) || (svLine.front() != '[') || !strx::EvalSection(svLine) ||
+				 (CSingleScale::FindSection(svLine) != CSingleScale::SEC_ScaleEnd) )
+				continue;
+			ds.posEnd = strparser.GetMemoryOffset();
+			vdsDataSets.push_back(ds);
+			ds.posBegin = ds.posEnd;
+			ds.lLineCount = strparser.GetLineCount();
+			ds.chEOL = strparser.GetEOLChar();
+		}
+		// The rest of the data (usually empty or comments, but a V1
+		// dataset might end at the end of the data without [Scale End])
+		ds.posEnd = sizeData;
+		vdsDataSets.push_back(ds);
+	}
+
+	// Read the datasets by the worker threads
+	// A worker takes the next dataset not yet read. Datasets behind the
+	// first one which failed are skipped, as they will not be added.
+	std::vector<CSingleScale>	vssScales(vdsDataSets.size());
+	std::vector<long>			vlResults(vdsDataSets.size(), 0);
+	std::vector<std::exception_ptr>	vepExceptions(vdsDataSets.size());
+	std::atomic<std::size_t>	nNextDataSet(0);
+	std::atomic<std::size_t>	nFirstFailed(vdsDataSets.size());
+	auto	Worker = [&]()
+	{
+		std::size_t	n;
+		while ( (n = nNextDataSet.fetch_add(1)) < vdsDataSets.size() )
+		{
+			if ( n > nFirstFailed.load() )
+				continue;
+			const SDataSet &	ds = vdsDataSets[n];
+			CStringParser		strparser;
+			strparser.InitMemoryReading(pData + ds.posBegin, ds.posEnd - ds.posBegin,
+										ds.lLineCount, ds.chEOL);
+			try
+			{
+				vlResults[n] = vssScales[n].Read(strparser);
+			}
+			catch ( ... )
+			{
+				// Passed to the caller, if the serial reading would reach it
+				vepExceptions[n] = std::current_exception();
+				vlResults[n] = -1;
+			}
+			if ( vlResults[n] != 1 )
+			{
+				// Remember the lowest dataset number which stops reading
+				std::size_t	nFailed = nFirstFailed.load();
+				while ( (n < nFailed) && !nFirstFailed.compare_exchange_weak(nFailed, n) )
+					;
+			}
+		}
+	};
+
+	if ( nThreads == 0 )
+		nThreads = std::max(1u, std::thread::hardware_concurrency());
+	nThreads = static_cast<unsigned int>(std::min<std::size_t>(nThreads, vdsDataSets.size()));
+	{
+		// Joins the workers started, also if an exception leaves this block
+		struct SWorkers
+		{
+			std::vector<std::thread>	vthreads;
+			~SWorkers()
+			{
+				for ( std::size_t i = 0 ; i < vthreads.size() ; ++i )
+					vthreads[i].join();
+			}
+		} workers;
+		workers.vthreads.reserve(nThreads);
+		for ( unsigned int i = 1 ; i < nThreads ; ++i )
+		{
+			try
+			{
+				workers.vthreads.emplace_back(Worker);
+			}
+			catch ( const std::system_error & )
+			{
+				break; // No more threads: The others read the remaining datasets
+			}
+		}
+		Worker(); // The calling thread works, too
+	}
+
+	// Add the scales in file order, just like Add() does
+	long	lResult = 0;
+	for ( std::size_t n = 0 ; n < vdsDataSets.size() ; ++n )
+	{
+		if ( vepExceptions[n] )
+		{
+			UpdateChannelIndex();
+			std::rethrow_exception(vepExceptions[n]);
+		}
+		if ( vlResults[n] == 0 )
+			break; // No more scales in the file
+		if ( vlResults[n] != 1 )
+		{
+			m_err.SetError(vssScales[n].Err()); // An error occurred
+			lResult = -1;
+			break;
+		}
+		m_lssScales.push_back(std::move(vssScales[n]));
+		++lResult;
+	}
+
+	UpdateChannelIndex();
+	return lResult;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Lazy mode
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CMultiScaleFile::OpenLazy(const char * szFilepath, std::size_t nMaxCachedScales /* = 64 */,
+							   const char * szIndexFilepath /* = NULL */)
+{
+	EndLazyMode();
+	m_lssScales.clear();
+
+	std::shared_ptr<CMultiScaleIndex>	spIndex = std::make_shared<CMultiScaleIndex>();
+	long	lResult = spIndex->Open(szFilepath, szIndexFilepath);
+	if ( lResult < 0 )
+		m_err.SetError(spIndex->Err());
+	else
+		m_err.SetOK();
+
+	// Datasets before an error are available, just like with Add()
+	m_spIndex = spIndex;
+	m_nMaxCachedScales = std::max<std::size_t>(nMaxCachedScales, 1);
+	UpdateChannelIndex();
+	return lResult;
+}
+
+
+
+CSingleScale * CMultiScaleFile::GetLazyScale(long lIndex, bool bPin)
+{
+	if ( (lIndex < 0) || (lIndex >= m_spIndex->GetNumOfDataSets()) )
+		return NULL;
+
+	// Already read: Move it to the front or pin it. Splicing keeps the
+	// pointers to the scale valid.
+	std::unordered_map<long, LazyCacheIterator>::iterator	it = m_mapLazyCache.find(lIndex);
+	if ( it != m_mapLazyCache.end() )
+	{
+		SLazyScale &	entry = *it->second;
+		if ( !entry.bPinned && bPin )
+		{
+			entry.bPinned = true;
+			m_lLazyPinned.splice(m_lLazyPinned.begin(), m_lLazyCache, it->second);
+		}
+		else if ( !entry.bPinned )
+			m_lLazyCache.splice(m_lLazyCache.begin(), m_lLazyCache, it->second);
+		return &entry.SS;
+	}
+
+	// Read the scale first, so that a failed read does not drop a cached one
+	std::list<SLazyScale>	lNew(1);
+	SLazyScale &			entry = lNew.front();
+	if ( m_spIndex->LoadScale(lIndex, entry.SS) != 1 )
+	{
+		m_err.SetError(entry.SS.Err());
+		return NULL;
+	}
+	entry.lIndex = lIndex;
+	entry.bPinned = bPin;
+	m_mapLazyCache[lIndex] = lNew.begin();
+
+	if ( bPin )
+	{
+		m_lLazyPinned.splice(m_lLazyPinned.begin(), lNew);
+		return &entry.SS;
+	}
+
+	// Drop the least recently used scale, if the cache is full. Its node is
+	// not reused, so that pointers to it do not silently refer to another
+	// scale.
+	if ( m_lLazyCache.size() >= m_nMaxCachedScales )
+	{
+		m_mapLazyCache.erase(m_lLazyCache.back().lIndex);
+		m_lLazyCache.pop_back();
+	}
+	m_lLazyCache.splice(m_lLazyCache.begin(), lNew);
+	return &entry.SS;
+}
+
+
+
+long CMultiScaleFile::LoadAllScales()
+{
+	if ( !IsLazy() )
+		return GetNumOfScales();
+
+	std::list<CSingleScale>	lssScales;
+	long	lResult = 0;
+	for ( long i = 0 ; i < m_spIndex->GetNumOfDataSets() ; ++i )
+	{
+		// Scales read before may have been changed
+		std::unordered_map<long, LazyCacheIterator>::iterator	it = m_mapLazyCache.find(i);
+		if ( it != m_mapLazyCache.end() )
+		{
+			lssScales.push_back(std::move(it->second->SS));
+			++lResult;
+			continue;
+		}
+		lssScales.emplace_back();
+		if ( m_spIndex->LoadScale(i, lssScales.back()) != 1 )
+		{
+			m_err.SetError(lssScales.back().Err());
+			lssScales.pop_back();
+			lResult = -1;
+			break;
+		}
+		++lResult;
+	}
+
+	EndLazyMode();
+	m_lssScales.splice(m_lssScales.end(), lssScales);
+	UpdateChannelIndex();
+	return lResult;
+}
+
+
+
+bool CMultiScaleFile::WriteLazyScales(std::string & str, std::vector<char> * pvchBuffer,
+									  long lVersionFrom, long lVersionTo)
+{
+	for ( long i = 0 ; i < m_spIndex->GetNumOfDataSets() ; ++i )
+	{
+		// Scales read before may have been changed. The others are read
+		// without putting them into the cache.
+		std::unordered_map<long, LazyCacheIterator>::iterator	it = m_mapLazyCache.find(i);
+		if ( it != m_mapLazyCache.end() )
+		{
+			if ( !WriteDataSet(str, it->second->SS, lVersionFrom, lVersionTo) )
+				return false;
+			MoveToBuffer(str, pvchBuffer);
+			continue;
+		}
+		CSingleScale	SS;
+		if ( m_spIndex->LoadScale(i, SS) != 1 )
+			return m_err.SetError(SS.Err());
+		if ( !WriteDataSet(str, SS, lVersionFrom, lVersionTo) )
+			return false;
+		MoveToBuffer(str, pvchBuffer);
+	}
+	return m_err.SetOK();
+}
+
+
+
+std::size_t CMultiScaleFile::GetLazyWriteSizeEstimate() const
+{
+	std::size_t	sizeEstimate = 0;
+	for ( long i = 0 ; i < m_spIndex->GetNumOfDataSets() ; ++i )
+	{
+		const CMultiScaleIndex::SEntry &	entry = m_spIndex->GetEntry(i);
+		sizeEstimate += 256 + static_cast<std::size_t>(entry.ullEnd - entry.ullBegin);
+	}
+	return sizeEstimate;
+}
+
+
+
+void CMultiScaleFile::UpdateLazyChannelIndex()
+{
+	// The channel assignments are taken from the index, so that no scale
+	// must be read. Scales given out for writing may have been changed.
+	std::vector<std::list<CMIDIChannelRange> >	vlmcrChannels(m_spIndex->GetNumOfDataSets());
+	for ( std::size_t i = 0 ; i < vlmcrChannels.size() ; ++i )
+	{
+		std::unordered_map<long, LazyCacheIterator>::const_iterator	it = m_mapLazyCache.find(static_cast<long>(i));
+		if ( (it != m_mapLazyCache.end()) && it->second->bPinned )
+		{
+			vlmcrChannels[i] = it->second->SS.GetChannels();
+			continue;
+		}
+		const std::string &	strMIDIChannels = m_spIndex->GetEntry(static_cast<long>(i)).strMIDIChannels;
+		if ( strMIDIChannels.empty() )
+			continue;
+
+		std::vector<std::string_view>	vsvChannels;
+		strx::Split(strMIDIChannels, ',', vsvChannels, true, true);
+		for ( std::string_view svChannels : vsvChannels )
+		{
+			CMIDIChannelRange	mcr;
+			if ( mcr.SetFromStr(svChannels) )
+				vlmcrChannels[i].push_back(mcr);
+		}
+	}
+	m_cd.Build(vlmcrChannels);
+}
+
+
+
+void CMultiScaleFile::CopyLazyMode(const CMultiScaleFile & other)
+{
+	// The index is not changed after opening, so it is shared
+	m_spIndex = other.m_spIndex;
+	m_nMaxCachedScales = other.m_nMaxCachedScales;
+	m_lLazyCache = other.m_lLazyCache;
+	m_lLazyPinned = other.m_lLazyPinned;
+	m_mapLazyCache.clear();
+	for ( LazyCacheIterator it = m_lLazyCache.begin() ; it != m_lLazyCache.end() ; ++it )
+		m_mapLazyCache[it->lIndex] = it;
+	for ( LazyCacheIterator it = m_lLazyPinned.begin() ; it != m_lLazyPinned.end() ; ++it )
+		m_mapLazyCache[it->lIndex] = it;
+}
+
+
+
+void CMultiScaleFile::EndLazyMode()
+{
+	if ( !IsLazy() )
+		return;
+	m_spIndex.reset();
+	m_lLazyCache.clear();
+	m_lLazyPinned.clear();
+	m_mapLazyCache.clear();
+	m_cd.Clear();
+}
+
+
+
+
+
+} // namespace TUN
@@ -17,7 +17,15 @@
 
 #pragma warning( disable : 4786 )
 
+#include <algorithm>
+#include <iterator>
+#include <memory>
+#include <unordered_map>
+
 #include "TUN_Scale.h"
+#include "TUN_MappedFile.h"
+#include "TUN_ChannelDispatch.h"
+#include "TUN_MultiScaleIndex.h"
 
 
 
@@ -33,9 +41,27 @@ namespace TUN
 class CMultiScaleFile
 {
 public:
-	CMultiScaleFile() {}
+	CMultiScaleFile() : m_bIndexDirty(false), m_nMaxCachedScales(0) {}
+	CMultiScaleFile(const CMultiScaleFile & other)
+		: m_err(other.m_err), m_lssScales(other.m_lssScales)
+	{
+		CopyLazyMode(other);
+		UpdateChannelIndex();
+	}
+	// Moving keeps the scales in place, so the channel index stays valid
+	CMultiScaleFile(CMultiScaleFile && other) = default;
 	virtual ~CMultiScaleFile() {}
 
+	CMultiScaleFile & operator=(const CMultiScaleFile & other)
+	{
+		m_err = other.m_err;
+		m_lssScales = other.m_lssScales;
+		CopyLazyMode(other);
+		UpdateChannelIndex();
+		return *this;
+	}
+	CMultiScaleFile & operator=(CMultiScaleFile && other) = default;
+
 
 
 	// Error handling
@@ -47,6 +73,9 @@ public:
 
 
 	// Write the list of scales to the file/stream
+	// The file is formatted in memory and written to the stream at once.
+	// WriteToString() and WriteToBuffer() append the file data to str or
+	// vchBuffer, respectively, without using a stream.
 	bool Write(const char * szFilepath, long lVersionFrom = 0, long lVersionTo = 200)
 	{
 		std::ofstream	ofs(szFilepath, std::ios_base::out | std::ios_base::trunc);
@@ -56,31 +85,98 @@ public:
 
 	bool Write(std::ostream & os, long lVersionFrom = 0, long lVersionTo = 200)
 	{
-		os << ";" << std::endl;
-		os << "; This is an AnaMark multiple scales file" << std::endl;
-		os << "; (based on AnaMark tuning map file V2.00)" << std::endl;
-		os << ";" << std::endl;
-		os << "; Free .MSF and .TUN file handling source code (C)2009 by Mark Henning, Germany" << std::endl;
-		os << ";" << std::endl;
-		os << "; Specifications and free source code see:" << std::endl;
-		os << ";         " << CSingleScale::FormatSpecs() << std::endl;
-		os << ";" << std::endl;
+		std::string	str;
+		if ( !WriteToString(str, lVersionFrom, lVersionTo) )
+			return false;
+
+		os.write(str.data(), str.size());
+		if ( !os )
+			return m_err.SetError("Error writing the file.");
+		return m_err.SetOK();
+	}
+
+
+	// The datasets are formatted one after another and appended to
+	// vchBuffer, so that the file is not held in memory twice.
+	bool WriteToBuffer(std::vector<char> & vchBuffer, long lVersionFrom = 0, long lVersionTo = 200)
+	{
+		std::string	str;
+		return WriteFile(str, &vchBuffer, lVersionFrom, lVersionTo);
+	}
 
+
+	// In lazy mode, all datasets are written: Scales read before as they
+	// are now, the other ones are read from the file.
+	bool WriteToString(std::string & str, long lVersionFrom = 0, long lVersionTo = 200)
+	{
+		return WriteFile(str, NULL, lVersionFrom, lVersionTo);
+	}
+private:
+	// Formats the file into str. With pvchBuffer, str is moved to the
+	// buffer after the header and after each dataset.
+	bool WriteFile(std::string & str, std::vector<char> * pvchBuffer, long lVersionFrom, long lVersionTo)
+	{
+		// Reserve the memory for all scales at once
+		std::size_t	sizeEstimate = 1024;
 		std::list<CSingleScale>::iterator	it;
+		if ( IsLazy() )
+			sizeEstimate += GetLazyWriteSizeEstimate();
+		for ( it = m_lssScales.begin() ; it != m_lssScales.end() ; ++it )
+			sizeEstimate += 256 + it->GetWriteSizeEstimate(lVersionFrom, lVersionTo);
+		if ( pvchBuffer != NULL )
+		{
+			if ( pvchBuffer->capacity() < pvchBuffer->size() + sizeEstimate )
+				pvchBuffer->reserve(std::max(pvchBuffer->size() + sizeEstimate, 2 * pvchBuffer->capacity()));
+		}
+		else if ( str.capacity() < str.size() + sizeEstimate )
+			str.reserve(std::max(str.size() + sizeEstimate, 2 * str.capacity()));
+
+		str += ";\n";
+		str += "; This is an AnaMark multiple scales file\n";
+		str += "; (based on AnaMark tuning map file V2.00)\n";
+		str += ";\n";
+		str += "; Free .MSF and .TUN file handling source code (C)2009 by Mark Henning, Germany\n";
+		str += ";\n";
+		str += "; Specifications and free source code see:\n";
+		str += ";         ";
+		str += CSingleScale::FormatSpecs();
+		str += '\n';
+		str += ";\n";
+		MoveToBuffer(str, pvchBuffer);
+
+		if ( IsLazy() )
+			return WriteLazyScales(str, pvchBuffer, lVersionFrom, lVersionTo);
 		for ( it = m_lssScales.begin() ; it != m_lssScales.end() ; ++it )
 		{
-			os << std::endl;
-			os << std::endl;
-			os << std::endl;
-			os << ";======================================================================" << std::endl;
-			os << ";======================================================================" << std::endl;
-			os << ";======================================================================" << std::endl;
-			os << std::endl;
-			if ( !it->Write(os, lVersionFrom, lVersionTo, false) )
-				return m_err.SetError(it->Err().GetLastError().c_str());
+			if ( !WriteDataSet(str, *it, lVersionFrom, lVersionTo) )
+				return false;
+			MoveToBuffer(str, pvchBuffer);
 		}
 		return m_err.SetOK();
 	}
+	static void MoveToBuffer(std::string & str, std::vector<char> * pvchBuffer)
+	{
+		if ( pvchBuffer == NULL )
+			return;
+		pvchBuffer->insert(pvchBuffer->end(), str.begin(), str.end());
+		str.clear(); // The capacity is reused for the next dataset
+	}
+	bool WriteDataSet(std::string & str, CSingleScale & SS, long lVersionFrom, long lVersionTo)
+	{
+		str += '\n';
+		str += '\n';
+		str += '\n';
+		str += ";======================================================================\n";
+		str += ";======================================================================\n";
+		str += ";======================================================================\n";
+		str += '\n';
+		if ( !SS.WriteToString(str, lVersionFrom, lVersionTo, false) )
+			return m_err.SetError(SS.Err().GetLastError().c_str());
+		return true;
+	}
+	bool		WriteLazyScales(std::string & str, std::vector<char> * pvchBuffer, long lVersionFrom, long lVersionTo);
+	std::size_t	GetLazyWriteSizeEstimate() const;
+public:
 
 
 
@@ -89,15 +185,24 @@ public:
 	// otherwise: Number of scale datasets found
 	long	Add(const char * szFilepath)
 	{
-		// Open the file
+		// String which will receive the current line from the file
+		CStringParser	strparser;
+
+		// Map the file, if possible
+		CMappedFile		mf;
+		if ( mf.Open(szFilepath) )
+		{
+			strparser.InitMemoryReading(mf.GetData(), mf.GetSize());
+			return Add(strparser);
+		}
+
+		// Otherwise open the file as a stream
 		std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
 
 		if ( !ifstr )
 			return m_err.SetError("Error opening the file.");
 
-		// String which will receive the current line from the file
-		CStringParser	strparser;
-		strparser.InitStreamReading();
+		strparser.InitStreamReading(true);
 
 		// Read the file
 		long	lResult = Add(ifstr, strparser);
@@ -110,38 +215,254 @@ public:
 
 
 	long	Add(std::istream & istr, CStringParser & strparser)
+	{
+		strparser.AttachStream(istr);
+		return Add(strparser);
+	}
+
+
+	long	Add(CStringParser & strparser)
+	{
+		if ( LoadAllScales() < 0 )
+			return -1;
+		long	lResult = AddDataSets(strparser);
+		UpdateChannelIndex(); // Also scales added before an error
+		return lResult;
+	}
+private:
+	long	AddDataSets(CStringParser & strparser)
 	{
 		long	lResult = 0;
 		while (true)
 		{
-			CSingleScale	SS;
-			switch ( SS.Read(istr, strparser) )
+			// Read the scale in place; it is removed again, if there is none
+			m_lssScales.emplace_back();
+			CSingleScale &	SS = m_lssScales.back();
+			switch ( SS.Read(strparser) )
 			{
-			case 0:		return lResult; // No more scales in the file
-			case 1:		m_lssScales.push_back(SS); ++lResult; break;
-			default:	return -1; // An error occurred
+			case 0:		m_lssScales.pop_back(); return lResult; // No more scales in the file
+			case 1:		++lResult; break;
+			default:	m_err.SetError(SS.Err()); m_lssScales.pop_back(); return -1; // An error occurred
 			}
 		}
 	}
+public:
+
+
+
+	// Parallel version of Add() for files with many scale datasets:
+	// The data is split into datasets at the [Scale End] lines, which are
+	// read by nThreads worker threads (0 = number of CPU cores).
+	// The result is the same as with Add(): The scales are added in file
+	// order, reading stops at the first error and the error message
+	// (see Err()) has the same line number.
+	long	AddParallel(const char * szFilepath, unsigned int nThreads = 0);
+	long	AddParallelFromMemory(const char * pData, std::size_t sizeData, unsigned int nThreads = 0);
+
+
+
+	// Lazy mode for large files: OpenLazy() only indexes the datasets of
+	// the file (see CMultiScaleIndex, szIndexFilepath is its side-car
+	// file). A scale is read when GetScale(), Find() or ModifyScale()
+	// accesses it first.
+	// GetScale() gives read-only access: At most nMaxCachedScales of its
+	// scales are kept; the least recently used one is dropped first. So a
+	// pointer returned is valid until nMaxCachedScales other scales were
+	// read.
+	// Find() and ModifyScale() give write access: Their scales are kept
+	// until the lazy mode ends, so that changes are not lost. (Find()
+	// only returns the scales assigned to the channels.)
+	// In lazy mode, the list of scales (see GetScales()) is empty. Write()
+	// writes all datasets of the file. LoadAllScales() reads all datasets
+	// into the list and ends the lazy mode; Add(), AddParallel(),
+	// AddScale(), RemoveScale() and ModifyScales() call it first.
+	// Returns the same values as Add().
+	long	OpenLazy(const char * szFilepath, std::size_t nMaxCachedScales = 64,
+					 const char * szIndexFilepath = NULL);
+	bool	IsLazy() const { return m_spIndex != NULL; }
+	// Scales read before are taken as they are now. Returns the same values
+	// as Add(); in case of an error, the lazy mode is ended nevertheless
+	// and the datasets before the error are in the list.
+	// Pointers returned in lazy mode become invalid.
+	// Not in lazy mode, the number of scales is returned.
+	long	LoadAllScales();
+
+
+
+	// Number of scales and indexed read access (also in lazy mode, see
+	// ModifyScale() for write access)
+	// GetScale() returns NULL, if the index is invalid or the scale could
+	// not be read (see Err()).
+	long					GetNumOfScales() const
+	{
+		return ( IsLazy() ? m_spIndex->GetNumOfDataSets() : static_cast<long>(m_lssScales.size()) );
+	}
+	const CSingleScale *	GetScale(long lIndex)
+	{
+		if ( IsLazy() )
+			return Evaluated(GetLazyScale(lIndex, false));
+		if ( IsChannelIndexStale() )
+			UpdateChannelIndex();
+		return ( (lIndex < 0) || (lIndex >= static_cast<long>(m_vpssScales.size())) ?
+				 NULL : Evaluated(m_vpssScales[lIndex]) );
+	}
 
 
 
 	// Find Scale which applies to the given MIDI Channel
 	// returns NULL, if there is no scale applicable
+	// In lazy mode, the scale is kept until the lazy mode ends (see
+	// OpenLazy()). Formulas queued in deferred mode are evaluated by
+	// Find() and GetScale() (see CSingleScale::SetDeferredEvaluation()).
+	//
+	// The scale is looked up in a precomputed channel index, see
+	// TUN_ChannelDispatch.h. Find() and GetScale() rebuild it, if the
+	// scales were changed by the functions of this class (see
+	// ModifyScale() and ModifyScales()). When changing the channel
+	// assignment of a scale via the pointer returned, call
+	// UpdateChannelIndex() afterwards.
 	CSingleScale *	Find(long lMIDIChannel)
 	{
+		if ( IsChannelIndexStale() )
+			UpdateChannelIndex();
+		long	lScaleIndex = m_cd.Find(lMIDIChannel);
+		if ( IsLazy() )
+			return Evaluated(GetLazyScale(lScaleIndex, true));
+		return ( lScaleIndex < 0 ? NULL : Evaluated(m_vpssScales[lScaleIndex]) );
+	}
+	// Does not rebuild the index, so that const objects can be shared
+	// between threads. The index must be up to date, i.e. call
+	// UpdateChannelIndex() after changing the scales and before sharing
+	// the object. It does not evaluate queued formulas either, such
+	// scales report muted notes.
+	// In lazy mode, only scales read before are found.
+	const CSingleScale *	Find(long lMIDIChannel) const noexcept
+	{
+		long	lScaleIndex = m_cd.Find(lMIDIChannel);
+		if ( IsLazy() )
+		{
+			std::unordered_map<long, LazyCacheIterator>::const_iterator	it = m_mapLazyCache.find(lScaleIndex);
+			return ( it == m_mapLazyCache.end() ? NULL : &it->second->SS );
+		}
+		return ( (lScaleIndex < 0) || (lScaleIndex >= static_cast<long>(m_vpssScales.size())) ?
+				 NULL : m_vpssScales[lScaleIndex] );
+	}
+
+
+	void	UpdateChannelIndex()
+	{
+		m_bIndexDirty = false;
+		m_vpssScales.clear();
+		if ( IsLazy() )
+		{
+			UpdateLazyChannelIndex();
+			return;
+		}
+		m_vpssScales.reserve(m_lssScales.size());
 		std::list<CSingleScale>::iterator	it;
 		for ( it = m_lssScales.begin() ; it != m_lssScales.end() ; ++it )
+			m_vpssScales.push_back(&(*it));
+		m_cd.Build(m_lssScales);
+	}
+	// Scales added to or removed from m_lssScales directly are detected
+	// by its size
+	bool	IsChannelIndexStale() const noexcept
+	{
+		return m_bIndexDirty || (m_vpssScales.size() != m_lssScales.size());
+	}
+private:
+	CChannelDispatch				m_cd;
+	std::vector<CSingleScale *>		m_vpssScales; // Index = scale index of m_cd
+	bool							m_bIndexDirty; // Scales were changed
+	static CSingleScale *			Evaluated(CSingleScale * pSS)
+	{
+		if ( pSS != NULL )
+			pSS->EvaluateFormulas();
+		return pSS;
+	}
+
+	// Lazy mode
+	struct SLazyScale
+	{
+		long			lIndex;
+		bool			bPinned; // Write access was given, see OpenLazy()
+		CSingleScale	SS;
+	};
+	typedef std::list<SLazyScale>::iterator	LazyCacheIterator;
+	CSingleScale *	GetLazyScale(long lIndex, bool bPin);
+	void			UpdateLazyChannelIndex();
+	void			CopyLazyMode(const CMultiScaleFile & other);
+	void			EndLazyMode();
+
+	std::shared_ptr<const CMultiScaleIndex>			m_spIndex; // NULL = not in lazy mode
+	std::size_t										m_nMaxCachedScales;
+	std::list<SLazyScale>							m_lLazyCache; // Most recently used first
+	std::list<SLazyScale>							m_lLazyPinned; // Never dropped
+	std::unordered_map<long, LazyCacheIterator>		m_mapLazyCache; // Entries of both lists
+public:
+
+
+
+	// Access to the list of scales
+	// (Empty in lazy mode, see OpenLazy())
+	const std::list<CSingleScale> &	GetScales() const { return m_lssScales; }
+	void	AddScale(CSingleScale SS)
+	{
+		LoadAllScales();
+		m_lssScales.push_back(std::move(SS));
+		m_bIndexDirty = true;
+	}
+	// Returns false, if the index is invalid
+	bool	RemoveScale(long lIndex)
+	{
+		LoadAllScales();
+		if ( (lIndex < 0) || (lIndex >= static_cast<long>(m_lssScales.size())) )
+			return false;
+		std::list<CSingleScale>::iterator	it = m_lssScales.begin();
+		std::advance(it, lIndex);
+		m_lssScales.erase(it);
+		m_bIndexDirty = true;
+		return true;
+	}
+	// Write access to a single scale, e.g. to change its channel
+	// assignment. The channel index is rebuilt by the next Find() or
+	// GetScale(), so do not keep the pointer beyond that, but call
+	// ModifyScale() again. Returns NULL, if the index is invalid or the
+	// scale could not be read in lazy mode (see Err()).
+	CSingleScale *	ModifyScale(long lIndex)
+	{
+		if ( IsLazy() )
 		{
-			if ( it->AppliesToChannel(lMIDIChannel) )
-				return &(*it);
+			CSingleScale *	pSS = GetLazyScale(lIndex, true);
+			if ( pSS != NULL )
+				m_bIndexDirty = true;
+			return pSS;
 		}
-		return NULL;
+		if ( IsChannelIndexStale() )
+			UpdateChannelIndex();
+		if ( (lIndex < 0) || (lIndex >= static_cast<long>(m_vpssScales.size())) )
+			return NULL;
+		m_bIndexDirty = true;
+		return m_vpssScales[lIndex];
+	}
+	// Access to the list of scales for whatever you whish to do with it.
+	// The channel index is rebuilt by the next Find() or GetScale(), so
+	// do not keep the reference beyond that, but call ModifyScales() again.
+	// Ends the lazy mode (see LoadAllScales()).
+	std::list<CSingleScale> &	ModifyScales()
+	{
+		LoadAllScales();
+		m_bIndexDirty = true;
+		return m_lssScales;
 	}
 
 
 
-	// Direct access to the list of scales for whatever you whish to do with it:
+	// Direct access to the list of scales for whatever you whish to do with it
+	// (Deprecated, use the functions above. Find() and GetScale() notice
+	// scales added or removed here, but after replacing scales or changing
+	// their channel assignments, call UpdateChannelIndex(). Empty in lazy
+	// mode.)
 	std::list<CSingleScale>	m_lssScales;
 };
 
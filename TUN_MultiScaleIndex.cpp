@@ -0,0 +1,399 @@
+// TUN_MultiScaleIndex.cpp: Implementation of the class CMultiScaleIndex.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+//
+// Layout of an index file:
+//
+//		SIndexHeader		(64 bytes)
+//		SIndexEntry			Entries [ulNumOfEntries]
+//		char				String data [ulStringDataSize]
+//
+// The checksum is taken over the complete file, with the checksum field
+// itself set to 0. The data is stored in the byte order of the machine
+// which wrote the file; other files are rebuilt.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+#include "TUN_MultiScaleIndex.h"
+#include "TUN_ScaleCatalog.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// File layout
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+static const char			IndexMagic[4] = { 'T', 'U', 'N', 'I' };
+static const std::uint32_t	IndexEndianTag = 0x01020304;
+
+
+
+struct SIndexHeader
+{
+	char			achMagic[4];
+	std::uint32_t	ulEndianTag;
+	std::uint32_t	ulVersion;
+	std::uint32_t	ulHeaderSize;
+	std::uint64_t	ullFileSize;
+	std::uint64_t	ullChecksum;
+	std::uint64_t	ullMSFSize; // Size and modification time of the .msf file
+	std::int64_t	llMSFModified;
+	std::uint32_t	ulNumOfEntries;
+	std::uint32_t	ulStringDataSize;
+	std::uint8_t	aReserved[8];
+};
+static_assert(sizeof(SIndexHeader) == 64, "Layout of SIndexHeader changed");
+
+
+
+struct SIndexString
+{
+	std::uint32_t	ulOffset; // Offset in the string data
+	std::uint32_t	ulLength;
+};
+
+struct SIndexEntry
+{
+	std::uint64_t	ullBegin;
+	std::uint64_t	ullEnd;
+	std::int32_t	lLineCount;
+	std::int8_t		chEOL;
+	std::uint8_t	aReserved[3];
+	SIndexString	strName;
+	SIndexString	strID;
+	SIndexString	strMIDIChannels;
+};
+static_assert(sizeof(SIndexEntry) == 48, "Layout of SIndexEntry changed");
+
+
+
+static std::uint64_t Checksum(const char * pData, std::size_t sizeData)
+{
+	return ChecksumFNV1a(pData, sizeData, offsetof(SIndexHeader, ullChecksum));
+}
+
+
+
+static std::int64_t GetModificationTime(const char * szFilepath)
+{
+	std::error_code	ec;
+	std::filesystem::file_time_type	time = std::filesystem::last_write_time(szFilepath, ec);
+	return ( ec ? 0 : static_cast<std::int64_t>(time.time_since_epoch().count()) );
+}
+
+
+
+static void AddString(std::string & strData, SIndexString & rec, const std::string & str)
+{
+	rec.ulOffset = static_cast<std::uint32_t>(strData.size());
+	rec.ulLength = static_cast<std::uint32_t>(str.size());
+	strData += str;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CMultiScaleIndex::CMultiScaleIndex()
+	: m_bOpen(false), m_pData(NULL), m_sizeData(0), m_llModified(0)
+{
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Opening files
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CMultiScaleIndex::Open(const char * szFilepath, const char * szIndexFilepath /* = NULL */)
+{
+	Close();
+
+	// Map the file, if possible. Otherwise read it into memory.
+	if ( m_mf.Open(szFilepath) )
+	{
+		m_pData = m_mf.GetData();
+		m_sizeData = m_mf.GetSize();
+	}
+	else
+	{
+		std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
+		if ( !ifstr )
+		{
+			m_err.SetError("Error opening the file.");
+			return -1;
+		}
+		m_strData.assign(std::istreambuf_iterator<char>(ifstr), std::istreambuf_iterator<char>());
+		m_pData = m_strData.data();
+		m_sizeData = m_strData.size();
+	}
+	m_llModified = GetModificationTime(szFilepath);
+	m_bOpen = true;
+
+	if ( (szIndexFilepath != NULL) && ReadIndexFile(szIndexFilepath) )
+	{
+		m_err.SetOK();
+		return GetNumOfDataSets();
+	}
+
+	long	lResult = Build();
+	if ( (lResult >= 0) && (szIndexFilepath != NULL) )
+		WriteIndexFile(szIndexFilepath); // The side-car file is optional, errors are ignored
+	return lResult;
+}
+
+
+
+void CMultiScaleIndex::Close()
+{
+	m_mf.Close();
+	m_strData.clear();
+	m_strData.shrink_to_fit();
+	m_pData = NULL;
+	m_sizeData = 0;
+	m_llModified = 0;
+	m_bOpen = false;
+	m_vEntries.clear();
+	m_mapIDs.clear();
+}
+
+
+
+std::string CMultiScaleIndex::GetDefaultIndexFilepath(const std::string & strFilepath)
+{
+	return strFilepath + ".idx";
+}
+
+
+
+long CMultiScaleIndex::Build()
+{
+	// The catalog scans the datasets without evaluating the tunings
+	CScaleCatalog	catalog;
+	long			lResult = catalog.AddFromMemory(m_pData, m_sizeData, std::string());
+	if ( lResult < 0 )
+		m_err.SetError(catalog.Err());
+	else
+		m_err.SetOK();
+
+	const std::vector<CScaleCatalog::SEntry> &	vEntries = catalog.GetEntries();
+	m_vEntries.resize(vEntries.size());
+	for ( std::size_t i = 0 ; i < vEntries.size() ; ++i )
+	{
+		SEntry &	entry = m_vEntries[i];
+		entry.ullBegin = vEntries[i].ullBegin;
+		entry.ullEnd = vEntries[i].ullEnd;
+		entry.lLineCount = vEntries[i].lLineCount;
+		entry.chEOL = vEntries[i].chEOL;
+		entry.strName = vEntries[i].strName;
+		entry.strID = vEntries[i].strID;
+		entry.strMIDIChannels = vEntries[i].strMIDIChannels;
+		m_mapIDs.emplace(entry.strID, static_cast<long>(i));
+	}
+	return lResult;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Side-car file
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+bool CMultiScaleIndex::ReadIndexFile(const char * szIndexFilepath)
+{
+	std::ifstream	ifstr(szIndexFilepath, std::ios_base::in | std::ios_base::binary);
+	if ( !ifstr )
+		return false;
+	std::vector<char>	vchData((std::istreambuf_iterator<char>(ifstr)), std::istreambuf_iterator<char>());
+	if ( vchData.size() < sizeof(SIndexHeader) )
+		return false;
+
+	// Check the header, whether the index belongs to the current file
+	// and the checksum
+	SIndexHeader	hdr;
+	std::memcpy(&hdr, vchData.data(), sizeof(hdr));
+	if ( (std::memcmp(hdr.achMagic, IndexMagic, sizeof(IndexMagic)) != 0) ||
+		 (hdr.ulEndianTag != IndexEndianTag) ||
+		 (hdr.ulVersion != FormatVersion) ||
+		 (hdr.ulHeaderSize != sizeof(SIndexHeader)) ||
+		 (hdr.ullFileSize != vchData.size()) ||
+		 (hdr.ullFileSize != sizeof(SIndexHeader) +
+							 hdr.ulNumOfEntries * static_cast<std::uint64_t>(sizeof(SIndexEntry)) +
+							 hdr.ulStringDataSize) )
+		return false;
+	if ( (hdr.ullMSFSize != m_sizeData) || (hdr.llMSFModified != m_llModified) )
+		return false;
+	if ( hdr.ullChecksum != Checksum(vchData.data(), vchData.size()) )
+		return false;
+
+	const char	* pEntries = vchData.data() + sizeof(SIndexHeader);
+	const char	* pStringData = pEntries + hdr.ulNumOfEntries * sizeof(SIndexEntry);
+	std::vector<SEntry>	vEntries(hdr.ulNumOfEntries);
+	for ( std::size_t i = 0 ; i < vEntries.size() ; ++i )
+	{
+		SIndexEntry	rec;
+		std::memcpy(&rec, pEntries + i * sizeof(SIndexEntry), sizeof(rec));
+		const SIndexString	* apStrings[3] = { &rec.strName, &rec.strID, &rec.strMIDIChannels };
+		for ( int n = 0 ; n < 3 ; ++n )
+		{
+			if ( static_cast<std::uint64_t>(apStrings[n]->ulOffset) + apStrings[n]->ulLength > hdr.ulStringDataSize )
+				return false;
+		}
+		if ( (rec.ullBegin > rec.ullEnd) || (rec.ullEnd > m_sizeData) )
+			return false;
+
+		SEntry &	entry = vEntries[i];
+		entry.ullBegin = rec.ullBegin;
+		entry.ullEnd = rec.ullEnd;
+		entry.lLineCount = rec.lLineCount;
+		entry.chEOL = static_cast<char>(rec.chEOL);
+		entry.strName.assign(pStringData + rec.strName.ulOffset, rec.strName.ulLength);
+		entry.strID.assign(pStringData + rec.strID.ulOffset, rec.strID.ulLength);
+		entry.strMIDIChannels.assign(pStringData + rec.strMIDIChannels.ulOffset, rec.strMIDIChannels.ulLength);
+	}
+
+	m_vEntries.swap(vEntries);
+	m_mapIDs.clear();
+	for ( std::size_t i = 0 ; i < m_vEntries.size() ; ++i )
+		m_mapIDs.emplace(m_vEntries[i].strID, static_cast<long>(i));
+	return true;
+}
+
+
+
+bool CMultiScaleIndex::WriteIndexFile(const char * szIndexFilepath)
+{
+	if ( !IsOpen() )
+		return m_err.SetError("No file opened.");
+
+	std::vector<SIndexEntry>	vRecords(m_vEntries.size());
+	std::string					strStringData;
+	for ( std::size_t i = 0 ; i < m_vEntries.size() ; ++i )
+	{
+		const SEntry &	entry = m_vEntries[i];
+		SIndexEntry &	rec = vRecords[i];
+		std::memset(&rec, 0, sizeof(rec));
+		rec.ullBegin = entry.ullBegin;
+		rec.ullEnd = entry.ullEnd;
+		rec.lLineCount = static_cast<std::int32_t>(entry.lLineCount);
+		rec.chEOL = static_cast<std::int8_t>(entry.chEOL);
+		AddString(strStringData, rec.strName, entry.strName);
+		AddString(strStringData, rec.strID, entry.strID);
+		AddString(strStringData, rec.strMIDIChannels, entry.strMIDIChannels);
+	}
+
+	SIndexHeader	hdr;
+	std::memset(&hdr, 0, sizeof(hdr));
+	std::memcpy(hdr.achMagic, IndexMagic, sizeof(IndexMagic));
+	hdr.ulEndianTag = IndexEndianTag;
+	hdr.ulVersion = FormatVersion;
+	hdr.ulHeaderSize = sizeof(SIndexHeader);
+	hdr.ullMSFSize = m_sizeData;
+	hdr.llMSFModified = m_llModified;
+	hdr.ulNumOfEntries = static_cast<std::uint32_t>(vRecords.size());
+	hdr.ulStringDataSize = static_cast<std::uint32_t>(strStringData.size());
+	hdr.ullFileSize = sizeof(SIndexHeader) + vRecords.size() * sizeof(SIndexEntry) + strStringData.size();
+
+	std::vector<char>	vchBuffer(static_cast<std::size_t>(hdr.ullFileSize));
+	char	* pData = vchBuffer.data();
+	std::memcpy(pData, &hdr, sizeof(hdr));
+	if ( !vRecords.empty() )
+		std::memcpy(pData + sizeof(hdr), vRecords.data(), vRecords.size() * sizeof(SIndexEntry));
+	std::memcpy(pData + sizeof(hdr) + vRecords.size() * sizeof(SIndexEntry),
+				strStringData.data(), strStringData.size());
+	hdr.ullChecksum = Checksum(pData, vchBuffer.size());
+	std::memcpy(pData, &hdr, sizeof(hdr));
+
+	// Other processes never read an incomplete index
+	if ( !WriteFileAtomically(szIndexFilepath, vchBuffer.data(), vchBuffer.size()) )
+		return m_err.SetError("Error writing the index file.");
+	return m_err.SetOK();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Reading scales
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CMultiScaleIndex::FindID(const std::string & strID) const
+{
+	std::unordered_map<std::string, long>::const_iterator	it = m_mapIDs.find(strID);
+	return ( it == m_mapIDs.end() ? -1 : it->second );
+}
+
+
+
+long CMultiScaleIndex::LoadScale(long lIndex, CSingleScale & SS) const
+{
+	if ( (lIndex < 0) || (lIndex >= GetNumOfDataSets()) )
+		return 0;
+
+	const SEntry &	entry = m_vEntries[lIndex];
+	CStringParser	strparser;
+	strparser.InitMemoryReading(m_pData + entry.ullBegin, static_cast<std::size_t>(entry.ullEnd - entry.ullBegin),
+								entry.lLineCount, entry.chEOL);
+	return SS.Read(strparser);
+}
+
+
+
+long CMultiScaleIndex::LoadScaleByID(const std::string & strID, CSingleScale & SS) const
+{
+	return LoadScale(FindID(strID), SS);
+}
+
+
+
+
+
+} // namespace TUN
@@ -0,0 +1,152 @@
+// TUN_MultiScaleIndex.h: Interface of the class CMultiScaleIndex.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class gives random access to the scale datasets of large
+// multiple scale files (*.MSF). Instead of reading all datasets (see
+// CMultiScaleFile::Add()), an index of the datasets is built, which
+// holds the byte range, the name, the ID and the MIDI channel assignment
+// of each dataset. A single dataset is then read by parsing its byte
+// range only (see LoadScale()).
+//
+// The index can be stored in a side-car file next to the .msf file
+// (see GetDefaultIndexFilepath()). When opening the .msf file again,
+// the index is read from the side-car file, so that opening does not
+// depend on the number of datasets. The side-car file is rebuilt, if
+// the size or the modification time of the .msf file changed.
+//
+// After Open(), the const functions may be called from several threads.
+//
+// Usage:
+//
+//		CMultiScaleIndex	msi;
+//		std::string			strIndex = CMultiScaleIndex::GetDefaultIndexFilepath("lib.msf");
+//		if ( msi.Open("lib.msf", strIndex.c_str()) >= 0 )
+//			msi.LoadScaleByID("my_scale", SS);
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_MULTISCALEINDEX_H__3C5F0B92_8E41_4D27_9A6E_B1D4E0C7F318__INCLUDED_)
+#define AFX_TUN_MULTISCALEINDEX_H__3C5F0B92_8E41_4D27_9A6E_B1D4E0C7F318__INCLUDED_
+
+
+
+
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "TUN_Error.h"
+#include "TUN_MappedFile.h"
+#include "TUN_Scale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CMultiScaleIndex
+{
+public:
+	static constexpr std::uint32_t	FormatVersion = 1; // Increase on each change of the index file!
+
+	struct SEntry
+	{
+		// Byte range of the dataset in the file and the state of the line
+		// counting at its begin (see CStringParser::InitMemoryReading())
+		std::uint64_t	ullBegin;
+		std::uint64_t	ullEnd;
+		long			lLineCount;
+		char			chEOL;
+
+		std::string		strName;
+		std::string		strID;
+		std::string		strMIDIChannels; // Empty = all channels
+	};
+
+	CMultiScaleIndex();
+
+	// Indexes are not copyable
+	CMultiScaleIndex(const CMultiScaleIndex &) = delete;
+	CMultiScaleIndex & operator=(const CMultiScaleIndex &) = delete;
+
+
+
+	// Error handling
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+
+
+	// Opens an .msf file and reads or builds its index.
+	// szIndexFilepath: Side-car file of the index (NULL = none). If it is
+	// missing or outdated, the index is built and the file is written.
+	// -1 = an error occurred (datasets before the error are indexed)
+	// otherwise: Number of datasets found
+	long	Open(const char * szFilepath, const char * szIndexFilepath = NULL);
+	void	Close();
+	bool	IsOpen() const { return m_bOpen; }
+
+	// Default side-car file: The path of the .msf file plus ".idx"
+	static std::string	GetDefaultIndexFilepath(const std::string & strFilepath);
+
+
+
+	long			GetNumOfDataSets() const { return static_cast<long>(m_vEntries.size()); }
+	const SEntry &	GetEntry(long lIndex) const { return m_vEntries.at(lIndex); }
+
+	// Returns the index of the first dataset with the given ID or -1
+	long	FindID(const std::string & strID) const;
+
+
+
+	// Reads a dataset. Returns the same values as CSingleScale::Read(),
+	// i.e. 0 for an invalid index.
+	long	LoadScale(long lIndex, CSingleScale & SS) const;
+	long	LoadScaleByID(const std::string & strID, CSingleScale & SS) const;
+
+
+
+	// Writes the index to a side-car file
+	bool	WriteIndexFile(const char * szIndexFilepath);
+
+
+
+private:
+	bool	ReadIndexFile(const char * szIndexFilepath);
+	long	Build();
+
+	bool									m_bOpen;
+	CMappedFile								m_mf;
+	std::string								m_strData; // If the file can not be mapped
+	const char								* m_pData;
+	std::size_t								m_sizeData;
+	std::int64_t							m_llModified; // Modification time of the file
+
+	std::vector<SEntry>						m_vEntries;
+	std::unordered_map<std::string, long>	m_mapIDs; // ID -> index of the first dataset
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_MULTISCALEINDEX_H__3C5F0B92_8E41_4D27_9A6E_B1D4E0C7F318__INCLUDED_)
@@ -45,6 +45,9 @@
 #include <cmath>
 
 #include "TUN_Scale.h"
+#include "TUN_MappedFile.h"
+#include "TUN_FormulaEngine.h"
+#include "TUN_FormulaProgram.h"
 
 
 
@@ -90,6 +93,40 @@ double Factor2Cents(double dblFactor)
 	return log(dblFactor) * (1200/log(2));
 }
 
+// Converts Hz to cents like Hz2Cents(), but corrects the rounding errors
+// of log() and pow() by a few ulps, so that Cents2Hz() gives the
+// closest possible value to dblHz. For cent values up to about
+// 1700, this is always the identical value.
+static double Hz2CentsRoundTrip(double dblHz, double dblBaseFreqHz)
+{
+	double	dblCents = Hz2Cents(dblHz, dblBaseFreqHz);
+	if ( !std::isfinite(dblCents) )
+		return dblCents;
+
+	double	dblBestCents = dblCents;
+	double	dblBestDiff = fabs(Cents2Hz(dblCents, dblBaseFreqHz) - dblHz);
+	double	dblUp = dblCents;
+	double	dblDown = dblCents;
+	for ( int i = 0 ; (i < 2) && (dblBestDiff != 0) ; ++i )
+	{
+		dblUp = nextafter(dblUp, HUGE_VAL);
+		dblDown = nextafter(dblDown, -HUGE_VAL);
+		double	dblDiffUp = fabs(Cents2Hz(dblUp, dblBaseFreqHz) - dblHz);
+		double	dblDiffDown = fabs(Cents2Hz(dblDown, dblBaseFreqHz) - dblHz);
+		if ( dblDiffUp < dblBestDiff )
+		{
+			dblBestCents = dblUp;
+			dblBestDiff = dblDiffUp;
+		}
+		if ( dblDiffDown < dblBestDiff )
+		{
+			dblBestCents = dblDown;
+			dblBestDiff = dblDiffDown;
+		}
+	}
+	return dblBestCents;
+}
+
 double MIDINote_DefaultHz(int nMIDINote)
 {
 	return Cents2Hz(MIDINote_DefaultCents(nMIDINote), DefaultBaseFreqHz);
@@ -118,79 +155,88 @@ double MIDINote_DefaultCents(int nMIDINote)
 
 std::vector<std::string>	CSingleScale::m_vstrSections;
 std::vector<std::string>	CSingleScale::m_vstrKeys;
+alignas(64) const double	CSingleScale::m_adblMutedMIDINotesHz[CSingleScale::NumOfMIDINotes] = {};
 
 
 
-CSingleScale	ssTemporary___; // To ensure that the static vectors are initialized!
+// Names of the known sections and keys
+// Array index = eSection and eKey, respectively
+static constexpr std::string_view	SectionNames[CSingleScale::SEC_NumOfSections] =
+{
+	"",
+	"Scale Begin",
+	"Scale End",
 
+	"Info",
+	"Editor Specifics",
 
+	"Tuning",
+	"Exact Tuning",
+	"Functional Tuning",
 
-CSingleScale::CSingleScale()
-{
-	// If not yet done, initialize vectors with sections and keys
-	if ( m_vstrSections.empty() )
-	{
-		m_vstrSections.resize(SEC_NumOfSections);
-		m_vstrSections.at(SEC_ScaleBegin) = "Scale Begin";
-		m_vstrSections.at(SEC_ScaleEnd) = "Scale End";
+	"Mapping",
 
-		m_vstrSections.at(SEC_Info) = "Info";
-		m_vstrSections.at(SEC_EditorSpecifics) = "Editor Specifics";
+	"Assignment",
 
-		m_vstrSections.at(SEC_Tuning) = "Tuning";
-		m_vstrSections.at(SEC_ExactTuning) = "Exact Tuning";
-		m_vstrSections.at(SEC_FunctionalTuning) = "Functional Tuning";
+	"_DataSet_"
+};
 
-		m_vstrSections.at(SEC_Mapping) = "Mapping";
+static constexpr std::string_view	KeyNames[CSingleScale::KEY_NumOfKeys] =
+{
+	"",
+	// Keys of section [Scale Begin]
+	"Format",
+	"FormatVersion",
+	"FormatSpecs",
+	// Keys of section [Info]
+	"Name",
+	"ID",
+	"Filename",
+	"Author",
+	"Location",
+	"Contact",
+	"Date",
+	"Editor",
+	"EditorSpecs",
+	"Description",
+	"Keyword",
+	"History",
+	"Geography",
+	"Instrument",
+	"Composition",
+	"Comments",
+	// Keys of sections [Tuning] and [Exact Tuning]
+	"Note",
+	"BaseFreq",
+	"InitEqual",
+	// Keys of sections [Mapping]
+	"LoopSize",
+	"Keyboard",
+	// Keys of sections [Assignment]
+	"MIDIChannel",
+	// Keys of sections [_DataSet_]
+	"AllData"
+};
 
-		m_vstrSections.at(SEC_Assignment) = "Assignment";
 
-		m_vstrSections.at(SEC_DataSet) = "_DataSet_";
-	}
-	if ( m_vstrKeys.empty() )
-	{
-		m_vstrKeys.resize(KEY_NumOfKeys);
-		// Keys of section [Scale Begin]
-		m_vstrKeys.at(KEY_Format) = "Format";
-		m_vstrKeys.at(KEY_FormatVersion) = "FormatVersion";
-		m_vstrKeys.at(KEY_FormatSpecs) = "FormatSpecs";
-		// Keys of section [Info]
-		m_vstrKeys.at(KEY_Name) = "Name";
-		m_vstrKeys.at(KEY_ID) = "ID";
-		m_vstrKeys.at(KEY_Filename) = "Filename";
-		m_vstrKeys.at(KEY_Author) = "Author";
-		m_vstrKeys.at(KEY_Location) = "Location";
-		m_vstrKeys.at(KEY_Contact) = "Contact";
-		m_vstrKeys.at(KEY_Date) = "Date";
-		m_vstrKeys.at(KEY_Editor) = "Editor";
-		m_vstrKeys.at(KEY_EditorSpecs) = "EditorSpecs";
-		m_vstrKeys.at(KEY_Description) = "Description";
-		m_vstrKeys.at(KEY_Keyword) = "Keyword";
-		m_vstrKeys.at(KEY_History) = "History";
-		m_vstrKeys.at(KEY_Geography) = "Geography";
-		m_vstrKeys.at(KEY_Instrument) = "Instrument";
-		m_vstrKeys.at(KEY_Composition) = "Composition";
-		m_vstrKeys.at(KEY_Comments) = "Comments";
-		// Keys of sections [Tuning] and [Exact Tuning]
-		m_vstrKeys.at(KEY_Note) = "Note";
-		m_vstrKeys.at(KEY_BaseFreq) = "BaseFreq";
-		m_vstrKeys.at(KEY_InitEqual) = "InitEqual";
-		// Keys of sections [Mapping]
-		m_vstrKeys.at(KEY_LoopSize) = "LoopSize";
-		m_vstrKeys.at(KEY_Keyboard) = "Keyboard";
-		// Keys of sections [Assignment]
-		m_vstrKeys.at(KEY_MIDIChannel) = "MIDIChannel";
-		// Keys of sections [_DataSet_]
-		m_vstrKeys.at(KEY_AllData) = "AllData";
-	}
-	// Provide a standard tuning
-	Reset();
-}
+
+CSingleScale	ssTemporary___; // To ensure that the static vectors are initialized!
 
 
 
-CSingleScale::~CSingleScale()
+CSingleScale::CSingleScale()
 {
+	// If not yet done, initialize vectors with sections and keys
+	if ( m_vstrSections.empty() )
+		m_vstrSections.assign(std::begin(SectionNames), std::end(SectionNames));
+	if ( m_vstrKeys.empty() )
+		m_vstrKeys.assign(std::begin(KeyNames), std::end(KeyNames));
+	// Formulas are evaluated at once by default
+	m_bDeferredEvaluation = false;
+	m_bEqualPending = false;
+	m_lNumOfPendingFormulas = 0;
+	// Provide a standard tuning
+	Reset();
 }
 
 
@@ -237,11 +283,11 @@ void CSingleScale::Reset()
 	// Resize vectors for note frequencies
 	m_vdblNoteFrequenciesHz.resize(MaxNumOfNotes);
 
-	// Initialize scale frequencies
-	InitEqual();
-
 	// Initialize mapping
 	ResetKeyboardMapping();
+
+	// Initialize scale frequencies (also updates the MIDI note frequency table)
+	InitEqual();
 }
 
 
@@ -263,12 +309,26 @@ void CSingleScale::InitEqual(long lBaseNote /* = 69 */,
 	m_lInitEqual_BaseNote = lBaseNote;
 	m_dblInitEqual_BaseFreqHz = dblBaseFreqHz;
 
-	for ( int i = 0 ; i < MaxNumOfNotes ; ++i )
-		m_vdblNoteFrequenciesHz.at(i) =
-			m_dblInitEqual_BaseFreqHz * pow(2, (i-lBaseNote) / 12.);
-
 	// Clear formulas
 	m_lformulas.clear();
+	m_lNumOfPendingFormulas = 0;
+
+	// In deferred mode, the frequencies are set by EvaluateFormulas()
+	m_bEqualPending = m_bDeferredEvaluation;
+	if ( m_bEqualPending )
+		return;
+	SetEqualFrequencies();
+
+	UpdateMIDINoteFreqTable();
+}
+
+
+
+void CSingleScale::SetEqualFrequencies() const
+{
+	for ( int i = 0 ; i < MaxNumOfNotes ; ++i )
+		m_vdblNoteFrequenciesHz.at(i) =
+			m_dblInitEqual_BaseFreqHz * pow(2, (i-m_lInitEqual_BaseNote) / 12.);
 }
 
 
@@ -285,8 +345,149 @@ void CSingleScale::InitEqual(long lBaseNote /* = 69 */,
 
 void CSingleScale::AddFormula(CFormula formula)
 {
+	if ( m_bDeferredEvaluation && formula.HasValidRefs() )
+	{
+		m_lformulas.push_back(formula);
+		++m_lNumOfPendingFormulas;
+		return;
+	}
+	EvaluateFormulas(); // Invalid formulas throw like before
 	formula.Apply(m_vdblNoteFrequenciesHz);
 	m_lformulas.push_back(formula);
+	UpdateMIDINoteFreqTable();
+}
+
+
+
+void CSingleScale::SetFormulas(const CFormulaEngine & engine)
+{
+	m_lformulas = engine.GetFormulas();
+	m_vdblNoteFrequenciesHz = engine.GetNoteFrequenciesHz();
+	m_bEqualPending = false;
+	m_lNumOfPendingFormulas = 0;
+	UpdateMIDINoteFreqTable();
+}
+
+
+
+bool CSingleScale::SetFormulas(const std::list<CFormula> & lformulas)
+{
+	CFormulaProgram	program;
+	if ( !program.Compile(lformulas) )
+		return m_err.SetError(program.Err());
+	std::list<CFormula>	lformulasNew(lformulas); // lformulas may be m_lformulas
+	InitEqual(m_lInitEqual_BaseNote, m_dblInitEqual_BaseFreqHz);
+	if ( m_bEqualPending )
+	{
+		// Deferred mode
+		m_lformulas = std::move(lformulasNew);
+		m_lNumOfPendingFormulas = static_cast<long>(m_lformulas.size());
+		return m_err.SetOK();
+	}
+	program.Run(m_vdblNoteFrequenciesHz);
+	m_lformulas = std::move(lformulasNew);
+	UpdateMIDINoteFreqTable();
+	return m_err.SetOK();
+}
+
+
+
+bool CSingleScale::CompactFormulas()
+{
+	// Apply() below throws for invalid references
+	std::list<CFormula>::const_iterator	itCheck;
+	for ( itCheck = m_lformulas.begin() ; itCheck != m_lformulas.end() ; ++itCheck )
+		if ( !itCheck->HasValidRefs() )
+			return m_err.SetError("Formula refers to an invalid note index!");
+	EvaluateFormulas(); // Pending formulas might be removed
+
+	// Removing formulas may turn others into formulas without effect
+	bool	bRemoved;
+	do
+	{
+		std::vector<std::list<CFormula>::iterator>	vitFormulas;
+		std::vector<bool>							vbRemove;
+		vitFormulas.reserve(m_lformulas.size());
+		vbRemove.reserve(m_lformulas.size());
+
+		// Forward: Find the formulas which do not change any value
+		// (starting with the equal tuning, see InitEqual())
+		std::vector<double>	vdblHz(MaxNumOfNotes), vdblPrevHz;
+		for ( int i = 0 ; i < MaxNumOfNotes ; ++i )
+			vdblHz[i] = m_dblInitEqual_BaseFreqHz * pow(2, (i-m_lInitEqual_BaseNote) / 12.);
+		std::list<CFormula>::iterator	it;
+		for ( it = m_lformulas.begin() ; it != m_lformulas.end() ; ++it )
+		{
+			vdblPrevHz = vdblHz;
+			it->Apply(vdblHz);
+			vitFormulas.push_back(it);
+			vbRemove.push_back(memcmp(vdblPrevHz.data(), vdblHz.data(), MaxNumOfNotes * sizeof(double)) == 0);
+		}
+
+		// Backward: Find the formulas whose values are not read afterwards
+		// (the final values count as read)
+		std::vector<bool>	vbRead(MaxNumOfNotes, true);
+		long				lNumOfRead = MaxNumOfNotes;
+		for ( long l = static_cast<long>(vitFormulas.size())-1 ; l >= 0 ; --l )
+		{
+			if ( vbRemove[l] )
+				continue;
+			const CFormula &	formula = *vitFormulas[l];
+			bool				bUsed = false;
+			for ( long lStep = formula.GetNumOfSteps()-1 ; lStep >= 0 ; --lStep )
+			{
+				long	lIndex = formula.GetStepIndex(lStep);
+				if ( formula.GetEnsureHz() > 0 )
+				{
+					// Writes all notes from their previous values and the value of lIndex
+					if ( lNumOfRead == 0 )
+						continue;
+					bUsed = true;
+					if ( !vbRead[lIndex] )
+					{
+						vbRead[lIndex] = true;
+						++lNumOfRead;
+					}
+					continue;
+				}
+				if ( !vbRead[lIndex] )
+					continue; // Value of this step is overwritten
+				bUsed = true;
+				vbRead[lIndex] = false;
+				--lNumOfRead;
+				const SRVParam *	aprvp[2] = { &formula.GetRangeHz(), &formula.GetShiftHz() };
+				for ( int i = 0 ; i < 2 ; ++i )
+				{
+					if ( !aprvp[i]->IsRef() || vbRead[aprvp[i]->GetRefIndex(lIndex)] )
+						continue;
+					vbRead[aprvp[i]->GetRefIndex(lIndex)] = true;
+					++lNumOfRead;
+				}
+			}
+			vbRemove[l] = !bUsed;
+		}
+
+		bRemoved = false;
+		for ( long l = 0 ; l < static_cast<long>(vitFormulas.size()) ; ++l )
+		{
+			if ( vbRemove[l] )
+			{
+				m_lformulas.erase(vitFormulas[l]);
+				bRemoved = true;
+			}
+		}
+	} while ( bRemoved );
+
+	return m_err.SetOK();
+}
+
+
+
+void CSingleScale::SetMapping(const std::vector<long> & vlMapping)
+{
+	for ( long i = 0 ; i < MaxNumOfNotes ; ++i )
+		m_vlMapping.at(i) = ( i < static_cast<long>(vlMapping.size()) ? vlMapping[i] : i );
+	UpdateMIDINoteFreqTable();
 }
 
 
@@ -296,19 +497,24 @@ void CSingleScale::SetMappingLoopSize(long lMappingLoopSize)
 	if ( lMappingLoopSize < 1 )
 		lMappingLoopSize = 0;
 	m_lMappingLoopSize = lMappingLoopSize;
+	UpdateMIDINoteFreqTable();
 }
 
 
 
-long CSingleScale::MapMIDI2Scale(long lMIDINoteNumber) const
+long CSingleScale::MapMIDI2Scale(long lMIDINoteNumber) const noexcept
 {
+	lMIDINoteNumber = ClampMIDINote(lMIDINoteNumber);
+
+	// The mapping might have been resized via GetMapping()
+	long	lMapSize = static_cast<long>(m_vlMapping.size());
 	if ( m_lMappingLoopSize <= 0 )
-		return m_vlMapping.at(lMIDINoteNumber);
+		return ( lMIDINoteNumber < lMapSize ? m_vlMapping[lMIDINoteNumber] : lMIDINoteNumber );
 	else
 	{
 		long	lOctave = lMIDINoteNumber / m_lMappingLoopSize;
 		long	lOffset = lMIDINoteNumber % m_lMappingLoopSize;
-		long	lScaleNoteNumber = m_vlMapping.at(lOffset) + lOctave * m_lMappingLoopSize;
+		long	lScaleNoteNumber = ( lOffset < lMapSize ? m_vlMapping[lOffset] : lOffset ) + lOctave * m_lMappingLoopSize;
 		if ( lScaleNoteNumber < 0 )
 			lScaleNoteNumber = 0;
 		if ( lScaleNoteNumber >= MaxNumOfNotes )
@@ -319,6 +525,59 @@ long CSingleScale::MapMIDI2Scale(long lMIDINoteNumber) const
 
 
 
+void CSingleScale::UpdateMIDINoteFreqTable()
+{
+	// Otherwise EvaluateFormulas() updates the table
+	if ( !IsEvaluationPending() )
+		BuildMIDINoteFreqTable();
+}
+
+
+
+void CSingleScale::BuildMIDINoteFreqTable() const
+{
+	for ( long i = 0 ; i < NumOfMIDINotes ; ++i )
+	{
+		long	lScaleNoteNumber = MapMIDI2Scale(i);
+		if ( (lScaleNoteNumber >= 0) && (lScaleNoteNumber < MaxNumOfNotes) )
+			m_adblMIDINoteFreqHz[i] = m_vdblNoteFrequenciesHz[lScaleNoteNumber];
+		else
+			m_adblMIDINoteFreqHz[i] = 0; // Not mapped -> muted
+	}
+}
+
+
+
+void CSingleScale::SetDeferredEvaluation(bool bDeferred)
+{
+	m_bDeferredEvaluation = bDeferred;
+	if ( !m_bDeferredEvaluation )
+		EvaluateFormulas();
+}
+
+
+
+void CSingleScale::EvaluateFormulas() const
+{
+	if ( !IsEvaluationPending() )
+		return;
+	if ( m_bEqualPending )
+		SetEqualFrequencies();
+
+	// The formulas were checked when they were queued, so Apply() does
+	// not throw
+	std::list<CFormula>::const_iterator	it = m_lformulas.end();
+	std::advance(it, -m_lNumOfPendingFormulas);
+	for ( ; it != m_lformulas.end() ; ++it )
+		it->Apply(m_vdblNoteFrequenciesHz);
+
+	m_bEqualPending = false;
+	m_lNumOfPendingFormulas = 0;
+	BuildMIDINoteFreqTable();
+}
+
+
+
 
 
 //////////////////////////////////////////////////////////////////////
@@ -342,6 +601,39 @@ bool CSingleScale::Write(std::ostream & os,
 						 long lVersionFrom /* = 0 */,
 						 long lVersionTo /* = 200 */,
 						 bool bWriteHeaderComment /* = true */)
+{
+	// Format the complete file in memory and write it at once
+	std::string	str;
+	if ( !WriteToString(str, lVersionFrom, lVersionTo, bWriteHeaderComment) )
+		return false;
+
+	os.write(str.data(), str.size());
+	if ( !os )
+		return m_err.SetError("Error writing the file.");
+	return m_err.SetOK();
+}
+
+
+
+bool CSingleScale::WriteToBuffer(std::vector<char> & vchBuffer,
+								 long lVersionFrom /* = 0 */,
+								 long lVersionTo /* = 200 */,
+								 bool bWriteHeaderComment /* = true */)
+{
+	std::string	str;
+	if ( !WriteToString(str, lVersionFrom, lVersionTo, bWriteHeaderComment) )
+		return false;
+
+	vchBuffer.insert(vchBuffer.end(), str.begin(), str.end());
+	return true;
+}
+
+
+
+bool CSingleScale::WriteToString(std::string & str,
+								 long lVersionFrom /* = 0 */,
+								 long lVersionTo /* = 200 */,
+								 bool bWriteHeaderComment /* = true */)
 {
 	// Evaluate which sections to write
 	if ( lVersionFrom < 0 )
@@ -355,78 +647,89 @@ bool CSingleScale::Write(std::ostream & os,
 	bool	bV100 = ((lVersionFrom <= 100) && (lVersionTo >= 100));
 	bool	bV200 = ((lVersionFrom <= 200) && (lVersionTo >= 200));
 
+	// The sections of version 0 and 1 contain the note frequencies
+	if ( bV000 || bV100 )
+		EvaluateFormulas();
+
 	int				i;
 
+	// Avoid reallocations while appending
+	std::size_t	sizeRequired = str.size() + GetWriteSizeEstimate(lVersionFrom, lVersionTo);
+	if ( str.capacity() < sizeRequired )
+		str.reserve(std::max(sizeRequired, 2 * str.capacity()));
+
 	// Header comment
 	if ( bV100 || bV200 )
 	{
-		os << ";" << std::endl;
-		os << "; This is an AnaMark tuning map file V2.00" << std::endl;
+		str += ";\n";
+		str += "; This is an AnaMark tuning map file V2.00\n";
 		if ( !bV200 )
-			os << "; written in V1.00 compatibility mode" << std::endl;
-		os << ";" << std::endl;
-		os << "; Free .TUN file handling source code (C)2009 by Mark Henning, Germany" << std::endl;
-		os << ";" << std::endl;
-		os << "; Specifications and free source code see:" << std::endl;
-		os << ";         " << FormatSpecs() << std::endl;
-		os << ";" << std::endl;
-		os << std::endl;
-		os << std::endl;
+			str += "; written in V1.00 compatibility mode\n";
+		str += ";\n";
+		str += "; Free .TUN file handling source code (C)2009 by Mark Henning, Germany\n";
+		str += ";\n";
+		str += "; Specifications and free source code see:\n";
+		str += ";         ";
+		str += FormatSpecs();
+		str += '\n';
+		str += ";\n";
+		str += '\n';
+		str += '\n';
 	}
 
 	// Section [Scale Begin]
 	if ( bV100 || bV200 )
 	{
-		os << ";" << std::endl;
-		os << "; Begin of tuning file and format declaration" << std::endl;
-		os << ";" << std::endl;
-		WriteSection(os, SEC_ScaleBegin);
-		WriteKey(os, KEY_Format, std::string(Format()));
-		WriteKey(os, KEY_FormatVersion, long(FormatVersion()));
-		WriteKey(os, KEY_FormatSpecs, std::string(FormatSpecs()));
-		os << std::endl;
-		os << std::endl;
+		str += ";\n";
+		str += "; Begin of tuning file and format declaration\n";
+		str += ";\n";
+		WriteSection(str, SEC_ScaleBegin);
+		WriteKey(str, KEY_Format, std::string(Format()));
+		WriteKey(str, KEY_FormatVersion, long(FormatVersion()));
+		WriteKey(str, KEY_FormatSpecs, std::string(FormatSpecs()));
+		str += '\n';
+		str += '\n';
 	}
 
 	// Section [Assignment]
 	if ( bV200 && !m_lmcrChannels.empty() ) // Versions below 200 do not support Multi Scale Files!
 	{
-		os << ";" << std::endl;
-		os << "; Assignment of scale dataset" << std::endl;
-		os << "; Note: This might be ignored, if this is not part of a MSF-File!" << std::endl;
-		os << "; See the documentation of the software you use for details." << std::endl;
-		os << ";" << std::endl;
-		WriteSection(os, SEC_Assignment);
-		WriteKey(os, KEY_MIDIChannel, GetMIDIChannelsAssignment());
-		os << std::endl;
-		os << std::endl;
+		str += ";\n";
+		str += "; Assignment of scale dataset\n";
+		str += "; Note: This might be ignored, if this is not part of a MSF-File!\n";
+		str += "; See the documentation of the software you use for details.\n";
+		str += ";\n";
+		WriteSection(str, SEC_Assignment);
+		WriteKey(str, KEY_MIDIChannel, GetMIDIChannelsAssignment());
+		str += '\n';
+		str += '\n';
 	}
 
 	// Section [Info]
 	if ( bV100 || bV200 )
 	{
-		os << ";" << std::endl;
-		os << "; Scale informations" << std::endl;
-		os << ";" << std::endl;
-		WriteSection(os, SEC_Info);
-		WriteKey(os, KEY_Name, m_strName);
-		WriteKey(os, KEY_ID, m_strID);
-		WriteKey(os, KEY_Filename, m_strFilename);
-		WriteKey(os, KEY_Author, m_strAuthor);
-		WriteKey(os, KEY_Location, m_strLocation);
-		WriteKey(os, KEY_Contact, m_strContact);
-		WriteKey(os, KEY_Date, m_strDate);
-		WriteKey(os, KEY_Editor, m_strEditor);
-		WriteKey(os, KEY_EditorSpecs, m_strEditorSpecs);
-		WriteKey(os, KEY_Description, m_strDescription);
-		WriteKey(os, KEY_Keyword, m_lstrKeywords);
-		WriteKey(os, KEY_History, m_strHistory);
-		WriteKey(os, KEY_Geography, m_strGeography);
-		WriteKey(os, KEY_Instrument, m_strInstrument);
-		WriteKey(os, KEY_Composition, m_lstrCompositions);
-		WriteKey(os, KEY_Comments, m_strComments);
-		os << std::endl;
-		os << std::endl;
+		str += ";\n";
+		str += "; Scale informations\n";
+		str += ";\n";
+		WriteSection(str, SEC_Info);
+		WriteKey(str, KEY_Name, m_strName);
+		WriteKey(str, KEY_ID, m_strID);
+		WriteKey(str, KEY_Filename, m_strFilename);
+		WriteKey(str, KEY_Author, m_strAuthor);
+		WriteKey(str, KEY_Location, m_strLocation);
+		WriteKey(str, KEY_Contact, m_strContact);
+		WriteKey(str, KEY_Date, m_strDate);
+		WriteKey(str, KEY_Editor, m_strEditor);
+		WriteKey(str, KEY_EditorSpecs, m_strEditorSpecs);
+		WriteKey(str, KEY_Description, m_strDescription);
+		WriteKey(str, KEY_Keyword, m_lstrKeywords);
+		WriteKey(str, KEY_History, m_strHistory);
+		WriteKey(str, KEY_Geography, m_strGeography);
+		WriteKey(str, KEY_Instrument, m_strInstrument);
+		WriteKey(str, KEY_Composition, m_lstrCompositions);
+		WriteKey(str, KEY_Comments, m_strComments);
+		str += '\n';
+		str += '\n';
 	}
 
 	// You might write some editor specific data here...
@@ -435,33 +738,35 @@ bool CSingleScale::Write(std::ostream & os,
 		// Currently we don't have such specific data, so don't write the section
 		if ( false )
 		{
-			os << ";" << std::endl;
-			os << "; Editor specific data" << std::endl;
-			os << ";" << std::endl;
-			WriteSection(os, SEC_EditorSpecifics);
-			os << std::endl;
-			os << std::endl;
+			str += ";\n";
+			str += "; Editor specific data\n";
+			str += ";\n";
+			WriteSection(str, SEC_EditorSpecifics);
+			str += '\n';
+			str += '\n';
 		}
 	}
 
 	// Section [Functional Tuning]
 	if ( bV200 )
 	{
-		os << ";" << std::endl;
-		os << "; Version 2:" << std::endl;
-		os << "; Functional tunings" << std::endl;
-		os << ";" << std::endl;
-		WriteSection(os, SEC_FunctionalTuning);
-		os.precision(10);
-		os << m_vstrKeys.at(KEY_InitEqual).c_str()
-		   << " = (" << m_lInitEqual_BaseNote
-		   << ", " << m_dblInitEqual_BaseFreqHz
-		   << ")" << std::endl;
+		str += ";\n";
+		str += "; Version 2:\n";
+		str += "; Functional tunings\n";
+		str += ";\n";
+		WriteSection(str, SEC_FunctionalTuning);
+		char	sz[strx::DoubleStrSize];
+		str += m_vstrKeys.at(KEY_InitEqual);
+		str += " = (";
+		str += strx::ltostr(m_lInitEqual_BaseNote);
+		str += ", ";
+		str.append(sz, strx::dtostr(m_dblInitEqual_BaseFreqHz, sz));
+		str += ")\n";
 		std::list<CFormula>::const_iterator	it;
 		for ( it = m_lformulas.begin() ; it != m_lformulas.end() ; ++it )
-			WriteKey(os, KEY_Note, it->GetAsStr(), it->GetMyIndex());
-		os << std::endl;
-		os << std::endl;
+			WriteKey(str, KEY_Note, it->GetAsStr(), it->GetMyIndex());
+		str += '\n';
+		str += '\n';
 	}
 
 	// Section [Exact Tuning]
@@ -469,39 +774,38 @@ bool CSingleScale::Write(std::ostream & os,
 	{
 		double	dblET_BaseFreqHz = m_dblInitEqual_BaseFreqHz * pow(2, -m_lInitEqual_BaseNote / 12.);
 
-		os << ";" << std::endl;
-		os << "; Version 1:" << std::endl;
-		os << "; AnaMark-specific section with exact tunings" << std::endl;
-		os << ";" << std::endl;
-		WriteSection(os, SEC_ExactTuning);
-		os.precision(10);
-		WriteKey(os, KEY_BaseFreq, dblET_BaseFreqHz);
+		str += ";\n";
+		str += "; Version 1:\n";
+		str += "; AnaMark-specific section with exact tunings\n";
+		str += ";\n";
+		WriteSection(str, SEC_ExactTuning);
+		WriteKey(str, KEY_BaseFreq, dblET_BaseFreqHz);
 		for ( i = 0 ; i < MaxNumOfNotes ; ++i )
-			WriteKey(os, KEY_Note,
-					 Hz2Cents(m_vdblNoteFrequenciesHz.at(MapMIDI2Scale(i)),
-							  dblET_BaseFreqHz),
+			WriteKey(str, KEY_Note,
+					 Hz2CentsRoundTrip(m_vdblNoteFrequenciesHz.at(MapMIDI2Scale(i)),
+									   dblET_BaseFreqHz),
 					 i);
-		os << std::endl;
-		os << std::endl;
+		str += '\n';
+		str += '\n';
 	}
 
 	// Section [Tuning]
 	if ( bV000 )
 	{
-		os << ";" << std::endl;
-		os << "; Version 0:" << std::endl;
-		os << "; VAZ-section with quantized tunings" << std::endl;
-		os << ";" << std::endl;
-		WriteSection(os, SEC_Tuning);
+		str += ";\n";
+		str += "; Version 0:\n";
+		str += "; VAZ-section with quantized tunings\n";
+		str += ";\n";
+		WriteSection(str, SEC_Tuning);
 		for ( i = 0 ; i < MaxNumOfNotes ; ++i )
-			WriteKey(os, KEY_Note,
+			WriteKey(str, KEY_Note,
 					 long(static_cast<long>(floor(
 						Hz2Cents(m_vdblNoteFrequenciesHz.at(MapMIDI2Scale(i)),
 								 DefaultBaseFreqHz) + 0.5
 					 ))),
 					 i);
-		os << std::endl;
-		os << std::endl;
+		str += '\n';
+		str += '\n';
 	}
 
 	// Section [Mapping]
@@ -515,42 +819,42 @@ bool CSingleScale::Write(std::ostream & os,
 
 		if ( bNeedsMapping )
 		{
-			os << ";" << std::endl;
-			os << "; Keyboard mapping: Keyboard note number -> scale note number" << std::endl;
-			os << ";" << std::endl;
-			WriteSection(os, SEC_Mapping);
-			WriteKey(os, KEY_LoopSize, m_lMappingLoopSize);
+			str += ";\n";
+			str += "; Keyboard mapping: Keyboard note number -> scale note number\n";
+			str += ";\n";
+			WriteSection(str, SEC_Mapping);
+			WriteKey(str, KEY_LoopSize, m_lMappingLoopSize);
 			for ( i = 0 ; i < lMapSize ; ++i )
 			{
 				if ( m_vlMapping.at(i) != i )
-					WriteKey(os, KEY_Keyboard, m_vlMapping.at(i), i);
+					WriteKey(str, KEY_Keyboard, m_vlMapping.at(i), i);
 			}
-			os << std::endl;
-			os << std::endl;
+			str += '\n';
+			str += '\n';
 		}
 	}
 	else
 	{
 		if ( bV100 )
 		{
-			os << ";" << std::endl;
-			os << "; In V1.00 compatibility mode, there is no explicit keyboard mapping" << std::endl;
-			os << "; The order of frequencies above includes keyboard mapping settings." << std::endl;
-			os << ";" << std::endl;
-			os << std::endl;
-			os << std::endl;
+			str += ";\n";
+			str += "; In V1.00 compatibility mode, there is no explicit keyboard mapping\n";
+			str += "; The order of frequencies above includes keyboard mapping settings.\n";
+			str += ";\n";
+			str += '\n';
+			str += '\n';
 		}
 	}
 
 	// Section [Scale End]
 	if ( bV100 || bV200 )
 	{
-		os << ";" << std::endl;
-		os << "; End of tuning file" << std::endl;
-		os << ";" << std::endl;
-		WriteSection(os, SEC_ScaleEnd);
-		os << std::endl;
-		os << std::endl;
+		str += ";\n";
+		str += "; End of tuning file\n";
+		str += ";\n";
+		WriteSection(str, SEC_ScaleEnd);
+		str += '\n';
+		str += '\n';
 	}
 
 	return m_err.SetOK();
@@ -558,17 +862,72 @@ bool CSingleScale::Write(std::ostream & os,
 
 
 
-void CSingleScale::WriteSection(std::ostream & os, eSection section) const
+std::size_t CSingleScale::GetWriteSizeEstimate(long lVersionFrom /* = 0 */,
+												long lVersionTo /* = 200 */) const
+{
+	bool	bV000 = ((lVersionFrom <= 0) && (lVersionTo >= 0));
+	bool	bV100 = ((lVersionFrom <= 100) && (lVersionTo >= 100));
+	bool	bV200 = ((lVersionFrom <= 200) && (lVersionTo >= 200));
+
+	// Comments, section and key names
+	std::size_t	sizeEstimate = 4096;
+
+	// Info strings (plus some space for escape sequences)
+	if ( bV100 || bV200 )
+	{
+		sizeEstimate += m_strName.size() + m_strID.size() + m_strFilename.size() +
+						m_strAuthor.size() + m_strLocation.size() + m_strContact.size() +
+						m_strDate.size() + m_strEditor.size() + m_strEditorSpecs.size() +
+						m_strDescription.size() + m_strHistory.size() + m_strGeography.size() +
+						m_strInstrument.size() + m_strComments.size();
+		std::list<std::string>::const_iterator	it;
+		for ( it = m_lstrKeywords.begin() ; it != m_lstrKeywords.end() ; ++it )
+			sizeEstimate += it->size() + 16;
+		for ( it = m_lstrCompositions.begin() ; it != m_lstrCompositions.end() ; ++it )
+			sizeEstimate += it->size() + 16;
+		sizeEstimate += sizeEstimate / 8;
+	}
+
+	// Lines like 'Note 127 = "#>-1 %1.2345678 ~12"', 'Note 127 = 1234.567890123456'
+	// 'Note 127 = 12345' and 'Keyboard 127 = 127'
+	if ( bV200 )
+		sizeEstimate += m_lformulas.size() * 48 + MaxNumOfNotes * 20;
+	if ( bV100 )
+		sizeEstimate += MaxNumOfNotes * 32;
+	if ( bV000 )
+		sizeEstimate += MaxNumOfNotes * 20;
+
+	return sizeEstimate;
+}
+
+
+
+void CSingleScale::WriteSection(std::string & str, eSection section) const
 {
 	if ( (section <= SEC_Unknown) || (section >= SEC_NumOfSections) )
 		return;
 
-	os << strx::GetAsSection(m_vstrSections.at(section)).c_str() << std::endl;
+	str += '[';
+	str += m_vstrSections.at(section);
+	str += "]\n";
 }
 
 
 
-void CSingleScale::WriteKey(std::ostream & os, eKey key,
+void CSingleScale::WriteKeyName(std::string & str, eKey key, long lKeyIndex) const
+{
+	str += m_vstrKeys.at(key);
+	if ( (key == KEY_Note) || (key == KEY_Keyboard) )
+	{
+		str += ' ';
+		str += strx::ltostr(lKeyIndex);
+	}
+	str += " = ";
+}
+
+
+
+void CSingleScale::WriteKey(std::string & str, eKey key,
 							const std::list<std::string> & lstrValues) const
 {
 	if ( (key <= KEY_Unknown) || (key >= KEY_NumOfKeys) || (lstrValues.empty()) )
@@ -579,69 +938,78 @@ void CSingleScale::WriteKey(std::ostream & os, eKey key,
 	{
 		if ( it->empty() )
 			continue;
-		os << m_vstrKeys.at(key).c_str()
-			<< " = " << strx::GetAsString(*it).c_str() << std::endl;
+		WriteKeyName(str, key, -1);
+		strx::AppendAsString(str, *it);
+		str += '\n';
 	}
 }
 
 
 
-void CSingleScale::WriteKey(std::ostream & os, eKey key,
+void CSingleScale::WriteKey(std::string & str, eKey key,
 							const std::string & strValue, long lKeyIndex /* = -1 */) const
 {
 	if ( (key <= KEY_Unknown) || (key >= KEY_NumOfKeys) || (strValue.empty()) )
 		return;
 
-	os << m_vstrKeys.at(key).c_str();
-	if ( (key == KEY_Note) || (key == KEY_Keyboard) )
-		os << " " << lKeyIndex;
-	os << " = " << strx::GetAsString(strValue).c_str() << std::endl;
+	WriteKeyName(str, key, lKeyIndex);
+	strx::AppendAsString(str, strValue);
+	str += '\n';
 }
 
 
 
-void CSingleScale::WriteKey(std::ostream & os, eKey key,
+void CSingleScale::WriteKey(std::string & str, eKey key,
 							const double & dblValue, long lKeyIndex /* = -1 */) const
 {
 	if ( (key <= KEY_Unknown) || (key >= KEY_NumOfKeys) )
 		return;
 
-	os << m_vstrKeys.at(key).c_str();
-	if ( (key == KEY_Note) || (key == KEY_Keyboard) )
-		os << " " << lKeyIndex;
+	WriteKeyName(str, key, lKeyIndex);
+	// Written with full precision, so that reading the file back gives identical values
+	char	sz[strx::DoubleStrSize];
 	if ( fabs(dblValue) < 1e-8 ) // To avoid crude "near-zero" values due to numerical inaccuracies
-		os << " = " << (double)0 << std::endl;
+		str.append(sz, strx::dtostr(0, sz));
 	else
-		os << " = " << dblValue << std::endl;
+		str.append(sz, strx::dtostr(dblValue, sz));
+	str += '\n';
 }
 
 
 
-void CSingleScale::WriteKey(std::ostream & os, eKey key,
+void CSingleScale::WriteKey(std::string & str, eKey key,
 							const long & lValue, long lKeyIndex /* = -1 */) const
 {
 	if ( (key <= KEY_Unknown) || (key >= KEY_NumOfKeys) )
 		return;
 
-	os << m_vstrKeys.at(key).c_str();
-	if ( (key == KEY_Note) || (key == KEY_Keyboard) )
-		os << " " << lKeyIndex;
-	os << " = " << lValue << std::endl;
+	WriteKeyName(str, key, lKeyIndex);
+	str += strx::ltostr(lValue);
+	str += '\n';
 }
 
 
 
 long CSingleScale::Read(const char * szFilepath)
 {
-	// Open the file
+	// String which will receive the current line from the file
+	CStringParser	strparser;
+
+	// Map the file, if possible
+	CMappedFile		mf;
+	if ( mf.Open(szFilepath) )
+	{
+		strparser.InitMemoryReading(mf.GetData(), mf.GetSize());
+		return Read(strparser);
+	}
+
+	// Otherwise open the file as a stream
 	std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
 
 	if ( !ifstr )
 		return m_err.SetError("Error opening the file.");
 
-	// String which will receive the current line from the file
-	CStringParser	strparser;
-	strparser.InitStreamReading();
+	strparser.InitStreamReading(true);
 
 	// Read the file
 	long	lResult = Read(ifstr, strparser);
@@ -655,6 +1023,62 @@ long CSingleScale::Read(const char * szFilepath)
 
 
 long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
+{
+	strparser.AttachStream(istr);
+	return Read(strparser);
+}
+
+
+
+long CSingleScale::Read(CStringParser & strparser)
+{
+	// The MIDI note frequency table is updated once for the complete
+	// dataset (also in case of errors, as the scale might be changed)
+	// In deferred mode, the formulas read stay queued
+	long	lResult = ReadDataSet(strparser);
+	UpdateMIDINoteFreqTable();
+	return lResult;
+}
+
+
+
+long CSingleScale::ReadInfo(const char * szFilepath)
+{
+	CStringParser	strparser;
+
+	// Map the file, if possible
+	CMappedFile		mf;
+	if ( mf.Open(szFilepath) )
+	{
+		strparser.InitMemoryReading(mf.GetData(), mf.GetSize());
+		return ReadInfo(strparser);
+	}
+
+	// Otherwise open the file as a stream
+	std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
+
+	if ( !ifstr )
+	{
+		m_err.SetError("Error opening the file.");
+		return -1;
+	}
+
+	strparser.InitStreamReading(true);
+	strparser.AttachStream(ifstr);
+	return ReadInfo(strparser);
+}
+
+
+
+long CSingleScale::ReadInfo(CStringParser & strparser)
+{
+	// Reset() has already updated the MIDI note frequency table
+	return ReadDataSet(strparser, true);
+}
+
+
+
+long CSingleScale::ReadDataSet(CStringParser & strparser, bool bInfoOnly /* = false */)
 {
 	bool		bInScaleData = false; // Flag to determine whether we are within a scale dataset
 	eSection	secCurr = SEC_Unknown; // Current section
@@ -676,13 +1100,15 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 	long		lET_LastNoteFound = -1; // For auto completion
 	for ( int i = 0 ; i < MaxNumOfNotes ; ++i )
 		dblET_TunesCents[i] = lT_TunesCents[i] = 100 * i;
+	// Buffer for unescaped string values, reused for each line
+	std::string	strUnescaped;
 
 
 	// Read scale dataset from stream
 	while ( true )
 	{
 		// Get next line
-		if ( !strparser.GetLineAndTrim(istr, m_lReadLineCount) )
+		if ( !strparser.GetLineAndTrim(m_lReadLineCount) )
 		{
 			// No scale dataset found
 			if ( !bInScaleData )
@@ -700,14 +1126,21 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 			break;
 		}
 
+		// The line is evaluated without copying it
+		std::string_view	svLine = strparser.view();
+
 		// Skip empty lines and comments
-		if ( strparser.str().empty() || (strparser.str().at(0) == ';') )
+		if ( svLine.empty() || (svLine.front() == ';') )
+			continue;
+
+		// Fast skip of lines in sections not evaluated
+		if ( (secCurr == SEC_Unknown) && (svLine.front() != '[') )
 			continue;
 
 		// Check for new section
-		if ( strx::EvalSection(strparser.str()) )
+		if ( strx::EvalSection(svLine) )
 		{
-			secCurr = FindSection(strparser.str());
+			secCurr = FindSection(svLine);
 
 			if ( secCurr != SEC_ScaleBegin )
 			{
@@ -762,8 +1195,17 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 					// found ones -> remember it and process it
 					secPriorityTuning = secCurr;
 			}
+
+			// In info only mode, the scale is not evaluated
+			if ( bInfoOnly &&
+				 ((secCurr == SEC_Tuning) ||
+				  (secCurr == SEC_ExactTuning) ||
+				  (secCurr == SEC_FunctionalTuning) ||
+				  (secCurr == SEC_Mapping) ||
+				  (secCurr == SEC_EditorSpecifics)) )
+				secCurr = SEC_Unknown;
 			continue; // Process the next line
-		} // if ( strx::EvalSection(strparser.str()) )
+		} // if ( strx::EvalSection(svLine) )
 
 		// Skip lines not in a known section
 		if ( secCurr == SEC_Unknown )
@@ -774,8 +1216,8 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 			continue; // Currently just ignore editor specific data
 
 		// Split line into key and value
-		std::string	strKey, strValue;
-		if ( !strx::EvalKeyAndValue(strparser.str(), strKey, strValue) )
+		std::string_view	svKey, svValue;
+		if ( !strx::EvalKeyAndValue(svLine, svKey, svValue) )
 		{
 			m_err.SetError("Syntax error", m_lReadLineCount);
 			return -1;
@@ -783,7 +1225,7 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 
 		// Now process the key:
 		long	lKeyIndex;
-		eKey	key = FindKey(strKey, lKeyIndex);
+		eKey	key = FindKey(svKey, lKeyIndex);
 
 		switch ( secCurr )
 		{
@@ -791,7 +1233,7 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 			switch ( key )
 			{
 			case KEY_Format:
-				if ( !CheckType(strValue, m_strFormat) )
+				if ( !CheckType(svValue, m_strFormat) )
 					return -1;
 				if ( m_strFormat != Format() )
 				{
@@ -800,11 +1242,11 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 				}
 				break;
 			case KEY_FormatVersion:
-				if ( !CheckType(strValue, m_lFormatVersion) )
+				if ( !CheckType(svValue, m_lFormatVersion) )
 					return -1;
 				break;
 			case KEY_FormatSpecs:
-				if ( !CheckType(strValue, m_strFormatSpecs) )
+				if ( !CheckType(svValue, m_strFormatSpecs) )
 					return -1;
 				break;
 			}
@@ -814,31 +1256,31 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 			switch ( key )
 			{
 			case KEY_Name:
-				if ( !CheckType(strValue, m_strName) )
+				if ( !CheckType(svValue, m_strName) )
 					return -1;
 				break;
 			case KEY_ID:
-				if ( !CheckType(strValue, m_strID) )
+				if ( !CheckType(svValue, m_strID) )
 					return -1;
 				break;
 			case KEY_Filename:
-				if ( !CheckType(strValue, m_strFilename) )
+				if ( !CheckType(svValue, m_strFilename) )
 					return -1;
 				break;
 			case KEY_Author:
-				if ( !CheckType(strValue, m_strAuthor) )
+				if ( !CheckType(svValue, m_strAuthor) )
 					return -1;
 				break;
 			case KEY_Location:
-				if ( !CheckType(strValue, m_strLocation) )
+				if ( !CheckType(svValue, m_strLocation) )
 					return -1;
 				break;
 			case KEY_Contact:
-				if ( !CheckType(strValue, m_strContact) )
+				if ( !CheckType(svValue, m_strContact) )
 					return -1;
 				break;
 			case KEY_Date:
-				if ( !CheckType(strValue, m_strDate) )
+				if ( !CheckType(svValue, m_strDate) )
 					return -1;
 				if ( !IsDateFormatOK(m_strDate) )
 				{
@@ -847,42 +1289,42 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 				}
 				break;
 			case KEY_Editor:
-				if ( !CheckType(strValue, m_strEditor) )
+				if ( !CheckType(svValue, m_strEditor) )
 					return -1;
 				break;
 			case KEY_EditorSpecs:
-				if ( !CheckType(strValue, m_strEditorSpecs) )
+				if ( !CheckType(svValue, m_strEditorSpecs) )
 					return -1;
 				break;
 			case KEY_Description:
-				if ( !CheckType(strValue, m_strDescription) )
+				if ( !CheckType(svValue, m_strDescription) )
 					return -1;
 				break;
 			case KEY_Keyword:
 				{
 					std::string	strNewKeyword;
-					if ( !CheckType(strValue, strNewKeyword) )
+					if ( !CheckType(svValue, strNewKeyword) )
 						return -1;
 					if ( !strNewKeyword.empty() )
-						m_lstrKeywords.push_back(strNewKeyword);
+						m_lstrKeywords.push_back(std::move(strNewKeyword));
 				}
 				break;
 			case KEY_History:
-				if ( !CheckType(strValue, m_strHistory) )
+				if ( !CheckType(svValue, m_strHistory) )
 					return -1;
 				break;
 			case KEY_Geography:
-				if ( !CheckType(strValue, m_strGeography) )
+				if ( !CheckType(svValue, m_strGeography) )
 					return -1;
 				break;
 			case KEY_Instrument:
-				if ( !CheckType(strValue, m_strInstrument) )
+				if ( !CheckType(svValue, m_strInstrument) )
 					return -1;
 				break;
 			case KEY_Composition:
 				{
 					std::string	strNewComposition;
-					if ( !CheckType(strValue, strNewComposition) )
+					if ( !CheckType(svValue, strNewComposition) )
 						return -1;
 					if ( !strNewComposition.empty() )
 					{
@@ -897,12 +1339,12 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 							m_err.SetError("Composition format mismatch. \"Musician or Band|Album|Title|Year|Misc\" expected!", m_lReadLineCount);
 							return -1;
 						}
-						m_lstrCompositions.push_back(strNewComposition);
+						m_lstrCompositions.push_back(std::move(strNewComposition));
 					}
 				}
 				break;
 			case KEY_Comments:
-				if ( !CheckType(strValue, m_strComments) )
+				if ( !CheckType(svValue, m_strComments) )
 					return -1;
 				break;
 			}
@@ -910,7 +1352,7 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 
 		case SEC_Tuning:
 			if ( key == KEY_Note )
-				if ( !CheckType(strValue, lT_TunesCents[lKeyIndex]) )
+				if ( !CheckType(svValue, lT_TunesCents[lKeyIndex]) )
 					return -1;
 			break;
 
@@ -918,11 +1360,11 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 			switch ( key )
 			{
 			case KEY_BaseFreq:
-				if ( !CheckType(strValue, dblET_BaseFreqHz) )
+				if ( !CheckType(svValue, dblET_BaseFreqHz) )
 					return -1;
 				break;
 			case KEY_Note:
-				if ( !CheckType(strValue, dblET_TunesCents[lKeyIndex]) )
+				if ( !CheckType(svValue, dblET_TunesCents[lKeyIndex]) )
 					return -1;
 
 				// Originally used __max, a windows only function macro
@@ -937,28 +1379,30 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 			{
 			case KEY_InitEqual:
 				{
-					std::string	strParams = strValue;
-					if ( !strx::EvalFunctionParam(strParams) )
+					std::string_view	svParams = svValue;
+					if ( !strx::EvalFunctionParam(svParams) )
 					{
 						m_err.SetError("Value type mismatch. Function parameter block expected!", m_lReadLineCount);
 						return -1;
 					}
 
-					const char	* szBeginPtr = strParams.c_str();
-					const char	* szEndPtr;
-					m_lInitEqual_BaseNote = strtol(szBeginPtr, const_cast<char **>(&szEndPtr), 10);
-					while ( isspace(*szEndPtr) )
-						++szEndPtr;
-					if ( *szEndPtr != ',' )
+					// A missing number counts as 0, just like strtol/strtod do
+					std::string_view::size_type	pos = 0;
+					if ( !strx::Eval(svParams, pos, m_lInitEqual_BaseNote) )
+						m_lInitEqual_BaseNote = 0;
+					while ( (pos < svParams.size()) && isspace(static_cast<unsigned char>(svParams[pos])) )
+						++pos;
+					if ( (pos == svParams.size()) || (svParams[pos] != ',') )
 					{
 						m_err.SetError("Coma after parameter 1 missing!", m_lReadLineCount);
 						return -1;
 					}
-					szBeginPtr = szEndPtr +1;
-					m_dblInitEqual_BaseFreqHz = strtod(szBeginPtr, const_cast<char **>(&szEndPtr));
-					while ( isspace(*szEndPtr) )
-						++szEndPtr;
-					if ( *szEndPtr != '\0' )
+					++pos;
+					if ( !strx::Eval(svParams, pos, m_dblInitEqual_BaseFreqHz) )
+						m_dblInitEqual_BaseFreqHz = 0;
+					while ( (pos < svParams.size()) && isspace(static_cast<unsigned char>(svParams[pos])) )
+						++pos;
+					if ( pos != svParams.size() )
 					{
 						m_err.SetError("No more data expected after parameter 2!", m_lReadLineCount);
 						return -1;
@@ -968,16 +1412,21 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 				break;
 			case KEY_Note:
 				{
-					std::string	strFormula;
-					if ( !CheckType(strValue, strFormula) )
+					std::string_view	svFormula;
+					if ( !CheckType(svValue, svFormula, strUnescaped) )
 						return -1;
 					CFormula	formula(lKeyIndex);
-					if ( !formula.SetFromStr(strFormula) )
+					if ( !formula.SetFromStr(svFormula) || !formula.HasValidRefs() )
 					{
 						m_err.SetError("Formula syntax error or parameter refers to invalid note index!", m_lReadLineCount);
 						return -1;
 					}
-					AddFormula(formula);
+					// Like AddFormula(), but without updating the MIDI note frequency table
+					if ( m_bDeferredEvaluation )
+						++m_lNumOfPendingFormulas;
+					else
+						formula.Apply(m_vdblNoteFrequenciesHz);
+					m_lformulas.push_back(formula);
 				}
 				break;
 			}
@@ -985,21 +1434,21 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 
 		case SEC_Mapping:
 			if ( key == KEY_LoopSize )
-				if ( !CheckType(strValue, m_lMappingLoopSize) )
+				if ( !CheckType(svValue, m_lMappingLoopSize) )
 					return -1;
 			if ( key == KEY_Keyboard )
-				if ( !CheckType(strValue, m_vlMapping.at(lKeyIndex)) )
+				if ( !CheckType(svValue, m_vlMapping.at(lKeyIndex)) )
 					return -1;
 			break;
 
 		case SEC_Assignment:
 			if ( key == KEY_MIDIChannel )
 			{
-				std::string	strMIDIChannels;
-				if ( !CheckType(strValue, strMIDIChannels) )
+				std::string_view	svMIDIChannels;
+				if ( !CheckType(svValue, svMIDIChannels, strUnescaped) )
 					return -1;
 
-				if ( !SetMIDIChannelsAssignment(strMIDIChannels) )
+				if ( !SetMIDIChannelsAssignment(svMIDIChannels) )
 					return -1;
 			}
 			break;
@@ -1008,6 +1457,8 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 	} // while ( true )
 
 	// Apply tuning data of priority section found / check for existence of tuning data
+	if ( bInfoOnly && (secPriorityTuning != SEC_Unknown) )
+		return 1;
 	switch ( secPriorityTuning )
 	{
 	case SEC_Unknown:
@@ -1019,6 +1470,7 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 		ResetKeyboardMapping();
 		// Transfer Values from [Tuning] to m_vdblNoteFrequenciesHz
 		InitEqual(0, DefaultBaseFreqHz);
+		m_bEqualPending = false; // All notes are set here
 		for ( int i = 0 ; i < MaxNumOfNotes ; ++i )
 			m_vdblNoteFrequenciesHz.at(i) = Cents2Hz(lT_TunesCents[i], DefaultBaseFreqHz);
 		// Create formulas to represent values
@@ -1043,6 +1495,7 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 		}
 		// Transfer Values from [Exact Tuning] to m_vdblNoteFrequenciesHz
 		InitEqual(0, dblET_BaseFreqHz);
+		m_bEqualPending = false; // All notes are set here
 		for ( int i = 0 ; i < MaxNumOfNotes ; ++i )
 			m_vdblNoteFrequenciesHz.at(i) = Cents2Hz(dblET_TunesCents[i], dblET_BaseFreqHz);
 		// Create formulas to represent values
@@ -1069,10 +1522,22 @@ long CSingleScale::Read(std::istream & istr, CStringParser & strparser)
 
 
 
-bool CSingleScale::CheckType(const std::string & strValue, std::string & strResult)
+bool CSingleScale::CheckType(std::string_view svValue, std::string & strResult)
 {
-	strResult = strValue;
-	if ( !strx::EvalString(strResult) )
+	std::string_view	svResult;
+	if ( !strx::EvalString(svValue, svResult, strResult) )
+		return m_err.SetError("Value type mismatch. String expected!", m_lReadLineCount);
+	if ( svResult.data() != strResult.data() )
+		strResult.assign(svResult.data(), svResult.size());
+	return m_err.SetOK();
+}
+
+
+
+bool CSingleScale::CheckType(std::string_view svValue, std::string_view & svResult,
+							 std::string & strBuffer)
+{
+	if ( !strx::EvalString(svValue, svResult, strBuffer) )
 		return m_err.SetError("Value type mismatch. String expected!", m_lReadLineCount);
 	else
 		return m_err.SetOK();
@@ -1080,10 +1545,10 @@ bool CSingleScale::CheckType(const std::string & strValue, std::string & strResu
 
 
 
-bool CSingleScale::CheckType(const std::string & strValue, double & dblResult)
+bool CSingleScale::CheckType(std::string_view svValue, double & dblResult)
 {
-	std::string::size_type	pos = 0;
-	if ( strx::Eval(strValue, pos, dblResult) && (pos == strValue.size()) )
+	std::string_view::size_type	pos = 0;
+	if ( strx::Eval(svValue, pos, dblResult) && (pos == svValue.size()) )
 		return m_err.SetOK();
 	else
 		return m_err.SetError("Value type mismatch. Float expected!", m_lReadLineCount);
@@ -1091,10 +1556,10 @@ bool CSingleScale::CheckType(const std::string & strValue, double & dblResult)
 
 
 
-bool CSingleScale::CheckType(const std::string & strValue, long & lResult)
+bool CSingleScale::CheckType(std::string_view svValue, long & lResult)
 {
-	std::string::size_type	pos = 0;
-	if ( strx::Eval(strValue, pos, lResult) && (pos == strValue.size()) )
+	std::string_view::size_type	pos = 0;
+	if ( strx::Eval(svValue, pos, lResult) && (pos == svValue.size()) )
 		return m_err.SetOK();
 	else
 		return m_err.SetError("Value type mismatch. Integer expected!", m_lReadLineCount);
@@ -1184,17 +1649,16 @@ std::string CSingleScale::GetMIDIChannelsAssignment() const
 
 
 
-bool CSingleScale::SetMIDIChannelsAssignment(std::string strMIDIChannels)
+bool CSingleScale::SetMIDIChannelsAssignment(std::string_view svMIDIChannels)
 {
-	std::list<std::string>	lstrChannels;
-	strx::Split(strMIDIChannels, ',', lstrChannels, true, true);
+	std::vector<std::string_view>	vsvChannels;
+	strx::Split(svMIDIChannels, ',', vsvChannels, true, true);
 
-	std::list<std::string>::const_iterator	it;
 	m_lmcrChannels.clear();
-	for ( it = lstrChannels.begin() ; it != lstrChannels.end() ; ++it )
+	for ( std::string_view svChannels : vsvChannels )
 	{
 		CMIDIChannelRange	mcr;
-		if ( !mcr.SetFromStr(*it) )
+		if ( !mcr.SetFromStr(svChannels) )
 		{
 			m_err.SetError("Error in MIDI channel range: syntax error or values exceed the range 1-65535!", m_lReadLineCount);
 			return false;
@@ -1233,43 +1697,142 @@ bool CSingleScale::AppliesToChannel(long lMIDIChannel) const
 
 
 
-CSingleScale::eSection CSingleScale::FindSection(const std::string & strSection)
+// The known section and key names are found by a perfect hash table,
+// which is built at compile time. The hash function ignores the case,
+// so that names can be found without converting them to lower chars.
+
+
+
+// FNV-1a hash of the lower chars of a name
+static constexpr unsigned long NameHash(std::string_view svName, unsigned long ulSeed)
 {
-	if ( !strSection.empty() )
-		for ( long l = 0 ; l < m_vstrSections.size() ; ++l )
-			if ( strSection == strx::GetAsLower(m_vstrSections.at(l)) )
-				return static_cast<CSingleScale::eSection>(l);
-	return SEC_Unknown;
+	unsigned long	ulHash = 2166136261UL ^ ulSeed;
+	for ( std::string_view::size_type l = 0 ; l < svName.size() ; ++l )
+	{
+		char	ch = svName[l];
+		if ( (ch >= 'A') && (ch <= 'Z') )
+			ch = ch - 'A' + 'a';
+		ulHash = ((ulHash ^ static_cast<unsigned char>(ch)) * 16777619UL) & 0xffffffffUL;
+	}
+	return ulHash;
 }
 
 
 
-CSingleScale::eKey CSingleScale::FindKey(const std::string & strKey, long & lKeyIndex)
+// Size of the hash tables: 2^NameHashTableBits
+// The slot of a name is given by the upper bits of its 32 bit hash, as
+// those bits depend on all bits of the seed.
+const unsigned long	NameHashTableBits = 7;
+const unsigned long	NameHashTableSize = 1UL << NameHashTableBits;
+
+static constexpr unsigned long NameHashSlot(std::string_view svName, unsigned long ulSeed)
+{
+	return NameHash(svName, ulSeed) >> (32 - NameHashTableBits);
+}
+
+// Hash table: Maps the hash of a name to its index in the array of names
+// Index 0 (Unknown) marks an empty slot.
+struct SNameHashTable
 {
-	if ( !strKey.empty() )
+	unsigned long	ulSeed;
+	unsigned char	aucIndex[NameHashTableSize];
+};
+
+// Returns true, if no two names fall into the same slot
+template <std::size_t N>
+static constexpr bool IsNameHashPerfect(const std::string_view (& asvNames)[N], unsigned long ulSeed)
+{
+	bool	abUsed[NameHashTableSize] = {};
+	for ( std::size_t n = 1 ; n < N ; ++n )
 	{
-		for ( long l = 0 ; l < m_vstrKeys.size() ; ++l )
-		{
-			std::string	strCurr = strx::GetAsLower(m_vstrKeys.at(l));
-			if ( strKey == strCurr )
-			{
-				// Identity
-				if ( (l == KEY_Note) || (l == KEY_Keyboard) )
-					return KEY_Unknown; // Those keys need an index following
-				return static_cast<CSingleScale::eKey>(l);
-			}
+		unsigned long	ulSlot = NameHashSlot(asvNames[n], ulSeed);
+		if ( abUsed[ulSlot] )
+			return false;
+		abUsed[ulSlot] = true;
+	}
+	return true;
+}
 
-			if ( strKey.substr(0, strCurr.size()) == strCurr )
-			{
-				// Begin matches
-				if ( (l == KEY_Note) || (l == KEY_Keyboard) )
-				{
-					// Evaluate note index
-					lKeyIndex = atol(strKey.substr(strCurr.size()).c_str());
-					if ( IsNoteIndexOK(lKeyIndex) )
-						return static_cast<CSingleScale::eKey>(l);
-				}
-			}
+// Searches a seed, which leads to a perfect hash, and builds the table
+template <std::size_t N>
+static constexpr SNameHashTable BuildNameHashTable(const std::string_view (& asvNames)[N])
+{
+	SNameHashTable	ht = {};
+	while ( !IsNameHashPerfect(asvNames, ht.ulSeed) )
+		++ht.ulSeed;
+	for ( std::size_t n = 1 ; n < N ; ++n )
+		ht.aucIndex[NameHashSlot(asvNames[n], ht.ulSeed)] = static_cast<unsigned char>(n);
+	return ht;
+}
+
+static constexpr SNameHashTable	SectionHashTable = BuildNameHashTable(SectionNames);
+static constexpr SNameHashTable	KeyHashTable = BuildNameHashTable(KeyNames);
+
+
+
+// Looks up a name in a hash table and returns its index or 0 (Unknown)
+template <std::size_t N>
+static long FindName(const SNameHashTable & ht, const std::string_view (& asvNames)[N],
+					 std::string_view svName)
+{
+	if ( svName.empty() )
+		return 0;
+	long	lIndex = ht.aucIndex[NameHashSlot(svName, ht.ulSeed)];
+	return ( strx::EqualsNoCase(svName, asvNames[lIndex]) ? lIndex : 0 );
+}
+
+
+
+// Evaluates the index following a key name like atol() does,
+// but without the need of a null terminated string
+static long EvalKeyIndex(std::string_view svIndex)
+{
+	std::string_view::size_type	pos = 0;
+	while ( (pos < svIndex.size()) && isspace(static_cast<unsigned char>(svIndex[pos])) )
+		++pos;
+	bool	bNegative = false;
+	if ( (pos < svIndex.size()) && ((svIndex[pos] == '+') || (svIndex[pos] == '-')) )
+		bNegative = (svIndex[pos++] == '-');
+	long	lIndex = 0;
+	while ( (pos < svIndex.size()) && isdigit(static_cast<unsigned char>(svIndex[pos])) )
+	{
+		lIndex = lIndex * 10 + (svIndex[pos++] - '0');
+		if ( lIndex > MaxNumOfNotes )
+			lIndex = MaxNumOfNotes; // Invalid anyway, avoids overflow
+	}
+	return ( bNegative ? -lIndex : lIndex );
+}
+
+
+
+CSingleScale::eSection CSingleScale::FindSection(std::string_view svSection)
+{
+	return static_cast<CSingleScale::eSection>(FindName(SectionHashTable, SectionNames, svSection));
+}
+
+
+
+CSingleScale::eKey CSingleScale::FindKey(std::string_view svKey, long & lKeyIndex)
+{
+	// Identity
+	long	lKey = FindName(KeyHashTable, KeyNames, svKey);
+	if ( lKey != KEY_Unknown )
+	{
+		if ( (lKey == KEY_Note) || (lKey == KEY_Keyboard) )
+			return KEY_Unknown; // Those keys need an index following
+		return static_cast<CSingleScale::eKey>(lKey);
+	}
+
+	// Begin matches: Evaluate note index
+	const eKey	akeyIndexed[] = { KEY_Note, KEY_Keyboard };
+	for ( eKey key : akeyIndexed )
+	{
+		std::string_view	svName = KeyNames[key];
+		if ( strx::EqualsNoCase(svKey.substr(0, svName.size()), svName) )
+		{
+			lKeyIndex = EvalKeyIndex(svKey.substr(svName.size()));
+			if ( IsNoteIndexOK(lKeyIndex) )
+				return key;
 		}
 	}
 
@@ -57,6 +57,10 @@ double MIDINote_DefaultCents(int nMIDINote);
 
 
 
+class CFormulaEngine;
+
+
+
 class CSingleScale
 {
 	// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
@@ -125,8 +129,9 @@ public:
 
 	static const std::vector<std::string> &	GetSections() { return m_vstrSections; }
 	static const std::vector<std::string> &	GetKeys() { return m_vstrKeys; }
-	static eSection							FindSection(const std::string & strSection);
-	static eKey								FindKey(const std::string & strKey,
+	// Names are compared case insensitive
+	static eSection							FindSection(std::string_view svSection);
+	static eKey								FindKey(std::string_view svKey,
 													long & lKeyIndex);
 
 private:
@@ -137,7 +142,6 @@ private:
 	// Main stuff
 public:
 	CSingleScale();
-	virtual ~CSingleScale();
 
 
 
@@ -152,7 +156,7 @@ public:
 	// Initialize all keys (keyboard mapping) and scale to A=440Hz
 	void	Reset();
 private:
-	void	ResetKeyboardMapping();
+	void	ResetKeyboardMapping(); // Does not update the MIDI note frequency table
 public:
 	// Initialize scale (default values are A=440Hz)
 	void	InitEqual(long lBaseNote = 69, double dblBaseFreqHz = 440);
@@ -175,30 +179,136 @@ public:
 	 * (NOTE: Vector index is scale note number, NOT MIDI note number!)
 	 * @return Frequencies of scale notes.
 	 */
-	const std::vector<double> &	GetNoteFrequenciesHz() const { return m_vdblNoteFrequenciesHz; }
+	const std::vector<double> &	GetNoteFrequenciesHz() const
+	{
+		if ( IsEvaluationPending() )
+			EvaluateFormulas();
+		return m_vdblNoteFrequenciesHz;
+	}
 
 	/**
+	 * Real-time safe access of the MIDI note frequencies
+	 *
+	 * The following functions may be called from an audio callback:
+	 * They never allocate memory, never lock and never throw. MIDI note
+	 * numbers outside 0 to 127 are clamped to this range. The values are
+	 * read from a precomputed table (see GetMIDINoteFreqTable()).
+	 * ATTENTION: The scale must not be modified by another thread at the
+	 * same time. Modifications may allocate and are not real-time safe.
+	 * While formulas are pending in deferred mode, all notes are reported
+	 * as muted (0 Hz), see SetDeferredEvaluation().
+	 *
 	 * Be aware that frequencies <= 0 Hz could be returned, especially
  	 * when the .tun file loaded makes use of the [Functional Tuning] section.
  	 * It is strongly suggest to handle notes of such frequencies as "muted" notes.
  	 * (i.e. do not output any sound on these notes.)
+	 * IsMIDINoteMuted() tells whether this applies (also to NaN).
 	 * @param  lMIDINoteNumber MIDI note number (0 to 127)
 	 * @return                 Frequency of that note in scale
 	 */
-	double						GetMIDINoteFreqHz(long lMIDINoteNumber) const { return m_vdblNoteFrequenciesHz.at(MapMIDI2Scale(lMIDINoteNumber)); }
+	double						GetMIDINoteFreqHz(long lMIDINoteNumber) const noexcept
+	{
+		if ( IsEvaluationPending() )
+			return 0;
+		return m_adblMIDINoteFreqHz[ClampMIDINote(lMIDINoteNumber)];
+	}
+	bool						IsMIDINoteMuted(long lMIDINoteNumber) const noexcept
+	{
+		if ( IsEvaluationPending() )
+			return true;
+		return !(m_adblMIDINoteFreqHz[ClampMIDINote(lMIDINoteNumber)] > 0);
+	}
+	// Returns false for muted notes, dblFreqHz is set in any case
+	bool						GetMIDINoteFreqHz(long lMIDINoteNumber, double & dblFreqHz) const noexcept
+	{
+		dblFreqHz = ( IsEvaluationPending() ? 0 : m_adblMIDINoteFreqHz[ClampMIDINote(lMIDINoteNumber)] );
+		return (dblFreqHz > 0);
+	}
+	/**
+	 * Table of the frequencies of all MIDI notes (mapping applied)
+	 *
+	 * The table has NumOfMIDINotes entries and is aligned to a cache line.
+	 * It is updated whenever formulas, mapping or loop size are changed
+	 * by the member functions of this class. MIDI notes which are mapped
+	 * to no scale note (e.g. -1) get 0 Hz. While formulas are pending
+	 * in deferred mode, a table of muted notes is returned.
+	 * @return Frequencies, index = MIDI note number
+	 */
+	const double *				GetMIDINoteFreqTable() const noexcept
+	{
+		if ( IsEvaluationPending() )
+			return m_adblMutedMIDINotesHz;
+		return m_adblMIDINoteFreqHz;
+	}
+	static constexpr long		NumOfMIDINotes = 128;
+	static long					ClampMIDINote(long lMIDINoteNumber) noexcept
+	{
+		return ( lMIDINoteNumber < 0 ? 0 : (lMIDINoteNumber >= NumOfMIDINotes ? NumOfMIDINotes-1 : lMIDINoteNumber) );
+	}
+	// Rebuilds the MIDI note frequency table. Must be called after
+	// changing the mapping via the reference returned by GetMapping().
+	void						UpdateMIDINoteFreqTable();
+	/**
+	 * Deferred evaluation of the formulas
+	 *
+	 * In deferred mode, InitEqual(), AddFormula() and SetFormulas(list)
+	 * only queue the formulas, so that a series of changes evaluates the
+	 * formulas once. Read() and ReadInfo() queue the formulas read as
+	 * well, so reading only the names or the formulas costs no evaluation.
+	 * They are evaluated by EvaluateFormulas(), by GetNoteFrequenciesHz(),
+	 * when writing the note frequencies and when the deferred mode is
+	 * switched off. The results are the same as without deferred mode.
+	 * ATTENTION: The MIDI note accessors (GetMIDINoteFreqHz(), ...) do not
+	 * evaluate, as they are real-time safe. While formulas are pending,
+	 * they report all notes as muted. Call EvaluateFormulas() after the
+	 * changes and before passing the scale to an audio callback or to
+	 * other threads. GetNoteFrequenciesHz() on a const scale with pending
+	 * formulas changes the scale, i.e. it must not run in several threads
+	 * at the same time.
+	 */
+	void	SetDeferredEvaluation(bool bDeferred);
+	bool	IsDeferredEvaluation() const { return m_bDeferredEvaluation; }
+	bool	IsEvaluationPending() const noexcept { return m_bEqualPending || (m_lNumOfPendingFormulas > 0); }
+	void	EvaluateFormulas() const;
 	// Write-access of the note frequencies
 	// When changing values you must make use of the CFormula class
 	// The object stores *all* applied formulas in a list so that
 	// it contains the complete history of changes, which is also
 	// written to the file.
 	void	AddFormula(CFormula formula);
+	// Read-access of the formulas applied (in list order)
+	const std::list<CFormula> &	GetFormulas() const { return m_lformulas; }
+	// Takes the formulas and note frequencies of a formula engine, which
+	// evaluates changes of single formulas incrementally (see
+	// TUN_FormulaEngine.h)
+	void	SetFormulas(const CFormulaEngine & engine);
+	// Replaces the formulas and derives the note frequencies from the
+	// equal tuning with a compiled program (see TUN_FormulaProgram.h).
+	// Returns false and changes nothing, if a formula refers to an
+	// invalid note index.
+	bool	SetFormulas(const std::list<CFormula> & lformulas);
+	// Removes the formulas without effect on the note frequencies:
+	// Formulas which do not change any value and formulas whose values
+	// are overwritten before they are read. The remaining formulas (and
+	// their references) are kept as they are, the note frequencies are
+	// not changed. The result is not minimal: Formulas are only removed
+	// as a whole and never merged, so a loop which is partly overwritten
+	// and constant values of a note which are read in between are kept.
+	// Returns false and changes nothing, if a formula refers to an
+	// invalid note index.
+	bool	CompactFormulas();
 	// Read/write-access of the mapping
+	// (See UpdateMIDINoteFreqTable() when writing via GetMapping())
 	std::vector<long> &			GetMapping() { return m_vlMapping; }
 	const std::vector<long> &	GetMapping() const { return m_vlMapping; }
+	void						SetMapping(const std::vector<long> & vlMapping);
 	long						GetMappingLoopSize() const { return m_lMappingLoopSize; }
 	void						SetMappingLoopSize(long lMappingLoopSize);
-	long						MapMIDI2Scale(long lMIDINoteNumber) const; // Returns scale note number
+	// Returns scale note number (or the mapping value, if it is < 0)
+	// The MIDI note number is clamped to 0 to 127. Does not throw.
+	long						MapMIDI2Scale(long lMIDINoteNumber) const noexcept;
 	// Read/write-access of Assigment data for Multi Scale Files
+	// (For scales of a CMultiScaleFile see CMultiScaleFile::ModifyScale())
 	std::list<CMIDIChannelRange> &			GetChannels() { return m_lmcrChannels; }
 	const std::list<CMIDIChannelRange> &	GetChannels() const { return m_lmcrChannels; }
 
@@ -209,29 +319,57 @@ public:
 	//
 	// lVersionFrom and lVersionTo define which sections to write.
 	// Valid version values for From and To are 0, 100, 200
+	//
+	// The file is formatted in memory and written to the stream at once.
+	// WriteToString() and WriteToBuffer() append the file data to str or
+	// vchBuffer, respectively, without using a stream.
 	bool	Write(const char * szFilepath,
 				  long lVersionFrom = 0, long lVersionTo = 200, bool bWriteHeaderComment = true);
 	bool	Write(std::ostream & os,
 				  long lVersionFrom = 0, long lVersionTo = 200, bool bWriteHeaderComment = true);
+	bool	WriteToString(std::string & str,
+						  long lVersionFrom = 0, long lVersionTo = 200, bool bWriteHeaderComment = true);
+	bool	WriteToBuffer(std::vector<char> & vchBuffer,
+						  long lVersionFrom = 0, long lVersionTo = 200, bool bWriteHeaderComment = true);
+	// Estimated number of bytes written (usually a bit too large)
+	std::size_t	GetWriteSizeEstimate(long lVersionFrom = 0, long lVersionTo = 200) const;
 private:
-	void	WriteSection(std::ostream & os, eSection section) const;
-	void	WriteKey(std::ostream & os, eKey key, const std::list<std::string> & lstrValues) const;
-	void	WriteKey(std::ostream & os, eKey key, const std::string & strValue, long lKeyIndex = -1) const;
-	void	WriteKey(std::ostream & os, eKey key, const double & dblValue, long lKeyIndex = -1) const;
-	void	WriteKey(std::ostream & os, eKey key, const long & lValue, long lKeyIndex = -1) const;
+	void	WriteSection(std::string & str, eSection section) const;
+	void	WriteKeyName(std::string & str, eKey key, long lKeyIndex) const;
+	void	WriteKey(std::string & str, eKey key, const std::list<std::string> & lstrValues) const;
+	void	WriteKey(std::string & str, eKey key, const std::string & strValue, long lKeyIndex = -1) const;
+	void	WriteKey(std::string & str, eKey key, const double & dblValue, long lKeyIndex = -1) const;
+	void	WriteKey(std::string & str, eKey key, const long & lValue, long lKeyIndex = -1) const;
 public:
 
 	// Read-functions return:
 	// -1 = an error occurred
 	// 0 = No scale dataset found
 	// 1 = everything O.K.
+	//
+	// Regular files are memory mapped and parsed in place. Other files
+	// (e.g. pipes) are read as a stream.
+	// Read(strparser) reads from the stream or memory block the parser
+	// was initialized with.
 	long	Read(const char * szFilepath);
 	long	Read(std::istream & istr, CStringParser & strparser);
+	long	Read(CStringParser & strparser);
+	// Reads only the keys of the sections [Scale Begin], [Info] and
+	// [Assignment] (e.g. for building catalogs, see CScaleCatalog).
+	// Tuning and mapping sections are skipped without evaluating them,
+	// so the scale stays equal tempered (see Reset()). The return values
+	// are the same as of Read(); the dataset is checked for errors only
+	// as far as it is evaluated.
+	long	ReadInfo(const char * szFilepath);
+	long	ReadInfo(CStringParser & strparser);
 private:
+	long	ReadDataSet(CStringParser & strparser, bool bInfoOnly = false);
 	long	m_lReadLineCount;
-	bool	CheckType(const std::string & strValue, std::string & strResult);
-	bool	CheckType(const std::string & strValue, double & dblResult);
-	bool	CheckType(const std::string & strValue, long & lResult);
+	bool	CheckType(std::string_view svValue, std::string & strResult);
+	bool	CheckType(std::string_view svValue, std::string_view & svResult,
+					  std::string & strBuffer);
+	bool	CheckType(std::string_view svValue, double & dblResult);
+	bool	CheckType(std::string_view svValue, long & lResult);
 public:
 
 
@@ -279,7 +417,7 @@ public:
 	// Keys of section [Assignment]
 	// Returns true, if scale applies to MIDI Channel given
 	std::string				GetMIDIChannelsAssignment() const;
-	bool					SetMIDIChannelsAssignment(std::string strMIDIChannels);
+	bool					SetMIDIChannelsAssignment(std::string_view svMIDIChannels);
 	bool					AppliesToChannel(long lMIDIChannel) const;
 
 
@@ -306,6 +444,8 @@ private:
 	// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
 	// Misc functions
 	static bool		IsNoteIndexOK(int nIndex);
+	void			SetEqualFrequencies() const; // See InitEqual()
+	void			BuildMIDINoteFreqTable() const;
 
 
 
@@ -313,11 +453,22 @@ private:
 	// Last but not least: the scale and its definitions
 	long				m_lInitEqual_BaseNote;
 	double				m_dblInitEqual_BaseFreqHz;
-	std::vector<double>	m_vdblNoteFrequenciesHz; // index = Scale note number, see m_vlMapping
+	mutable std::vector<double>	m_vdblNoteFrequenciesHz; // index = Scale note number, see m_vlMapping
 	std::list<CFormula>	m_lformulas;
+	// Deferred evaluation, see SetDeferredEvaluation()
+	bool				m_bDeferredEvaluation;
+	mutable bool		m_bEqualPending; // Equal tuning not yet set
+	mutable long		m_lNumOfPendingFormulas; // Last formulas of m_lformulas not yet applied
 	// Keyboard mapping:
 	std::vector<long>	m_vlMapping; // index = MIDI note number, value = Scale note number
 	long				m_lMappingLoopSize;
+	// Resulting frequencies of the MIDI notes, see UpdateMIDINoteFreqTable()
+	alignas(64) mutable double	m_adblMIDINoteFreqHz[NumOfMIDINotes];
+	// Returned by GetMIDINoteFreqTable() while formulas are pending
+	alignas(64) static const double	m_adblMutedMIDINotesHz[NumOfMIDINotes];
+
+	// Restores the scale from a binary file without evaluating formulas
+	friend class CBinaryScale;
 }; // class CSingleScale
 
 
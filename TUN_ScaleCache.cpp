@@ -0,0 +1,360 @@
+// TUN_ScaleCache.cpp: Implementation of the class CScaleCache.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#include "TUN_ScaleCache.h"
+#include "TUN_BinaryScale.h"
+#include "TUN_MappedFile.h"
+#include "SCL_Import.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+// Extension of cache entries
+static const char	CacheEntryExt[] = ".tunb";
+
+
+
+// FNV-1a, 64 bit (see TUN_MappedFile.h)
+static void HashAdd(std::uint64_t & ullHash, const void * pData, std::size_t sizeData)
+{
+	ullHash = HashFNV1a(pData, sizeData, ullHash);
+}
+
+static void HashAdd(std::uint64_t & ullHash, std::uint64_t ullValue)
+{
+	HashAdd(ullHash, &ullValue, sizeof(ullValue));
+}
+
+// Hash of the content type and the library version
+static std::uint64_t HashBegin(const char * szContentType)
+{
+	std::uint64_t	ullHash = FNV1aInit;
+	HashAdd(ullHash, szContentType, std::char_traits<char>::length(szContentType));
+	HashAdd(ullHash, CScaleCache::LibraryVersion);
+	HashAdd(ullHash, CBinaryScale::FormatVersion);
+	return ullHash;
+}
+
+
+
+// Makes the content of a file available: Regular files are memory
+// mapped, other files are read into strBuffer.
+static bool GetFileContent(const char * szFilepath, CMappedFile & mf,
+						   std::string & strBuffer, std::string_view & svContent)
+{
+	if ( mf.Open(szFilepath) )
+	{
+		svContent = std::string_view(mf.GetData(), mf.GetSize());
+		return true;
+	}
+
+	std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
+	if ( !ifstr )
+		return false;
+	strBuffer.assign(std::istreambuf_iterator<char>(ifstr), std::istreambuf_iterator<char>());
+	svContent = strBuffer;
+	return !ifstr.bad();
+}
+
+
+
+static bool IsCacheEntry(const std::filesystem::directory_entry & entry)
+{
+	std::error_code	ec;
+	return entry.is_regular_file(ec) && (entry.path().extension() == CacheEntryExt);
+}
+
+
+
+// Reads Scala files without cache
+static bool ReadSCLFiles(CSingleScale & SS, CErr & err,
+						 const char * szSCLFilepath, const char * szKBMFilepath)
+{
+	CSCL_Import	imp;
+	if ( (szKBMFilepath != NULL) && !imp.ReadKBM(szKBMFilepath) )
+		return err.SetError(imp.Err());
+	if ( !imp.ReadSCL(szSCLFilepath) )
+		return err.SetError(imp.Err());
+	imp.SetSingleScale(SS);
+	return err.SetOK();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Construction/Destruction
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CScaleCache::CScaleCache(const std::string & strDirectory, std::uintmax_t sizeMax /* = 0 */)
+	: m_strDirectory(strDirectory), m_sizeMax(sizeMax), m_bEnabled(false), m_sizeCurrent(0),
+	  m_nHits(0), m_nMisses(0), m_nEvictions(0)
+{
+	std::error_code	ec;
+	std::filesystem::create_directories(m_strDirectory, ec);
+	if ( ec || !std::filesystem::is_directory(m_strDirectory, ec) )
+	{
+		m_err.SetError(("Error creating the cache directory: " + ec.message()).c_str());
+		return;
+	}
+	m_bEnabled = true;
+
+	// Get the current size and limit it
+	if ( m_sizeMax > 0 )
+	{
+		std::lock_guard<std::mutex>	lock(m_mtxSize);
+		Evict();
+	}
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Reading files
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CScaleCache::Read(CSingleScale & SS, const char * szFilepath)
+{
+	CMappedFile			mf;
+	std::string			strBuffer;
+	std::string_view	svContent;
+	if ( !m_bEnabled || !GetFileContent(szFilepath, mf, strBuffer, svContent) )
+		return SS.Read(szFilepath); // Also reports the error
+
+	std::uint64_t	ullHash = HashBegin("TUN");
+	HashAdd(ullHash, svContent.data(), svContent.size());
+	std::string		strEntryPath = GetEntryPath(ullHash, svContent.size());
+	if ( ReadEntry(SS, strEntryPath) )
+		return 1;
+
+	// Parse the content already in memory
+	++m_nMisses;
+	CStringParser	strparser;
+	strparser.InitMemoryReading(svContent.data(), svContent.size());
+	long	lResult = SS.Read(strparser);
+	if ( lResult == 1 )
+		WriteEntry(SS, strEntryPath);
+	return lResult;
+}
+
+
+
+bool CScaleCache::ReadSCL(CSingleScale & SS, CErr & err,
+						  const char * szSCLFilepath, const char * szKBMFilepath /* = NULL */)
+{
+	if ( m_bEnabled )
+	{
+		CMappedFile			mfSCL, mfKBM;
+		std::string			strBufferSCL, strBufferKBM;
+		std::string_view	svSCL, svKBM;
+		if ( GetFileContent(szSCLFilepath, mfSCL, strBufferSCL, svSCL) &&
+			 ((szKBMFilepath == NULL) || GetFileContent(szKBMFilepath, mfKBM, strBufferKBM, svKBM)) )
+		{
+			// The sizes separate the contents of both files
+			std::uint64_t	ullHash = HashBegin(szKBMFilepath == NULL ? "SCL" : "SCL+KBM");
+			HashAdd(ullHash, svSCL.size());
+			HashAdd(ullHash, svSCL.data(), svSCL.size());
+			HashAdd(ullHash, svKBM.size());
+			HashAdd(ullHash, svKBM.data(), svKBM.size());
+			std::string		strEntryPath = GetEntryPath(ullHash, svSCL.size() + svKBM.size());
+			if ( ReadEntry(SS, strEntryPath) )
+				return err.SetOK();
+
+			++m_nMisses;
+			if ( !ReadSCLFiles(SS, err, szSCLFilepath, szKBMFilepath) )
+				return false;
+			WriteEntry(SS, strEntryPath);
+			return true;
+		}
+	}
+
+	// Cache not usable, read the files directly (also reports the errors)
+	return ReadSCLFiles(SS, err, szSCLFilepath, szKBMFilepath);
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Statistics
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CScaleCache::SStatistics CScaleCache::GetStatistics() const
+{
+	SStatistics	stat;
+	stat.ullHits = m_nHits.load();
+	stat.ullMisses = m_nMisses.load();
+	stat.ullEvictions = m_nEvictions.load();
+	return stat;
+}
+
+
+
+void CScaleCache::ResetStatistics()
+{
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_nEvictions = 0;
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Cache entries
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+std::string CScaleCache::GetEntryPath(std::uint64_t ullHash, std::uint64_t ullSize) const
+{
+	// Name: <hash>-<content size>.tunb
+	char	szName[64];
+	snprintf(szName, sizeof(szName), "%016llx-%llx%s",
+			 static_cast<unsigned long long>(ullHash), static_cast<unsigned long long>(ullSize), CacheEntryExt);
+	return (std::filesystem::path(m_strDirectory) / szName).string();
+}
+
+
+
+bool CScaleCache::ReadEntry(CSingleScale & SS, const std::string & strEntryPath)
+{
+	// Missing or damaged entries and entries of other versions are misses
+	CBinaryScale	bs;
+	if ( !bs.Open(strEntryPath.c_str()) || !bs.GetSingleScale(SS) )
+		return false;
+	++m_nHits;
+
+	// The modification time is used to find the least recently used entries
+	std::error_code	ec;
+	std::filesystem::last_write_time(strEntryPath, std::filesystem::file_time_type::clock::now(), ec);
+	return true;
+}
+
+
+
+void CScaleCache::WriteEntry(const CSingleScale & SS, const std::string & strEntryPath)
+{
+	std::vector<char>	vchBuffer;
+	CBinaryScale::Write(SS, vchBuffer);
+
+	// Other threads or processes never see incomplete entries
+	if ( !WriteFileAtomically(strEntryPath, vchBuffer.data(), vchBuffer.size()) )
+		return; // The cache is optional, errors are ignored
+
+	if ( m_sizeMax > 0 )
+	{
+		std::lock_guard<std::mutex>	lock(m_mtxSize);
+		m_sizeCurrent += vchBuffer.size();
+		if ( m_sizeCurrent > m_sizeMax )
+			Evict();
+	}
+}
+
+
+
+void CScaleCache::Evict()
+{
+	// IMPORTANT: m_mtxSize is expected to be locked!
+
+	// Other processes may share the directory, so the real size is used
+	struct SEntry
+	{
+		std::filesystem::file_time_type	timeUsed;
+		std::uintmax_t					size;
+		std::filesystem::path			path;
+	};
+	std::vector<SEntry>	vEntries;
+	std::error_code		ec;
+	m_sizeCurrent = 0;
+	std::filesystem::directory_iterator	it(m_strDirectory, ec), itEnd;
+	for ( ; !ec && (it != itEnd) ; it.increment(ec) )
+	{
+		if ( !IsCacheEntry(*it) )
+			continue;
+		std::error_code	ecEntry;
+		SEntry	entry = { it->last_write_time(ecEntry), it->file_size(ecEntry), it->path() };
+		if ( ecEntry )
+			continue; // Deleted meanwhile
+		m_sizeCurrent += entry.size;
+		vEntries.push_back(entry);
+	}
+	if ( m_sizeCurrent <= m_sizeMax )
+		return;
+
+	// Delete the least recently used entries. Some space is freed in
+	// advance, so that not each following write has to evict.
+	std::uintmax_t	sizeTarget = m_sizeMax - m_sizeMax / 8;
+	std::sort(vEntries.begin(), vEntries.end(),
+			  [](const SEntry & a, const SEntry & b) { return a.timeUsed < b.timeUsed; });
+	for ( std::size_t i = 0 ; (i < vEntries.size()) && (m_sizeCurrent > sizeTarget) ; ++i )
+	{
+		if ( std::filesystem::remove(vEntries[i].path, ec) )
+			++m_nEvictions;
+		m_sizeCurrent -= vEntries[i].size;
+	}
+}
+
+
+
+void CScaleCache::Clear()
+{
+	if ( !m_bEnabled )
+		return;
+
+	std::lock_guard<std::mutex>	lock(m_mtxSize);
+	std::error_code	ec;
+	std::filesystem::directory_iterator	it(m_strDirectory, ec), itEnd;
+	std::vector<std::filesystem::path>	vpathEntries;
+	for ( ; !ec && (it != itEnd) ; it.increment(ec) )
+		if ( IsCacheEntry(*it) )
+			vpathEntries.push_back(it->path());
+	for ( std::size_t i = 0 ; i < vpathEntries.size() ; ++i )
+		std::filesystem::remove(vpathEntries[i], ec);
+	m_sizeCurrent = 0;
+}
+
+
+
+
+
+} // namespace TUN
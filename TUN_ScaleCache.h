@@ -0,0 +1,134 @@
+// TUN_ScaleCache.h: Interface of the class CScaleCache.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class implements an on-disk cache of parsed tuning files.
+// The resolved scale of each file is stored as binary tuning file
+// (see CBinaryScale) in a cache directory. The name of a cache entry is
+// derived from a hash of the file content and the library version, so
+// that changed files and library updates never return stale scales.
+// If a file was read before, loading it skips tokenizing, formula
+// parsing and evaluation.
+//
+// The cache directory may be shared by several threads and processes.
+// Entries are written to a temporary file and renamed. If the cache
+// becomes larger than the size given, the least recently used entries
+// are deleted.
+//
+// Usage:
+//
+//		CScaleCache		cache("/var/cache/tunings", 64 << 20);
+//		CSingleScale	SS;
+//		long			lResult = cache.Read(SS, "scale.tun");
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_SCALECACHE_H__5A790E7D_D053_4A7E_A89A_77CC95538DA7__INCLUDED_)
+#define AFX_TUN_SCALECACHE_H__5A790E7D_D053_4A7E_A89A_77CC95538DA7__INCLUDED_
+
+
+
+
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+#include "TUN_Error.h"
+#include "TUN_Scale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CScaleCache
+{
+public:
+	// Increase, if reading or evaluating scales changes its results!
+	static constexpr std::uint32_t	LibraryVersion = 2;
+
+	// sizeMax = 0: The size of the cache is not limited
+	explicit CScaleCache(const std::string & strDirectory, std::uintmax_t sizeMax = 0);
+
+	// Caches are not copyable
+	CScaleCache(const CScaleCache &) = delete;
+	CScaleCache & operator=(const CScaleCache &) = delete;
+
+
+
+	// Error handling (errors of the cache directory, errors of the files
+	// read are returned by the read functions)
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+	// false, if the cache directory can not be created. The read functions
+	// read the files directly in this case.
+	bool	IsEnabled() const { return m_bEnabled; }
+
+
+
+	// Reads an AnaMark tuning file (*.TUN) like CSingleScale::Read()
+	long	Read(CSingleScale & SS, const char * szFilepath);
+	// Reads a Scala file and optionally a keyboard mapping file like
+	// CSCL_Import does. Errors are returned in err.
+	bool	ReadSCL(CSingleScale & SS, CErr & err,
+					const char * szSCLFilepath, const char * szKBMFilepath = NULL);
+
+
+
+	// Statistics for monitoring. All functions are thread safe.
+	struct SStatistics
+	{
+		unsigned long long	ullHits;		// Scale read from the cache
+		unsigned long long	ullMisses;		// File parsed (and added to the cache)
+		unsigned long long	ullEvictions;	// Entries deleted to limit the size
+	};
+	SStatistics		GetStatistics() const;
+	void			ResetStatistics();
+
+	// Deletes all entries
+	void			Clear();
+
+
+
+private:
+	std::string	GetEntryPath(std::uint64_t ullHash, std::uint64_t ullSize) const;
+	bool		ReadEntry(CSingleScale & SS, const std::string & strEntryPath);
+	void		WriteEntry(const CSingleScale & SS, const std::string & strEntryPath);
+	void		Evict();
+
+	std::string						m_strDirectory;
+	std::uintmax_t					m_sizeMax;
+	bool							m_bEnabled;
+
+	std::mutex						m_mtxSize; // Guards m_sizeCurrent and the eviction
+	std::uintmax_t					m_sizeCurrent; // Estimated, updated by Evict()
+
+	std::atomic<unsigned long long>	m_nHits;
+	std::atomic<unsigned long long>	m_nMisses;
+	std::atomic<unsigned long long>	m_nEvictions;
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_SCALECACHE_H__5A790E7D_D053_4A7E_A89A_77CC95538DA7__INCLUDED_)
@@ -0,0 +1,162 @@
+// TUN_ScaleCatalog.cpp: Implementation of the class CScaleCatalog.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <algorithm>
+#include <fstream>
+#include <iterator>
+
+#include "TUN_ScaleCatalog.h"
+#include "TUN_MappedFile.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+// Copies the keys read by CSingleScale::ReadInfo()
+static void SetInfo(CScaleCatalog::SEntry & entry, const CSingleScale & SS)
+{
+	entry.strName = SS.m_strName;
+	entry.strID = SS.m_strID;
+	entry.strFilename = SS.m_strFilename;
+	entry.strAuthor = SS.m_strAuthor;
+	entry.strLocation = SS.m_strLocation;
+	entry.strContact = SS.m_strContact;
+	entry.strDate = SS.GetDate();
+	entry.strEditor = SS.m_strEditor;
+	entry.strEditorSpecs = SS.m_strEditorSpecs;
+	entry.strDescription = SS.m_strDescription;
+	entry.lstrKeywords = SS.m_lstrKeywords;
+	entry.strHistory = SS.m_strHistory;
+	entry.strGeography = SS.m_strGeography;
+	entry.strInstrument = SS.m_strInstrument;
+	entry.lstrCompositions = SS.m_lstrCompositions;
+	entry.strComments = SS.m_strComments;
+	entry.strMIDIChannels = SS.GetMIDIChannelsAssignment();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Building the catalog
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CScaleCatalog::AddFile(const char * szFilepath)
+{
+	// Map the file, if possible. Otherwise read it into memory, as the
+	// byte offsets are taken from the memory reading mode.
+	CMappedFile		mf;
+	if ( mf.Open(szFilepath) )
+		return AddFromMemory(mf.GetData(), mf.GetSize(), szFilepath);
+
+	std::ifstream	ifstr(szFilepath, std::ios_base::in | std::ios_base::binary);
+	if ( !ifstr )
+	{
+		m_err.SetError("Error opening the file.");
+		return -1;
+	}
+	std::string	strData((std::istreambuf_iterator<char>(ifstr)), std::istreambuf_iterator<char>());
+	return AddFromMemory(strData.data(), strData.size(), szFilepath);
+}
+
+
+
+long CScaleCatalog::AddFromMemory(const char * pData, std::size_t sizeData,
+								  const std::string & strFilepath)
+{
+	m_err.SetOK();
+
+	CStringParser	strparser;
+	strparser.InitMemoryReading(pData, sizeData);
+
+	// One scale object is reused for all datasets
+	CSingleScale	SS;
+	long			lDataSets = 0;
+	while ( true )
+	{
+		SEntry	entry;
+		entry.strFilepath = strFilepath;
+		entry.lDataSetIndex = lDataSets;
+		entry.ullBegin = strparser.GetMemoryOffset();
+		entry.lLineCount = strparser.GetLineCount();
+		entry.chEOL = strparser.GetEOLChar();
+
+		switch ( SS.ReadInfo(strparser) )
+		{
+		case 0: // No more datasets
+			return lDataSets;
+		case 1:
+			entry.ullEnd = strparser.GetMemoryOffset();
+			SetInfo(entry, SS);
+			m_vEntries.push_back(entry);
+			++lDataSets;
+			break;
+		default:
+			m_err.SetError(SS.Err());
+			return -1;
+		}
+	}
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// Reading scales
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+long CScaleCatalog::LoadScale(const SEntry & entry, CSingleScale & SS)
+{
+	CMappedFile		mf;
+	if ( mf.Open(entry.strFilepath.c_str()) )
+		return LoadScale(entry, SS, mf.GetData(), mf.GetSize());
+
+	std::ifstream	ifstr(entry.strFilepath.c_str(), std::ios_base::in | std::ios_base::binary);
+	if ( !ifstr )
+		return SS.Read(entry.strFilepath.c_str()); // Reports the error
+	std::string	strData((std::istreambuf_iterator<char>(ifstr)), std::istreambuf_iterator<char>());
+	return LoadScale(entry, SS, strData.data(), strData.size());
+}
+
+
+
+long CScaleCatalog::LoadScale(const SEntry & entry, CSingleScale & SS,
+							  const char * pData, std::size_t sizeData)
+{
+	// A file changed since building the catalog might be shorter
+	std::uint64_t	ullEnd = std::min<std::uint64_t>(entry.ullEnd, sizeData);
+	std::uint64_t	ullBegin = std::min(entry.ullBegin, ullEnd);
+
+	CStringParser	strparser;
+	strparser.InitMemoryReading(pData + ullBegin, static_cast<std::size_t>(ullEnd - ullBegin),
+								entry.lLineCount, entry.chEOL);
+	return SS.Read(strparser);
+}
+
+
+
+
+
+} // namespace TUN
@@ -0,0 +1,125 @@
+// TUN_ScaleCatalog.h: Interface of the class CScaleCatalog.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// This class builds a catalog of the scale datasets in tuning files
+// (*.TUN and *.MSF), e.g. for a scale browser. Only the keys of the
+// sections [Info] and [Assignment] are read (see
+// CSingleScale::ReadInfo()); the tunings are skipped without being
+// evaluated. For each dataset, its byte range in the file is recorded,
+// so that the complete scale can be read later without scanning the
+// file again (see LoadScale()).
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_SCALECATALOG_H__01CCE9EE_FDB6_44D3_8A12_388A6BA0D3A5__INCLUDED_)
+#define AFX_TUN_SCALECATALOG_H__01CCE9EE_FDB6_44D3_8A12_388A6BA0D3A5__INCLUDED_
+
+
+
+
+
+#include <cstdint>
+#include <list>
+#include <string>
+#include <vector>
+
+#include "TUN_Error.h"
+#include "TUN_Scale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+class CScaleCatalog
+{
+public:
+	struct SEntry
+	{
+		std::string				strFilepath;
+		long					lDataSetIndex;	// Index of the dataset within the file
+
+		// Byte range of the dataset in the file and the state of the line
+		// counting at its begin (see CStringParser::InitMemoryReading())
+		std::uint64_t			ullBegin;
+		std::uint64_t			ullEnd;
+		long					lLineCount;
+		char					chEOL;
+
+		// Keys of section [Info] (see CSingleScale)
+		std::string				strName;
+		std::string				strID;
+		std::string				strFilename;
+		std::string				strAuthor;
+		std::string				strLocation;
+		std::string				strContact;
+		std::string				strDate;
+		std::string				strEditor;
+		std::string				strEditorSpecs;
+		std::string				strDescription;
+		std::list<std::string>	lstrKeywords;
+		std::string				strHistory;
+		std::string				strGeography;
+		std::string				strInstrument;
+		std::list<std::string>	lstrCompositions;
+		std::string				strComments;
+		// Key of section [Assignment] (empty = all channels)
+		std::string				strMIDIChannels;
+	};
+
+
+
+	// Error handling
+	const CErr &	Err() const { return m_err; }
+private:
+	CErr	m_err;
+public:
+
+
+
+	// Adds all datasets of the file to the catalog
+	// -1 = an error occurred (datasets before the error are added)
+	// otherwise: Number of datasets added
+	long	AddFile(const char * szFilepath);
+	// Same for a file in memory; strFilepath is stored in the entries
+	long	AddFromMemory(const char * pData, std::size_t sizeData,
+						  const std::string & strFilepath);
+	void	Clear() { m_vEntries.clear(); }
+
+	const std::vector<SEntry> &	GetEntries() const { return m_vEntries; }
+
+
+
+	// Reads the complete scale of an entry from its file.
+	// Returns the same values as CSingleScale::Read().
+	static long	LoadScale(const SEntry & entry, CSingleScale & SS);
+	// Same for a file in memory (pData = begin of the file)
+	static long	LoadScale(const SEntry & entry, CSingleScale & SS,
+						  const char * pData, std::size_t sizeData);
+
+
+
+private:
+	std::vector<SEntry>	m_vEntries;
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_SCALECATALOG_H__01CCE9EE_FDB6_44D3_8A12_388A6BA0D3A5__INCLUDED_)
@@ -0,0 +1,307 @@
+// TUN_ScalePublisher.cpp: Implementation of the classes CScaleSnapshot
+// and CScalePublisher.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+//////////////////////////////////////////////////////////////////////
+//
+// Reclamation of old snapshots (epoch based):
+//
+// m_nEpoch is incremented by each publication. A reader stores the
+// current epoch in a free reader slot *before* it loads the snapshot
+// pointer and clears the slot when it is done. The writer first replaces
+// the pointer, then retires the old snapshot together with the epoch E
+// before the increment. A reader whose slot holds an epoch > E has read
+// the epoch after the increment and thus loads the new pointer (or a
+// later one). So a retired snapshot can be freed, as soon as no slot
+// holds an epoch <= E. A reader which stored E or less, but after the
+// writer scanned its slot, also loads the new pointer.
+// Readers which found no free slot are counted in m_nOverflowReaders;
+// as long as there are any, nothing is freed.
+// All operations on the slots, m_nEpoch and m_pSnapshot are sequentially
+// consistent, which this reasoning relies on.
+//
+//////////////////////////////////////////////////////////////////////
+
+#include <cassert>
+
+#include "TUN_ScalePublisher.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CScaleSnapshot
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CScaleSnapshot::CScaleSnapshot()
+	: CScaleSnapshot(CSingleScale())
+{
+}
+
+
+
+CScaleSnapshot::CScaleSnapshot(const CSingleScale & SS)
+{
+	SS.EvaluateFormulas(); // Deferred mode: The MIDI note table is not up to date
+	const double *	pdblMIDINoteFreqHz = SS.GetMIDINoteFreqTable();
+	for ( long i = 0 ; i < NumOfMIDINotes ; ++i )
+	{
+		m_adblMIDINoteFreqHz[i] = pdblMIDINoteFreqHz[i];
+		m_adblNoteFrequenciesHz[i] = SS.GetNoteFrequenciesHz().at(i);
+		m_alMIDI2Scale[i] = SS.MapMIDI2Scale(i);
+	}
+	m_lBaseNote = SS.GetBaseNote();
+	m_dblBaseFreqHz = SS.GetBaseFreqHz();
+	m_lMappingLoopSize = SS.GetMappingLoopSize();
+}
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CScalePublisher
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+CScalePublisher::CScalePublisher()
+	: m_nNextSlot(0), m_nOverflowReaders(0), m_nEpoch(1),
+	  m_pSnapshot(new CScaleSnapshot()), m_lLoadResult(0), m_bLoading(false)
+{
+	for ( long i = 0 ; i < MaxReaderSlots ; ++i )
+		m_aReaderSlots[i].nEpoch.store(0);
+}
+
+
+
+CScalePublisher::~CScalePublisher()
+{
+	WaitForLoad();
+
+	// There must not be any reader left
+	assert(m_nOverflowReaders.load() == 0);
+	for ( std::size_t i = 0 ; i < m_vRetired.size() ; ++i )
+		delete m_vRetired[i].pSnapshot;
+	delete m_pSnapshot.load();
+}
+
+
+
+long CScalePublisher::EnterReader() const noexcept
+{
+	const std::uint64_t	nEpoch = m_nEpoch.load(std::memory_order_seq_cst);
+
+	// Different readers start at different slots to avoid contention
+	const long	lStart = static_cast<long>(
+		m_nNextSlot.fetch_add(1, std::memory_order_relaxed) % MaxReaderSlots);
+	for ( long i = 0 ; i < MaxReaderSlots ; ++i )
+	{
+		const long		lSlot = (lStart + i) % MaxReaderSlots;
+		std::uint64_t	nFree = 0;
+		if ( m_aReaderSlots[lSlot].nEpoch.compare_exchange_strong(nFree, nEpoch,
+																  std::memory_order_seq_cst) )
+			return lSlot;
+	}
+
+	// All slots in use: Block reclamation until this reader is done
+	m_nOverflowReaders.fetch_add(1, std::memory_order_seq_cst);
+	return -1;
+}
+
+
+
+void CScalePublisher::LeaveReader(long lSlot) const noexcept
+{
+	if ( lSlot < 0 )
+		m_nOverflowReaders.fetch_sub(1, std::memory_order_seq_cst);
+	else
+		m_aReaderSlots[lSlot].nEpoch.store(0, std::memory_order_seq_cst);
+}
+
+
+
+void CScalePublisher::Publish(const CSingleScale & SS)
+{
+	// Create the snapshot outside of the lock
+	const CScaleSnapshot *	pSnapshot = new CScaleSnapshot(SS);
+
+	std::lock_guard<std::mutex>	lock(m_mtxWriter);
+	PublishSnapshot(pSnapshot);
+}
+
+
+
+void CScalePublisher::LoadAsync(const std::string & strFilepath)
+{
+	std::lock_guard<std::mutex>	lockLoader(m_mtxLoader);
+	if ( m_threadLoader.joinable() )
+		m_threadLoader.join();
+	Reclaim();
+
+	m_bLoading = true;
+	try
+	{
+		m_threadLoader = std::thread([this, strFilepath]()
+		{
+			// An exception leaving the thread would terminate the process,
+			// so failures are stored like errors of Read()
+			long					lResult = -1;
+			CErr					err;
+			const CScaleSnapshot *	pSnapshot = NULL;
+			try
+			{
+				CSingleScale	SS;
+				lResult = SS.Read(strFilepath.c_str());
+				err = SS.Err();
+				if ( lResult == 1 )
+					pSnapshot = new CScaleSnapshot(SS);
+			}
+			catch ( const std::exception & e )
+			{
+				lResult = -1;
+				err.SetError(e.what());
+			}
+			catch ( ... )
+			{
+				lResult = -1;
+				err.SetError("Unknown error while loading the file.");
+			}
+
+			try
+			{
+				std::lock_guard<std::mutex>	lock(m_mtxWriter);
+				m_lLoadResult = lResult;
+				m_errLoad = err;
+				if ( pSnapshot != NULL )
+				{
+					PublishSnapshot(pSnapshot);
+					pSnapshot = NULL;
+				}
+				else
+					ReclaimLocked();
+			}
+			catch ( ... )
+			{
+				delete pSnapshot; // Not published
+			}
+			m_bLoading = false;
+		});
+	}
+	catch ( ... )
+	{
+		// The thread could not be started
+		m_bLoading = false;
+		std::lock_guard<std::mutex>	lock(m_mtxWriter);
+		m_lLoadResult = -1;
+		m_errLoad.SetError("Error starting the loader thread.");
+	}
+}
+
+
+
+long CScalePublisher::WaitForLoad()
+{
+	{
+		std::lock_guard<std::mutex>	lockLoader(m_mtxLoader);
+		if ( m_threadLoader.joinable() )
+			m_threadLoader.join();
+	}
+
+	std::lock_guard<std::mutex>	lock(m_mtxWriter);
+	ReclaimLocked();
+	return m_lLoadResult;
+}
+
+
+
+CErr CScalePublisher::GetLoadError() const
+{
+	std::lock_guard<std::mutex>	lock(m_mtxWriter);
+	return m_errLoad;
+}
+
+
+
+void CScalePublisher::Reclaim()
+{
+	std::lock_guard<std::mutex>	lock(m_mtxWriter);
+	ReclaimLocked();
+}
+
+
+
+std::size_t CScalePublisher::GetNumOfRetired() const
+{
+	std::lock_guard<std::mutex>	lock(m_mtxWriter);
+	return m_vRetired.size();
+}
+
+
+
+// m_mtxWriter must be locked
+void CScalePublisher::PublishSnapshot(const CScaleSnapshot * pSnapshot)
+{
+	// Does not throw after publishing, so the caller still owns pSnapshot
+	// in case of an exception
+	if ( m_vRetired.size() == m_vRetired.capacity() )
+		m_vRetired.reserve(2 * m_vRetired.size() + 1);
+	SRetired	retired;
+	retired.pSnapshot = m_pSnapshot.exchange(pSnapshot, std::memory_order_seq_cst);
+	retired.nEpoch = m_nEpoch.fetch_add(1, std::memory_order_seq_cst);
+	m_vRetired.push_back(retired);
+	ReclaimLocked();
+}
+
+
+
+// m_mtxWriter must be locked
+void CScalePublisher::ReclaimLocked()
+{
+	if ( m_vRetired.empty() )
+		return;
+
+	// See explanation at the top of this file
+	std::uint64_t	nOldestReader = UINT64_MAX;
+	for ( long i = 0 ; i < MaxReaderSlots ; ++i )
+	{
+		const std::uint64_t	nEpoch = m_aReaderSlots[i].nEpoch.load(std::memory_order_seq_cst);
+		if ( (nEpoch != 0) && (nEpoch < nOldestReader) )
+			nOldestReader = nEpoch;
+	}
+	if ( m_nOverflowReaders.load(std::memory_order_seq_cst) != 0 )
+		return; // Try again later
+
+	std::size_t	nKept = 0;
+	for ( std::size_t i = 0 ; i < m_vRetired.size() ; ++i )
+	{
+		if ( m_vRetired[i].nEpoch < nOldestReader )
+			delete m_vRetired[i].pSnapshot;
+		else
+			m_vRetired[nKept++] = m_vRetired[i];
+	}
+	m_vRetired.resize(nKept);
+}
+
+
+
+
+
+} // namespace TUN
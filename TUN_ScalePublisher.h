@@ -0,0 +1,254 @@
+// TUN_ScalePublisher.h: Interface of the classes CScaleSnapshot and
+// CScalePublisher.
+//
+// Part of the AnaMark Tuning Library. Not part of Mark Henning's
+// original code; distributed under the same MIT License (see
+// LICENSE.md).
+//
+// These classes allow to change the tuning while notes are playing:
+// A CScalePublisher holds an immutable CScaleSnapshot, which can be read
+// by audio threads without locks. A new scale is parsed (e.g. on a
+// background thread) and published by swapping the snapshot pointer
+// atomically. Old snapshots are freed, when no reader uses them anymore
+// (see Reclaim()).
+//
+// Usage in the audio thread:
+//
+//		CScalePublisher::CReadGuard	guard = publisher.Acquire();
+//		double	dblFreqHz = guard->GetMIDINoteFreqHz(lMIDINote);
+//
+// Usage in the GUI/loader thread:
+//
+//		publisher.LoadAsync("new_scale.tun");
+//		// or: publisher.Publish(SS);
+//
+//////////////////////////////////////////////////////////////////////
+
+#if !defined(AFX_TUN_SCALEPUBLISHER_H__FA07EF82_6963_4604_B151_4D7EB2F21756__INCLUDED_)
+#define AFX_TUN_SCALEPUBLISHER_H__FA07EF82_6963_4604_B151_4D7EB2F21756__INCLUDED_
+
+
+
+
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "TUN_Error.h"
+#include "TUN_Scale.h"
+
+
+
+
+
+namespace TUN
+{
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CScaleSnapshot
+//////////////////////////////////////////////////////////////////////
+
+// Immutable copy of the data of a CSingleScale needed for playing.
+// All read functions are real-time safe (see CSingleScale).
+class CScaleSnapshot
+{
+public:
+	static constexpr long	NumOfMIDINotes = CSingleScale::NumOfMIDINotes;
+
+	CScaleSnapshot(); // Equal tempered scale with A=440Hz
+	explicit CScaleSnapshot(const CSingleScale & SS);
+
+
+
+	double			GetMIDINoteFreqHz(long lMIDINoteNumber) const noexcept
+	{
+		return m_adblMIDINoteFreqHz[CSingleScale::ClampMIDINote(lMIDINoteNumber)];
+	}
+	bool			IsMIDINoteMuted(long lMIDINoteNumber) const noexcept
+	{
+		return !(m_adblMIDINoteFreqHz[CSingleScale::ClampMIDINote(lMIDINoteNumber)] > 0);
+	}
+	const double *	GetMIDINoteFreqTable() const noexcept { return m_adblMIDINoteFreqHz; }
+
+	// Scale note number of a MIDI note (see CSingleScale::MapMIDI2Scale())
+	long			MapMIDI2Scale(long lMIDINoteNumber) const noexcept
+	{
+		return m_alMIDI2Scale[CSingleScale::ClampMIDINote(lMIDINoteNumber)];
+	}
+	// Index = scale note number
+	const double *	GetNoteFrequenciesHz() const noexcept { return m_adblNoteFrequenciesHz; }
+
+	long			GetBaseNote() const noexcept { return m_lBaseNote; }
+	double			GetBaseFreqHz() const noexcept { return m_dblBaseFreqHz; }
+	long			GetMappingLoopSize() const noexcept { return m_lMappingLoopSize; }
+
+
+
+private:
+	alignas(64) double	m_adblMIDINoteFreqHz[NumOfMIDINotes];
+	double				m_adblNoteFrequenciesHz[NumOfMIDINotes];
+	long				m_alMIDI2Scale[NumOfMIDINotes];
+	long				m_lBaseNote;
+	double				m_dblBaseFreqHz;
+	long				m_lMappingLoopSize;
+};
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CScalePublisher
+//////////////////////////////////////////////////////////////////////
+
+class CScalePublisher
+{
+public:
+	CScalePublisher(); // Publishes the default CScaleSnapshot
+	~CScalePublisher(); // Waits for a running LoadAsync()
+
+	// Publishers are not copyable
+	CScalePublisher(const CScalePublisher &) = delete;
+	CScalePublisher & operator=(const CScalePublisher &) = delete;
+
+
+
+	// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+	// Reader side (audio threads)
+	//
+	// Acquire() and the CReadGuard never allocate, lock or throw.
+	// The snapshot stays valid as long as the guard exists, even if a new
+	// scale is published meanwhile. A guard only keeps the snapshots alive,
+	// which were replaced after it was acquired. Keep the guard only for a
+	// short time (e.g. one audio block) nevertheless.
+	// Up to MaxReaderSlots guards can exist at the same time without
+	// restriction. Beyond that, Acquire() still works, but no snapshot can
+	// be freed until those additional guards are destroyed.
+	static constexpr long	MaxReaderSlots = 64;
+
+	class CReadGuard
+	{
+	public:
+		CReadGuard(CReadGuard && other) noexcept
+			: m_pPublisher(other.m_pPublisher), m_lSlot(other.m_lSlot),
+			  m_pSnapshot(other.m_pSnapshot)
+		{
+			other.m_pPublisher = NULL;
+			other.m_pSnapshot = NULL;
+		}
+		~CReadGuard()
+		{
+			if ( m_pPublisher != NULL )
+				m_pPublisher->LeaveReader(m_lSlot);
+		}
+		CReadGuard(const CReadGuard &) = delete;
+		CReadGuard & operator=(const CReadGuard &) = delete;
+		CReadGuard & operator=(CReadGuard &&) = delete;
+
+		const CScaleSnapshot *	operator->() const noexcept { return m_pSnapshot; }
+		const CScaleSnapshot &	operator*() const noexcept { return *m_pSnapshot; }
+		const CScaleSnapshot *	Get() const noexcept { return m_pSnapshot; }
+
+	private:
+		friend class CScalePublisher;
+		CReadGuard(const CScalePublisher * pPublisher, long lSlot,
+				   const CScaleSnapshot * pSnapshot) noexcept
+			: m_pPublisher(pPublisher), m_lSlot(lSlot), m_pSnapshot(pSnapshot) {}
+
+		const CScalePublisher	* m_pPublisher;
+		long					m_lSlot; // -1 = no free reader slot was found
+		const CScaleSnapshot	* m_pSnapshot;
+	};
+
+	CReadGuard	Acquire() const noexcept
+	{
+		// Register first, so that the snapshot loaded below can not be freed
+		long	lSlot = EnterReader();
+		return CReadGuard(this, lSlot, m_pSnapshot.load(std::memory_order_seq_cst));
+	}
+
+
+
+	// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - -
+	// Writer side (not real-time safe)
+	//
+	// The writer functions may be called from any thread. They are
+	// serialized internally, but never block the readers.
+
+	// Publishes a snapshot of the scale
+	void	Publish(const CSingleScale & SS);
+
+	// Reads the tuning file on a background thread and publishes the scale,
+	// if it was read successfully. A previous LoadAsync() is waited for.
+	void	LoadAsync(const std::string & strFilepath);
+	// Waits for the end of LoadAsync() and returns its result
+	// (see CSingleScale::Read(); 1 = scale was published)
+	long	WaitForLoad();
+	bool	IsLoading() const { return m_bLoading.load(); }
+	// Error of the last LoadAsync()
+	CErr	GetLoadError() const;
+
+	// Frees old snapshots, which are no longer used by any reader.
+	// Publish(), LoadAsync() and WaitForLoad() do this automatically.
+	// Snapshots which were still read at the last of these calls stay
+	// allocated until the next one. Call Reclaim() periodically from a
+	// non real-time thread (e.g. a GUI timer) to free them earlier.
+	void	Reclaim();
+
+	// Number of replaced snapshots, which are not yet freed
+	std::size_t	GetNumOfRetired() const;
+
+
+
+private:
+	long	EnterReader() const noexcept;
+	void	LeaveReader(long lSlot) const noexcept;
+	void	PublishSnapshot(const CScaleSnapshot * pSnapshot);
+	void	ReclaimLocked();
+
+	struct SReaderSlot
+	{
+		// Epoch at which the reader entered, 0 = slot is free
+		alignas(64) std::atomic<std::uint64_t>	nEpoch;
+	};
+	struct SRetired
+	{
+		const CScaleSnapshot	* pSnapshot;
+		std::uint64_t			nEpoch; // Epoch in which it was replaced
+	};
+
+	mutable SReaderSlot						m_aReaderSlots[MaxReaderSlots];
+	mutable std::atomic<unsigned long>		m_nNextSlot; // Start of the free slot search
+	mutable std::atomic<long>				m_nOverflowReaders; // Readers without slot
+	std::atomic<std::uint64_t>				m_nEpoch;
+	std::atomic<const CScaleSnapshot *>		m_pSnapshot;
+
+	mutable std::mutex						m_mtxWriter; // Guards the next three members
+	std::vector<SRetired>					m_vRetired; // Replaced, maybe still read
+	CErr									m_errLoad;
+	long									m_lLoadResult;
+
+	std::mutex								m_mtxLoader; // Guards m_threadLoader
+	std::thread								m_threadLoader;
+	std::atomic<bool>						m_bLoading;
+};
+
+
+
+
+
+} // namespace TUN
+
+
+
+
+
+#endif // !defined(AFX_TUN_SCALEPUBLISHER_H__FA07EF82_6963_4604_B151_4D7EB2F21756__INCLUDED_)
@@ -9,6 +9,11 @@
 //
 //////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <limits>
+
 #include "TUN_StringTools.h"
 
 
@@ -69,18 +74,40 @@ std::string	GetAsLower(const std::string & str)
 	return ToLower(temp);
 }
 
+bool EqualsNoCase(std::string_view sv1, std::string_view sv2)
+{
+	if ( sv1.size() != sv2.size() )
+		return false;
+	for ( std::string_view::size_type l = 0 ; l < sv1.size() ; ++l )
+		if ( tolower(static_cast<unsigned char>(sv1[l])) != tolower(static_cast<unsigned char>(sv2[l])) )
+			return false;
+	return true;
+}
+
 
 
 std::string & Trim(std::string & str)
 {
+	// We're doing in-place conversion here:
 	std::string::size_type	posFirst = str.find_first_not_of(WhiteSpaceChars());
 	if ( posFirst == std::string::npos )
-		str = "";
+		str.clear();
 	else
-		str = str.substr(posFirst, str.find_last_not_of(WhiteSpaceChars()) - posFirst + 1);
+	{
+		str.erase(str.find_last_not_of(WhiteSpaceChars()) + 1);
+		str.erase(0, posFirst);
+	}
 	return str;
 }
 
+std::string_view Trim(std::string_view sv)
+{
+	std::string_view::size_type	posFirst = sv.find_first_not_of(WhiteSpaceChars());
+	if ( posFirst == std::string_view::npos )
+		return std::string_view();
+	return sv.substr(posFirst, sv.find_last_not_of(WhiteSpaceChars()) - posFirst + 1);
+}
+
 
 
 std::string & RemoveSpaces(std::string & str)
@@ -102,16 +129,29 @@ std::string & RemoveSpaces(std::string & str)
 	return str;
 }
 
+std::string_view RemoveSpaces(std::string_view sv, std::string & strBuffer)
+{
+	std::string_view::size_type	l = 0;
+	while ( (l < sv.size()) && !isspace(static_cast<unsigned char>(sv[l])) )
+		++l;
+	if ( l == sv.size() )
+		return sv; // Nothing to remove
+
+	strBuffer.assign(sv.data(), l);
+	for ( ; l < sv.size() ; ++l )
+		if ( !isspace(static_cast<unsigned char>(sv[l])) )
+			strBuffer += sv[l];
+	return strBuffer;
+}
 
 
-std::string & Escape(std::string & str)
-{
-	std::string	strEsc;
-	strEsc.reserve(str.size() * 2 + 1); // Avoids reallocation in most cases
 
-	for ( std::string::size_type l = 0 ; l < str.size() ; ++l )
+// Appends the escaped string to strEsc
+static void AppendEscaped(std::string & strEsc, std::string_view sv)
+{
+	for ( std::string_view::size_type l = 0 ; l < sv.size() ; ++l )
 	{
-		switch ( str.at(l) )
+		switch ( sv[l] )
 		{
 		case '\0': strEsc += "\\0"; break; // Nullbyte
 		case '\a': strEsc += "\\a"; break; // Bell (alert)
@@ -126,8 +166,8 @@ std::string & Escape(std::string & str)
 		case '\\': strEsc += "\\\\"; break; // Backslash
 		case '\?': strEsc += "\\?"; break; // Literal question mark
 		default:
-			if ( (static_cast<unsigned char>(str.at(l)) < 0x20) ||
-				 (static_cast<unsigned char>(str.at(l)) == 0xff) )
+			if ( (static_cast<unsigned char>(sv[l]) < 0x20) ||
+				 (static_cast<unsigned char>(sv[l]) == 0xff) )
 			{
 				char	szHex[3] = "00";
 				strEsc += "\\x0";
@@ -135,13 +175,22 @@ std::string & Escape(std::string & str)
 				// CHANGED:  Removed hexidecimal ltoa usage
 				// Original usage:
 				// 	 strEsc += ltoa(static_cast<unsigned char>(str.at(l)), szHex, 16);
-				sprintf(szHex, "%x", static_cast<unsigned char>(str.at(l)));
+				sprintf(szHex, "%x", static_cast<unsigned char>(sv[l]));
 				strEsc += szHex;
 			}
 			else
-				strEsc += str.at(l);
+				strEsc += sv[l];
 		}
 	}
+}
+
+
+
+std::string & Escape(std::string & str)
+{
+	std::string	strEsc;
+	strEsc.reserve(str.size() * 2 + 1); // Avoids reallocation in most cases
+	AppendEscaped(strEsc, str);
 
 	str = strEsc;
 
@@ -204,22 +253,14 @@ std::string & Unescape(std::string & str)
 
 bool Eval(const std::string & str, std::string::size_type & pos, double & dblResult)
 {
-	const char	* szBeginPtr = str.c_str() + pos;
-	char		* szEndPtr;
-	dblResult = strtod(szBeginPtr, &szEndPtr); // conversion
-	pos += szEndPtr - szBeginPtr; // points to the next char
-	return (szBeginPtr != szEndPtr); // return false if an error occurred
+	return Eval(std::string_view(str), pos, dblResult);
 }
 
 
 
 bool Eval(const std::string & str, std::string::size_type & pos, long & lResult)
 {
-	const char	* szBeginPtr = str.c_str() + pos;
-	char		* szEndPtr;
-	lResult = strtol(szBeginPtr, &szEndPtr, 10); // conversion
-	pos += szEndPtr - szBeginPtr; // points to the next char
-	return (szBeginPtr != szEndPtr); // return false if an error occurred
+	return Eval(std::string_view(str), pos, lResult);
 }
 
 
@@ -313,6 +354,195 @@ void Split(std::string & str, char chSeparator, std::list<std::string> & lstrRes
 
 
 
+//////////////////////////////////////////////////////////////////////
+// String evaluation functions without copying
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+// Numbers are converted by std::from_chars, which does not depend on the
+// locale and is thread safe. The syntax accepted is the same as the one
+// of strtod() and strtol() in the "C" locale: Leading white spaces and a
+// sign are skipped. Doubles may also be given as hex ("0x1.8p3"), "inf"
+// or "nan".
+// As with strtod() and strtol(), a result out of range is set to the
+// largest possible value or to 0, respectively.
+
+
+
+// Skips leading white spaces and a sign, returns true if the sign is '-'
+static bool SkipSpacesAndSign(const char * & pFirst, const char * pLast)
+{
+	while ( (pFirst != pLast) && isspace(static_cast<unsigned char>(*pFirst)) )
+		++pFirst;
+	if ( (pFirst != pLast) && ((*pFirst == '+') || (*pFirst == '-')) )
+		return (*pFirst++ == '-');
+	return false;
+}
+
+
+
+bool Eval(std::string_view sv, std::string_view::size_type & pos, double & dblResult)
+{
+	const char	* pBegin = sv.data() + pos;
+	const char	* pLast = sv.data() + sv.size();
+	const char	* pFirst = pBegin;
+	bool		bNegative = SkipSpacesAndSign(pFirst, pLast);
+
+	std::chars_format	fmt = std::chars_format::general;
+	if ( (pLast - pFirst > 2) && (pFirst[0] == '0') && ((pFirst[1] == 'x') || (pFirst[1] == 'X')) &&
+		 (isxdigit(static_cast<unsigned char>(pFirst[2])) || (pFirst[2] == '.')) )
+	{
+		fmt = std::chars_format::hex;
+		pFirst += 2;
+	}
+
+	std::from_chars_result	res = { pFirst, std::errc::invalid_argument };
+	if ( (pFirst != pLast) && (*pFirst != '+') && (*pFirst != '-') ) // Only one sign allowed
+		res = std::from_chars(pFirst, pLast, dblResult, fmt);
+
+	if ( res.ec == std::errc::invalid_argument )
+	{
+		dblResult = 0;
+		return false; // error: no number, pos keeps unchanged
+	}
+	if ( res.ec == std::errc::result_out_of_range )
+	{
+		// Overflow or underflow: The exponent's sign tells us which one
+		const char	* pExp = std::find_if(pFirst, res.ptr, [](char ch) { return (ch == 'e') || (ch == 'E') || (ch == 'p') || (ch == 'P'); });
+		bool		bUnderflow = (pExp != res.ptr) && (pExp + 1 != res.ptr) && (pExp[1] == '-');
+		dblResult = ( bUnderflow ? 0 : HUGE_VAL );
+	}
+	if ( bNegative )
+		dblResult = -dblResult;
+
+	pos += res.ptr - pBegin; // points to the next char
+	return true;
+}
+
+
+
+bool Eval(std::string_view sv, std::string_view::size_type & pos, long & lResult)
+{
+	const char	* pBegin = sv.data() + pos;
+	const char	* pLast = sv.data() + sv.size();
+	const char	* pFirst = pBegin;
+	bool		bNegative = SkipSpacesAndSign(pFirst, pLast);
+
+	// The digits are converted as unsigned value, so that the sign
+	// can be handled the same way for '+' and '-'
+	unsigned long			ulResult = 0;
+	std::from_chars_result	res = { pFirst, std::errc::invalid_argument };
+	if ( (pFirst != pLast) && isdigit(static_cast<unsigned char>(*pFirst)) )
+		res = std::from_chars(pFirst, pLast, ulResult, 10);
+
+	if ( res.ec == std::errc::invalid_argument )
+	{
+		lResult = 0;
+		return false; // error: no number, pos keeps unchanged
+	}
+
+	const unsigned long	ulMax = static_cast<unsigned long>(std::numeric_limits<long>::max());
+	if ( bNegative )
+		lResult = ( (res.ec == std::errc::result_out_of_range) || (ulResult > ulMax + 1) ?
+					std::numeric_limits<long>::min() :
+					static_cast<long>(0 - ulResult) );
+	else
+		lResult = ( (res.ec == std::errc::result_out_of_range) || (ulResult > ulMax) ?
+					std::numeric_limits<long>::max() :
+					static_cast<long>(ulResult) );
+
+	pos += res.ptr - pBegin; // points to the next char
+	return true;
+}
+
+
+
+bool EvalKeyAndValue(std::string_view sv, std::string_view & svKey, std::string_view & svValue)
+{
+	std::string_view::size_type	pos = sv.find('=');
+
+	if ( (pos == std::string_view::npos) || (!IsLetterOrUnderscore(sv.at(0))) )
+		return false; // error: no '=' or first char of key is invalid
+
+	svKey = Trim(sv.substr(0, pos));
+	svValue = Trim(sv.substr(pos+1));
+	return true;
+}
+
+
+
+bool EvalSection(std::string_view & sv)
+{
+	if ( (sv.size() < 2) || (sv.front() != '[') || (sv.back() != ']') )
+		return false;
+
+	sv = Trim(sv.substr(1, sv.size()-2));
+	return true;
+}
+
+
+
+bool EvalFunctionParam(std::string_view & sv)
+{
+	if ( (sv.size() < 2) || (sv.front() != '(') || (sv.back() != ')') )
+		return false;
+
+	sv = sv.substr(1, sv.size()-2);
+	return true;
+}
+
+
+
+bool EvalString(std::string_view sv, std::string_view & svResult, std::string & strBuffer)
+{
+	if ( (sv.size() < 2) || (sv.front() != '\"') || (sv.back() != '\"') )
+		return false;
+
+	svResult = sv.substr(1, sv.size()-2);
+	if ( svResult.find('\\') != std::string_view::npos )
+	{
+		// Unescaping is needed
+		strBuffer.assign(svResult.data(), svResult.size());
+		svResult = Unescape(strBuffer);
+	}
+	return true;
+}
+
+
+
+void Split(std::string_view sv, char chSeparator, std::vector<std::string_view> & vsvResult,
+		   bool bTrimItems, bool bIgnoreEmptyItems)
+{
+	// Initialize list
+	vsvResult.clear();
+
+	// Split string
+	std::string_view::size_type	posCurr = 0;
+	while ( true )
+	{
+		// Find the next separator and extract the item
+		std::string_view::size_type	posSep = sv.find(chSeparator, posCurr);
+		std::string_view	svCurr = sv.substr(posCurr, posSep == std::string_view::npos ? std::string_view::npos : posSep - posCurr);
+
+		// Process the item
+		if ( bTrimItems )
+			svCurr = Trim(svCurr);
+		if ( !(bIgnoreEmptyItems && svCurr.empty()) )
+			vsvResult.push_back(svCurr);
+
+		if ( posSep == std::string_view::npos )
+			return;
+		posCurr = posSep + 1;
+	}
+}
+
+
+
+
+
 //////////////////////////////////////////////////////////////////////
 // String construction functions
 //////////////////////////////////////////////////////////////////////
@@ -333,13 +563,19 @@ std::string ltostr(long lValue)
 
 std::string dtostr(double dblValue)
 {
-	char	sz[30]; // Enough for 64-Bit double
+	char	sz[DoubleStrSize];
+	return std::string(sz, dtostr(dblValue, sz));
+}
 
-	// TODO:  Replace function call gcvt and test, as gcvt is not standard
-	// 		Original call was _gcvt, where _gcvt was Windows only
-	//    May not be avaliable in all compilers, nor operate the same
-	// 		gcvt is avaliable in gcc v9.2.0 Homebrew
-	return std::string(gcvt(dblValue, 20, sz));
+std::size_t dtostr(double dblValue, char * sz)
+{
+	// CHANGED:  Replaced gcvt(dblValue, 20, sz) by std::to_chars.
+	// The shortest representation is written, which reads back
+	// to exactly the same double value, in the style of "%g".
+	std::to_chars_result	res = std::to_chars(sz, sz + DoubleStrSize - 1, dblValue,
+												std::chars_format::general);
+	*res.ptr = '\0';
+	return res.ptr - sz;
 }
 
 std::string	GetAsSection(const std::string & str)
@@ -355,9 +591,240 @@ std::string	GetAsString(const std::string & str)
 	return "\"" + Escape(temp) + "\"";
 }
 
+void AppendAsString(std::string & str, std::string_view sv)
+{
+	str += '\"';
+	AppendEscaped(str, sv);
+	str += '\"';
+}
+
 
 
 
 
 } // namespace strx
+
+
+
+
+
+//////////////////////////////////////////////////////////////////////
+// class CStringParser
+//////////////////////////////////////////////////////////////////////
+
+
+
+
+
+// Size of the blocks read from the stream in block buffered mode
+const std::size_t	StreamBlockSize = 65536;
+
+
+
+void CStringParser::InitStreamReading(bool bBlockBuffered /* = false */)
+{
+	m_pistr = NULL;
+	m_chEOL = '@';
+	m_lLineCount = -1;
+
+	m_bBlockBuffered = bBlockBuffered;
+	m_bEndOfData = false;
+	m_bLastLineRead = false;
+	m_sizeBlock = 0;
+	m_posBlock = 0;
+	if ( m_bBlockBuffered )
+		m_vchBlock.resize(StreamBlockSize + 1);
+	else
+		m_vchBlock.clear();
+
+	m_bMemory = false;
+	m_pMemBegin = m_pMemPos = m_pMemEnd = NULL;
+	m_svLine = std::string_view();
+	m_bLineAsStr = true;
+}
+
+
+
+void CStringParser::InitMemoryReading(const char * pData, std::size_t sizeData,
+									  long lLineCount /* = -1 */, char chEOL /* = '@' */)
+{
+	InitStreamReading();
+	m_lLineCount = lLineCount;
+	m_chEOL = chEOL;
+
+	m_bMemory = true;
+	m_pMemBegin = pData;
+	m_pMemPos = pData;
+	m_pMemEnd = pData + sizeData;
+	m_bLineAsStr = false;
+}
+
+
+
+bool CStringParser::GetLineAndTrim(long & lCurrLineCount)
+{
+	if ( m_bMemory )
+		return GetLineAndTrim_Memory(lCurrLineCount);
+	if ( m_pistr == NULL )
+	{
+		lCurrLineCount = m_lLineCount;
+		return false; // No stream attached
+	}
+	if ( m_bBlockBuffered )
+		return GetLineAndTrim_Buffered(lCurrLineCount);
+	return GetLineAndTrim_Stream(lCurrLineCount);
+}
+
+
+
+bool CStringParser::GetLineAndTrim_Stream(long & lCurrLineCount)
+{
+	std::istream	& istr = *m_pistr;
+
+	m_strLine.clear();
+	m_strLine.reserve(1000); // Should be enough in most cases
+
+	if ( !istr )
+	{
+		lCurrLineCount = m_lLineCount;
+		return false; // an error occurred or EOF
+	}
+
+	// Read from stream, until '\n', '\r', '\0' or EOF is reached
+	while ( istr )
+	{
+		char	ch = '\0';
+		istr.read(&ch, 1);
+		if ( (ch == '\0') || (ch == '\r') || (ch == '\n') )
+		{
+			CountEOL(ch, lCurrLineCount);
+			break; // Done. Line end character reached
+		}
+		else
+			m_strLine.append(1, ch);
+	}
+
+	strx::Trim(m_strLine);
+
+	return true;
+}
+
+
+
+bool CStringParser::GetLineAndTrim_Buffered(long & lCurrLineCount)
+{
+	// The line ends are the same as with byte by byte reading, including
+	// the empty line reported when the data ends with a line end character.
+	m_strLine.clear();
+
+	if ( m_bLastLineRead ||
+		 ((m_posBlock == m_sizeBlock) && !m_bEndOfData && !*m_pistr) )
+	{
+		lCurrLineCount = m_lLineCount;
+		return false; // an error occurred or EOF
+	}
+
+	while ( true )
+	{
+		if ( (m_posBlock == m_sizeBlock) && !FillBlock() )
+		{
+			// EOF counts like a '\0' line end character
+			m_bLastLineRead = true;
+			CountEOL('\0', lCurrLineCount);
+			break;
+		}
+
+		// Search for '\n', '\r' or '\0'. The sentinel behind the block
+		// data ensures that the search stops at the end of the block.
+		const char		* szBegin = &m_vchBlock[m_posBlock];
+		std::size_t		sizeLen = strcspn(szBegin, "\r\n");
+		m_strLine.append(szBegin, sizeLen);
+		m_posBlock += sizeLen;
+
+		if ( m_posBlock < m_sizeBlock )
+		{
+			CountEOL(m_vchBlock[m_posBlock++], lCurrLineCount);
+			break; // Done. Line end character reached
+		}
+	}
+
+	strx::Trim(m_strLine);
+
+	return true;
+}
+
+
+
+bool CStringParser::GetLineAndTrim_Memory(long & lCurrLineCount)
+{
+	// The line ends are the same as with stream reading, including
+	// the empty line reported when the data ends with a line end character.
+	m_svLine = std::string_view();
+	m_bLineAsStr = false;
+
+	if ( m_bLastLineRead )
+	{
+		lCurrLineCount = m_lLineCount;
+		return false; // EOF
+	}
+
+	const char	* pBegin = m_pMemPos;
+	const char	* pEOL = pBegin;
+	while ( (pEOL != m_pMemEnd) && (*pEOL != '\n') && (*pEOL != '\r') && (*pEOL != '\0') )
+		++pEOL;
+
+	if ( pEOL == m_pMemEnd )
+	{
+		// EOF counts like a '\0' line end character
+		m_bLastLineRead = true;
+		CountEOL('\0', lCurrLineCount);
+		m_pMemPos = m_pMemEnd;
+	}
+	else
+	{
+		CountEOL(*pEOL, lCurrLineCount);
+		m_pMemPos = pEOL + 1;
+	}
+
+	m_svLine = strx::Trim(std::string_view(pBegin, pEOL - pBegin));
+
+	return true;
+}
+
+
+
+bool CStringParser::FillBlock()
+{
+	m_posBlock = 0;
+	m_sizeBlock = 0;
+	if ( !m_bEndOfData && *m_pistr )
+	{
+		m_pistr->read(&m_vchBlock[0], StreamBlockSize);
+		m_sizeBlock = static_cast<std::size_t>(m_pistr->gcount());
+	}
+	m_vchBlock[m_sizeBlock] = '\0'; // Sentinel
+
+	// A short read means that there is no more data
+	if ( m_sizeBlock < StreamBlockSize )
+		m_bEndOfData = true;
+
+	return (m_sizeBlock > 0);
+}
+
+
+
+void CStringParser::CountEOL(char chEOL, long & lCurrLineCount)
+{
+	// Remember first found EOL char to trigger line count correctly
+	if ( m_chEOL == '@' )
+		m_chEOL = chEOL;
+	// Increase line count if trigger character is found
+	if ( chEOL == m_chEOL )
+		lCurrLineCount = ++m_lLineCount;
+}
+
+
+
+
+
 } // namespace TUN
@@ -21,7 +21,9 @@
 #include <cctype>
 #include <cstring>
 #include <string>
+#include <string_view>
 #include <list>
+#include <vector>
 #include <iostream>
 
 
@@ -56,11 +58,18 @@ const char * WhiteSpaceChars();
 std::string & ToLower(std::string & str);
 std::string	GetAsLower(const std::string & str);
 
+// Compare strings, ignoring the case
+bool EqualsNoCase(std::string_view sv1, std::string_view sv2);
+
 // Remove leading/trailing white spaces
 std::string & Trim(std::string & str);
+std::string_view Trim(std::string_view sv);
 
 // Remove white spaces within
+// The string_view version returns sv itself, if it contains no white
+// spaces. Otherwise, the result is built in strBuffer.
 std::string & RemoveSpaces(std::string & str);
+std::string_view RemoveSpaces(std::string_view sv, std::string & strBuffer);
 
 // Escape string according to C-like syntax, e.g. tabulator -> "\t"
 std::string & Escape(std::string & str);
@@ -78,6 +87,8 @@ std::string & Unescape(std::string & str);
 
 // Helper functions to retrieve double- and long-values from strings
 // with error checking
+// The conversion does not depend on the locale, so '.' is always the
+// decimal separator. The functions can be called from multiple threads.
 bool Eval(const std::string & str, std::string::size_type & pos, double & dblResult);
 bool Eval(const std::string & str, std::string::size_type & pos, long & lResult);
 
@@ -110,6 +121,41 @@ void Split(std::string & str, char chSeparator, std::list<std::string> & lstrRes
 
 
 
+//////////////////////////////////////////////////////////////////////
+// String evaluation functions without copying
+//////////////////////////////////////////////////////////////////////
+
+
+
+// These functions work like the ones above, but they return slices of
+// the input instead of modifying or copying it. So the results are only
+// valid as long as the input is.
+
+// The string does not need to be null terminated.
+// Locale independent and thread safe, as the std::string versions
+bool Eval(std::string_view sv, std::string_view::size_type & pos, double & dblResult);
+bool Eval(std::string_view sv, std::string_view::size_type & pos, long & lResult);
+
+// Unlike the std::string version, the key is *not* converted to lower
+// chars. Use case insensitive comparison instead.
+bool EvalKeyAndValue(std::string_view sv, std::string_view & svKey, std::string_view & svValue);
+
+// Unlike the std::string version, the section name is *not* converted to
+// lower chars. Use case insensitive comparison instead.
+bool EvalSection(std::string_view & sv);
+
+bool EvalFunctionParam(std::string_view & sv);
+
+// svResult refers to sv, if the string contains no escape sequences.
+// Otherwise, the string is unescaped into strBuffer and svResult refers
+// to strBuffer.
+bool EvalString(std::string_view sv, std::string_view & svResult, std::string & strBuffer);
+
+void Split(std::string_view sv, char chSeparator, std::vector<std::string_view> & vsvResult,
+		   bool bTrimItems, bool bIgnoreEmptyItems);
+
+
+
 //////////////////////////////////////////////////////////////////////
 // String construction functions
 //////////////////////////////////////////////////////////////////////
@@ -117,14 +163,23 @@ void Split(std::string & str, char chSeparator, std::list<std::string> & lstrRes
 
 
 // Convert double- and long-values to string
+// Doubles are written with as few digits as needed to read back the
+// identical value (independent of the locale).
 std::string ltostr(long lValue);
 std::string dtostr(double dblValue);
 
+// Same as above, but writes into a buffer of at least DoubleStrSize chars.
+// The string is null terminated, its length is returned.
+const std::size_t	DoubleStrSize = 32;
+std::size_t dtostr(double dblValue, char * sz);
+
 // Adds '[' and ']' to the begin and the end, respectively
 std::string	GetAsSection(const std::string & str);
 
 // Escapes string and adds '\"' to the begin and the end
 std::string	GetAsString(const std::string & str);
+// Same as above, but appends the result to str
+void		AppendAsString(std::string & str, std::string_view sv);
 
 
 
@@ -139,76 +194,129 @@ std::string	GetAsString(const std::string & str);
 class CStringParser
 {
 public:
-	CStringParser() {}
+	CStringParser() { InitStreamReading(); }
 	virtual ~CStringParser() {}
 
 
 
 
-	// TODO:  Migrate stream tools out of header file
 	//////////////////////////////////////////////////////////////////////
 	// Tool functions for working with streams
 	//////////////////////////////////////////////////////////////////////
 
 
 	// Call this before start reading from the stream
-	void	InitStreamReading()
-	{
-		m_chEOL = '@';
-		m_lLineCount = -1;
-	}
+	//
+	// bBlockBuffered = false: The stream is read byte by byte, so it
+	// is never read beyond the end of the current line.
+	// bBlockBuffered = true: The stream is read in large blocks. This is
+	// much faster, but the parser reads ahead of the current line. So
+	// the stream must not be read by anyone else until reading is done.
+	void	InitStreamReading(bool bBlockBuffered = false);
+
+
+	// Call this before start reading from a memory block, e.g. a
+	// memory mapped file (see CMappedFile).
+	// Lines are not copied, but referred to in the memory block, so the
+	// memory block must stay valid until reading is done.
+	// Line ends and line counting are the same as with streams.
+	// lLineCount and chEOL allow to continue the line counting of another
+	// parser, which has read the data in front of pData. Pass the values
+	// returned by its GetLineCount() and GetEOLChar().
+	void	InitMemoryReading(const char * pData, std::size_t sizeData,
+							  long lLineCount = -1, char chEOL = '@');
 
 
 	// Retrieve number of last read line or -1 if no line was read
 	// since initialization
 	long	GetLineCount() const { return m_lLineCount; }
 
+	// Line end character used for counting lines ('@' = not yet known)
+	char	GetEOLChar() const { return m_chEOL; }
+
+	// Memory reading mode: Number of bytes read so far, i.e. offset of
+	// the next line in the memory block
+	std::size_t	GetMemoryOffset() const { return m_pMemPos - m_pMemBegin; }
+
+
+	// Sets the stream which is read by GetLineAndTrim(lCurrLineCount)
+	// In memory reading mode, the stream is ignored.
+	void	AttachStream(std::istream & istr) { m_pistr = &istr; }
+
 
 	// Retrieves next line from stream and trim the result
 	bool	GetLineAndTrim(std::istream & istr, long & lCurrLineCount)
 	{
-		m_strLine = "";
-		m_strLine.reserve(1000); // Should be enough in most cases
-
-		if ( !istr )
-		{
-			lCurrLineCount = m_lLineCount;
-			return false; // an error occurred or EOF
-		}
+		AttachStream(istr);
+		return GetLineAndTrim(lCurrLineCount);
+	}
 
-		// Read from stream, until '\n', '\r', '\0' or EOF is reached
-		while ( istr )
-		{
-			char	ch = '\0';
-			istr.read(&ch, 1);
-			if ( (ch == '\0') || (ch == '\r') || (ch == '\n') )
-			{
-				// Remember first found EOL char to trigger line count correctly
-				if ( m_chEOL == '@' )
-					m_chEOL = ch;
-				// Increase line count if trigger character is found
-				if ( ch == m_chEOL )
-					lCurrLineCount = ++m_lLineCount;
-				break; // Done. Line end character reached
-			}
-			else
-				m_strLine.append(1, ch);
-		}
+	// Retrieves next line from the attached stream or the memory block
+	// and trim the result
+	bool	GetLineAndTrim(long & lCurrLineCount);
 
-		strx::Trim(m_strLine);
 
-		return true;
+	// Access to the current line
+	// view() does not copy the line. In memory reading mode, it refers
+	// directly to the memory block. str() provides the line as a
+	// modifiable string, which is only built when str() is called.
+	std::string_view view() const
+	{
+		return ( m_bMemory && !m_bLineAsStr ? m_svLine : std::string_view(m_strLine) );
+	}
+	std::string & str()
+	{
+		BuildLineStr();
+		return m_strLine;
+	}
+	const std::string & str() const
+	{
+		BuildLineStr();
+		return m_strLine;
 	}
 
+private:
+	// Memory reading mode: Copies the current line into m_strLine, if
+	// not yet done. This does not change the observable state, so it
+	// is allowed for const objects, too.
+	void	BuildLineStr() const
+	{
+		if ( m_bMemory && !m_bLineAsStr )
+		{
+			m_strLine.assign(m_svLine.data(), m_svLine.size());
+			m_bLineAsStr = true;
+		}
+	}
 
-	std::string & str() { return m_strLine; }
-	const std::string & str() const { return m_strLine; }
+private:
+	bool	GetLineAndTrim_Stream(long & lCurrLineCount);
+	bool	GetLineAndTrim_Buffered(long & lCurrLineCount);
+	bool	GetLineAndTrim_Memory(long & lCurrLineCount);
+	bool	FillBlock();
+	void	CountEOL(char chEOL, long & lCurrLineCount);
 
 	// Private variables for stream handling
 private:
-	char		m_chEOL;
-	long		m_lLineCount;
-	std::string	m_strLine;
+	std::istream	* m_pistr;
+	char			m_chEOL;
+	long			m_lLineCount;
+	mutable std::string	m_strLine; // Built lazily by str() in memory reading mode
+
+	// Private variables for block buffered stream handling
+	bool				m_bBlockBuffered;
+	bool				m_bEndOfData; // Stream returned no more data
+	bool				m_bLastLineRead; // Line at end of data was delivered
+	std::vector<char>	m_vchBlock; // Current block, followed by a '\0' sentinel
+	std::size_t			m_sizeBlock;
+	std::size_t			m_posBlock;
+
+	// Private variables for memory reading
+	bool				m_bMemory;
+	const char			* m_pMemBegin;
+	const char			* m_pMemPos;
+	const char			* m_pMemEnd;
+	std::string_view	m_svLine;
+	mutable bool		m_bLineAsStr; // m_strLine holds the current line
 }; // class CStringParser
 
 